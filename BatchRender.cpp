@@ -0,0 +1,62 @@
+#include "BatchRender.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = (size_t)ceil(p * sorted.size());
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+bool render_batch(const CpuRenderer& renderer, const CameraPath& path, const BatchOptions& options, BatchStats& stats)
+{
+    stats = {};
+    if (options.frameCount <= 0)
+        return true;
+
+    // With several frames in flight, the parallel_for calls inside render run
+    // inline, so each frame renders on the one thread that took it.
+    std::vector<double> latencies(options.frameCount);
+    std::atomic<bool> failed(false);
+    auto start = std::chrono::steady_clock::now();
+    parallel_for(0, options.frameCount, 1, [&](size_t i) {
+        auto frameStart = std::chrono::steady_clock::now();
+        int frame = options.firstFrame + (int)i;
+        Image image;
+        image.resize(options.width, options.height);
+        renderer.render(path.at(frame), image, options.mode);
+        char filename[1024];
+        snprintf(filename, sizeof(filename), "%s%04d.ppm", options.outputPrefix.c_str(), frame);
+        if (!write_ppm(image, filename))
+            failed = true;
+        latencies[i] = elapsed_ms(frameStart);
+    });
+
+    stats.frames = options.frameCount;
+    stats.seconds = elapsed_ms(start) / 1000.0;
+    stats.framesPerSecond = stats.frames / std::max(stats.seconds, 1e-9);
+    set_latency_percentiles(latencies, stats);
+    return !failed;
+}
+
+void set_latency_percentiles(std::vector<double>& latenciesMs, BatchStats& stats)
+{
+    if (latenciesMs.empty())
+        return;
+    std::sort(latenciesMs.begin(), latenciesMs.end());
+    stats.p50Ms = percentile(latenciesMs, 0.5);
+    stats.p90Ms = percentile(latenciesMs, 0.9);
+    stats.p99Ms = percentile(latenciesMs, 0.99);
+    stats.maxMs = latenciesMs.back();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "CameraPath.hpp"
+#include "CpuRenderer.hpp"
+#include <string>
+#include <vector>
+
+struct BatchOptions
+{
+    int firstFrame = 0;
+    int frameCount = 1;
+    int width = 1024;
+    int height = 768;
+    RenderMode mode = RENDER_TRACED;
+    std::string outputPrefix = "frame"; // frame n goes to <prefix>NNNN.ppm
+};
+
+struct BatchStats
+{
+    int frames = 0;
+    double seconds = 0.0;
+    double framesPerSecond = 0.0;
+    // Per-frame latency from the start of its render until its file is
+    // written, as nearest-rank percentiles.
+    double p50Ms = 0.0;
+    double p90Ms = 0.0;
+    double p99Ms = 0.0;
+    double maxMs = 0.0;
+};
+
+// Render frames [firstFrame, firstFrame + frameCount) of the path, one frame
+// per thread at a time, and write each as soon as it is done. The renderer's
+// scene and environment map are shared read-only. Returns false if a file
+// could not be written; frames already in flight still finish.
+bool render_batch(const CpuRenderer& renderer, const CameraPath& path, const BatchOptions& options, BatchStats& stats);
+
+// Fill the latency fields of stats from per-frame latencies, sorting them.
+void set_latency_percentiles(std::vector<double>& latenciesMs, BatchStats& stats);
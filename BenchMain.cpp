@@ -0,0 +1,211 @@
+#include "BvhReport.hpp"
+#include "Camera.hpp"
+#include "CompressedBvh.hpp"
+#include "CpuRenderer.hpp"
+#include "DemoScene.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Compares the BVH builders on the glass shell, times environment lookups as
+// misses do them, then times CPU renders of the drawFrame orbit. Prints one
+// line per result so runs can be diffed.
+static void usage()
+{
+    fprintf(stderr,
+        "usage: refraction-bench [options]\n"
+        "  --data <dir>    directory holding shell.obj, sphere.obj and envmap.png (default ..)\n"
+        "  --grid <n>      n x n instance grid of spheres around the shell (default 0)\n"
+        "  --size <w>x<h>  image size of the timed renders (default 640x480)\n"
+        "  --frames <n>    timed renders, spread evenly around the orbit (default 16)\n"
+        "  --json <dir>    also write bvh-<builder>.json reports there\n");
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Primary rays of the drawFrame orbit through one tree on one thread, as in
+// inspect_bvh: millions of rays per second, best of three passes, and the
+// traversal work per ray.
+template <typename Tree>
+static double trace_orbit(const Tree& tree, double& nodesPerRay, double& trianglesPerRay)
+{
+    const int orbitFrames = 16, raysPerSide = 128;
+    const double rays = (double)orbitFrames * raysPerSide * raysPerSide;
+    double best = 1e30;
+    BvhTraversalStats stats;
+    for (int pass = 0; pass < 4; pass++) {
+        // The first pass counts the work; the others are timed without it.
+        BvhTraversalStats* counting = pass == 0 ? &stats : nullptr;
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < orbitFrames; frame++) {
+            Camera camera = orbit_camera(0.01f + 6.2832f * frame / orbitFrames);
+            for (int y = 0; y < raysPerSide; y++) {
+                for (int x = 0; x < raysPerSide; x++) {
+                    Ray ray = { camera.origin, pixel_ray(camera, x, y, raysPerSide, raysPerSide), 0.0f, 1e30f };
+                    Hit hit;
+                    tree.intersect(ray, CULL_NONE, hit, counting);
+                }
+            }
+        }
+        if (pass > 0)
+            best = std::min(best, seconds_since(start));
+    }
+    nodesPerRay = stats.nodes / rays;
+    trianglesPerRay = stats.triangles / rays;
+    return rays / best * 1e-6;
+}
+
+// The lat-long lookup with the exact atan2/acos, as Miss did before the
+// polynomial versions.
+static float3 reference_lookup(const EnvMap& env, float3 dir)
+{
+    const float pi = 3.14159265f;
+    float u = (atan2f(dir.x, dir.z) / pi + 1.0f) * 0.5f;
+    float v = acosf(clamp(dir.y, -1.0f, 1.0f)) / pi;
+    int tx = std::min((int)(u * env.width), env.width - 1);
+    int ty = std::min((int)(v * env.height), env.height - 1);
+    const float* p = &env.texels[3 * (ty * env.width + tx)];
+    return { p[0], p[1], p[2] };
+}
+
+// Miss shading throughput: random directions through each lookup, best of a
+// few passes, in millions of rays per second.
+static void bench_env_lookups(EnvMap& env)
+{
+    const size_t count = 1 << 20;
+    std::vector<float3> dirs(count), colors(count);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    for (float3& dir : dirs) {
+        do
+            dir = { uniform(rng), uniform(rng), uniform(rng) };
+        while (dot(dir, dir) > 1.0f || dot(dir, dir) < 1e-4f);
+        dir = normalize(dir);
+    }
+    int cubeSize = std::max(env.height / 2, 1);
+    static volatile float sink;
+    env.bakeCubeMap(cubeSize);
+
+    auto measure = [&](const char* name, auto&& lookup) {
+        double best = 1e30;
+        for (int pass = 0; pass < 5; pass++) {
+            auto start = std::chrono::steady_clock::now();
+            lookup();
+            best = std::min(best, seconds_since(start));
+            // Keep the stores alive.
+            sink = sink + colors[pass].x;
+        }
+        printf("env %-10s %8.1f Mrays/s\n", name, count / best * 1e-6);
+    };
+    measure("reference", [&] {
+        for (size_t i = 0; i < count; i++)
+            colors[i] = reference_lookup(env, dirs[i]);
+    });
+    measure("scalar", [&] {
+        for (size_t i = 0; i < count; i++)
+            colors[i] = env.lookup(dirs[i]);
+    });
+    measure("sse2", [&] { env.lookupMany(dirs.data(), colors.data(), count); });
+    measure("cube", [&] {
+        for (size_t i = 0; i < count; i++)
+            colors[i] = env.lookupCube(dirs[i]);
+    });
+}
+
+int main(int argc, char** argv)
+{
+    const char* data = "..";
+    const char* jsonDir = nullptr;
+    unsigned grid = 0;
+    int width = 640, height = 480, frames = 16;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--data") && hasValue)
+            data = argv[++i];
+        else if (!strcmp(argv[i], "--grid") && hasValue)
+            grid = (unsigned)atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--size") && hasValue && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2)
+            i++;
+        else if (!strcmp(argv[i], "--frames") && hasValue)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--json") && hasValue)
+            jsonDir = argv[++i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (width <= 0 || height <= 0 || frames <= 0) {
+        usage();
+        return 1;
+    }
+
+    CpuDemoScene demo;
+    if (!demo.load(data, grid)) {
+        fprintf(stderr, "cannot load the scene from %s\n", data);
+        return 1;
+    }
+
+    static const struct
+    {
+        const char* name;
+        BvhBuilder builder;
+    } builders[] = { { "sah", BVH_BUILDER_SAH }, { "lbvh", BVH_BUILDER_LBVH }, { "sbvh", BVH_BUILDER_SBVH } };
+    // Each builder's tree as built, then as a CompressedBvh, whose build time
+    // is the time to compress it. Both rows take their traversal work and
+    // Mrays/s from the same trace_orbit rays.
+    printf("%-6s %-10s %10s %10s %8s %10s %10s %8s %10s %10s\n", "bvh", "layout", "build ms", "sah cost", "nodes", "nodes/ray",
+        "tris/ray", "B/node", "kbytes", "Mrays/s");
+    for (const auto& b : builders) {
+        BvhBuildOptions options;
+        options.builder = b.builder;
+        Bvh bvh;
+        bvh.build(demo.meshes[0], options);
+        BvhReport report = inspect_bvh(bvh);
+        double nodesPerRay, trianglesPerRay;
+        double mrays = trace_orbit(bvh, nodesPerRay, trianglesPerRay);
+        printf("%-6s %-10s %10.2f %10.2f %8u %10.2f %10.2f %8zu %10.1f %10.2f\n", b.name, "binary", report.buildMs, report.sahCost,
+            report.nodeCount, nodesPerRay, trianglesPerRay, sizeof(BvhNode), report.memoryBytes / 1024.0, mrays);
+
+        auto start = std::chrono::steady_clock::now();
+        CompressedBvh compressed;
+        compressed.build(bvh);
+        double compressMs = seconds_since(start) * 1e3;
+        mrays = trace_orbit(compressed, nodesPerRay, trianglesPerRay);
+        printf("%-6s %-10s %10.2f %10s %8zu %10.2f %10.2f %8zu %10.1f %10.2f\n", b.name, "compressed", compressMs, "-",
+            compressed.nodes.size(), nodesPerRay, trianglesPerRay, sizeof(CompressedNode), compressed.memoryBytes() / 1024.0, mrays);
+        if (jsonDir && !write_json(report, (std::string(jsonDir) + "/bvh-" + b.name + ".json").c_str())) {
+            fprintf(stderr, "cannot write the %s report to %s\n", b.name, jsonDir);
+            return 1;
+        }
+    }
+
+    bench_env_lookups(demo.envMap);
+
+    CpuRenderer renderer;
+    renderer.scene = &demo.scene;
+    renderer.envMap = &demo.envMap;
+    Image image;
+    image.resize(width, height);
+    for (RenderMode mode : { RENDER_TRACED, RENDER_HYBRID }) {
+        double primaryMs = 0.0, shadeMs = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+            RenderStats stats = renderer.render(orbit_camera(0.01f + 6.2832f * frame / frames), image, mode);
+            primaryMs += stats.primaryMs;
+            shadeMs += stats.shadeMs;
+        }
+        printf("render %-6s %dx%d: primary %.1f ms, shade %.1f ms, frame %.1f ms\n", mode == RENDER_TRACED ? "traced" : "hybrid",
+            width, height, primaryMs / frames, shadeMs / frames, (primaryMs + shadeMs) / frames);
+    }
+    return 0;
+}
@@ -0,0 +1,497 @@
+#include "Bvh.hpp"
+#include "Hash.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <numeric>
+#include <stdio.h>
+#include <string>
+
+constexpr float INF = 1e30f;
+constexpr int maxStackDepth = 128;
+constexpr char bvhMagic[4] = { 'R', 'B', 'V', 'H' };
+// Bump when the builder changes the trees it produces for the same input.
+constexpr uint32_t bvhVersion = 2;
+
+bool intersect_triangle(const Ray& ray, float3 v0, float3 v1, float3 v2, RayCull cull, float& t, float& u, float& v)
+{
+    // Moller-Trumbore. det > 0 exactly when the triangle winds clockwise seen
+    // along the ray, i.e. is front facing by the DXR convention.
+    float3 e1 = v1 - v0;
+    float3 e2 = v2 - v0;
+    float3 p = cross(ray.dir, e2);
+    float det = dot(e1, p);
+    if (fabsf(det) < 1e-12f)
+        return false;
+    if ((cull == CULL_BACK_FACING && det < 0.0f) || (cull == CULL_FRONT_FACING && det > 0.0f))
+        return false;
+
+    float invDet = 1.0f / det;
+    float3 s = ray.origin - v0;
+    u = dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+    float3 q = cross(s, e1);
+    v = dot(ray.dir, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+    t = dot(e2, q) * invDet;
+    return t > ray.tmin && t < ray.tmax;
+}
+
+namespace {
+
+struct Bin
+{
+    float3 bmin = { INF, INF, INF };
+    float3 bmax = { -INF, -INF, -INF };
+    uint32_t count = 0;
+};
+
+} // namespace
+
+static void build_sah_nodes(uint32_t count, const float3* primMin, const float3* primMax, const float3* centroids,
+    const BvhBuildOptions& options, std::vector<BvhNode>& nodes, std::vector<uint32_t>& primIndices)
+{
+    nodes.clear();
+    primIndices.resize(count);
+    std::iota(primIndices.begin(), primIndices.end(), 0);
+    if (count == 0)
+        return;
+
+    auto updateBounds = [&](BvhNode& node) {
+        node.bmin = { INF, INF, INF };
+        node.bmax = { -INF, -INF, -INF };
+        for (uint32_t i = 0; i < node.count; i++) {
+            uint32_t prim = primIndices[node.leftFirst + i];
+            node.bmin = min(node.bmin, primMin[prim]);
+            node.bmax = max(node.bmax, primMax[prim]);
+        }
+    };
+
+    nodes.reserve(2 * count);
+    BvhNode root = {};
+    root.leftFirst = 0;
+    root.count = count;
+    updateBounds(root);
+    nodes.push_back(root);
+
+    int binCount = std::max(options.binCount, 2);
+    std::vector<Bin> bins(binCount);
+    std::vector<float> leftArea(binCount), rightArea(binCount);
+    std::vector<uint32_t> leftCount(binCount), rightCount(binCount);
+
+    std::vector<uint32_t> stack = { 0 };
+    while (!stack.empty()) {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        BvhNode node = nodes[index];
+        if (node.count <= 1)
+            continue;
+
+        float3 cmin = { INF, INF, INF }, cmax = { -INF, -INF, -INF };
+        for (uint32_t i = 0; i < node.count; i++) {
+            float3 c = centroids[primIndices[node.leftFirst + i]];
+            cmin = min(cmin, c);
+            cmax = max(cmax, c);
+        }
+
+        // Evaluate every bin boundary on every axis.
+        float bestCost = INF;
+        int bestAxis = -1, bestPlane = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            float lo = component(cmin, axis), extent = component(cmax, axis) - lo;
+            if (extent <= 0.0f)
+                continue;
+            float scale = binCount / extent;
+            std::fill(bins.begin(), bins.end(), Bin());
+            for (uint32_t i = 0; i < node.count; i++) {
+                uint32_t prim = primIndices[node.leftFirst + i];
+                int b = std::min(binCount - 1, (int)((component(centroids[prim], axis) - lo) * scale));
+                bins[b].count++;
+                bins[b].bmin = min(bins[b].bmin, primMin[prim]);
+                bins[b].bmax = max(bins[b].bmax, primMax[prim]);
+            }
+
+            Bin left, right;
+            for (int i = 0; i < binCount - 1; i++) {
+                left.count += bins[i].count;
+                left.bmin = min(left.bmin, bins[i].bmin);
+                left.bmax = max(left.bmax, bins[i].bmax);
+                leftCount[i] = left.count;
+                leftArea[i] = left.count ? surface_area(left.bmin, left.bmax) : 0.0f;
+
+                int j = binCount - 1 - i;
+                right.count += bins[j].count;
+                right.bmin = min(right.bmin, bins[j].bmin);
+                right.bmax = max(right.bmax, bins[j].bmax);
+                rightCount[j - 1] = right.count;
+                rightArea[j - 1] = right.count ? surface_area(right.bmin, right.bmax) : 0.0f;
+            }
+            for (int i = 0; i < binCount - 1; i++) {
+                if (leftCount[i] == 0 || rightCount[i] == 0)
+                    continue;
+                float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestPlane = i;
+                }
+            }
+        }
+
+        // Stop when splitting costs more than testing every triangle, unless the
+        // leaf would be too big. Identical centroids leave no split at all.
+        float splitCost = options.traversalCost + bestCost / surface_area(node.bmin, node.bmax);
+        if (bestAxis < 0 || (splitCost >= node.count && node.count <= (uint32_t)options.maxLeafSize))
+            continue;
+
+        float lo = component(cmin, bestAxis);
+        float scale = binCount / (component(cmax, bestAxis) - lo);
+        uint32_t* first = &primIndices[node.leftFirst];
+        uint32_t* middle = std::partition(first, first + node.count, [&](uint32_t prim) {
+            return std::min(binCount - 1, (int)((component(centroids[prim], bestAxis) - lo) * scale)) <= bestPlane;
+        });
+
+        BvhNode left = {}, right = {};
+        left.leftFirst = node.leftFirst;
+        left.count = (uint32_t)(middle - first);
+        right.leftFirst = left.leftFirst + left.count;
+        right.count = node.count - left.count;
+        updateBounds(left);
+        updateBounds(right);
+
+        uint32_t leftIndex = (uint32_t)nodes.size();
+        nodes.push_back(left);
+        nodes.push_back(right);
+        nodes[index].leftFirst = leftIndex;
+        nodes[index].count = 0;
+        stack.push_back(leftIndex + 1);
+        stack.push_back(leftIndex);
+    }
+
+}
+
+void build_bvh_nodes(uint32_t count, const float3* primMin, const float3* primMax, const float3* centroids,
+    const BvhBuildOptions& options, std::vector<BvhNode>& nodes, std::vector<uint32_t>& primIndices)
+{
+    if (options.builder == BVH_BUILDER_LBVH)
+        build_lbvh_nodes(count, primMin, primMax, centroids, options, nodes, primIndices);
+    else
+        build_sah_nodes(count, primMin, primMax, centroids, options, nodes, primIndices);
+}
+
+void Bvh::build(const Mesh& mesh_, const BvhBuildOptions& options)
+{
+    auto start = std::chrono::steady_clock::now();
+    file.close();
+    mesh = &mesh_;
+    triCount = (uint32_t)(mesh->indices.size() / 3);
+    if (options.builder == BVH_BUILDER_SBVH) {
+        build_sbvh_nodes(*mesh, options, nodeStorage, triIndexStorage);
+    } else {
+        std::vector<float3> centroids(triCount), triMin(triCount), triMax(triCount);
+        parallel_for(0, triCount, 4096, [&](size_t i) {
+            float3 a = vertex_position(*mesh, (uint32_t)i, 0);
+            float3 b = vertex_position(*mesh, (uint32_t)i, 1);
+            float3 c = vertex_position(*mesh, (uint32_t)i, 2);
+            triMin[i] = min(min(a, b), c);
+            triMax[i] = max(max(a, b), c);
+            centroids[i] = (a + b + c) * (1.0f / 3.0f);
+        });
+        build_bvh_nodes(triCount, triMin.data(), triMax.data(), centroids.data(), options, nodeStorage, triIndexStorage);
+    }
+
+    nodes = nodeStorage.empty() ? nullptr : nodeStorage.data();
+    nodeCount = (uint32_t)nodeStorage.size();
+    triIndices = triIndexStorage.data();
+    triIndexCount = (uint32_t)triIndexStorage.size();
+    depth = bvh_depth(nodes, nodeCount);
+    if (options.treeletIterations > 0)
+        optimize(options.treeletSize, options.treeletIterations, options.traversalCost);
+    buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Bvh::detach()
+{
+    if (!file.data)
+        return;
+    nodeStorage.assign(nodes, nodes + nodeCount);
+    triIndexStorage.assign(triIndices, triIndices + triIndexCount);
+    nodes = nodeStorage.data();
+    triIndices = triIndexStorage.data();
+    file.close();
+}
+
+void bvh_levels(const BvhNode* nodes, uint32_t nodeCount, std::vector<uint32_t>& order, std::vector<size_t>& levelStart)
+{
+    order.assign(1, 0);
+    levelStart.assign(1, 0);
+    order.reserve(nodeCount);
+    for (size_t first = 0; first < order.size();) {
+        size_t last = order.size();
+        for (size_t i = first; i < last; i++) {
+            const BvhNode& node = nodes[order[i]];
+            if (node.count == 0) {
+                order.push_back(node.leftFirst);
+                order.push_back(node.leftFirst + 1);
+            }
+        }
+        levelStart.push_back(last);
+        first = last;
+    }
+}
+
+uint32_t bvh_depth(const BvhNode* nodes, uint32_t nodeCount)
+{
+    if (nodeCount == 0)
+        return 0;
+    std::vector<uint32_t> order;
+    std::vector<size_t> levelStart;
+    bvh_levels(nodes, nodeCount, order, levelStart);
+    return (uint32_t)levelStart.size() - 2;
+}
+
+bool valid_bvh_nodes(const BvhNode* nodes, uint32_t nodeCount, uint32_t triIndexCount)
+{
+    if (nodeCount == 0)
+        return true;
+    std::vector<uint8_t> reached(nodeCount, 0);
+    std::vector<uint32_t> stack = { 0 };
+    reached[0] = 1;
+    while (!stack.empty()) {
+        const BvhNode& node = nodes[stack.back()];
+        stack.pop_back();
+        if (node.count) {
+            if (node.leftFirst > triIndexCount || node.count > triIndexCount - node.leftFirst)
+                return false;
+            continue;
+        }
+        if (node.leftFirst == 0 || node.leftFirst >= nodeCount - 1)
+            return false;
+        for (uint32_t child = node.leftFirst; child <= node.leftFirst + 1; child++) {
+            if (reached[child])
+                return false;
+            reached[child] = 1;
+            stack.push_back(child);
+        }
+    }
+    return true;
+}
+
+void Bvh::refit()
+{
+    if (nodeCount == 0)
+        return;
+    detach();
+
+    // A node's children are always one level below it, so once a level is
+    // done every parent above it can be finished.
+    std::vector<uint32_t> order;
+    std::vector<size_t> levelStart;
+    bvh_levels(nodes, nodeCount, order, levelStart);
+
+    for (size_t level = levelStart.size() - 1; level-- > 0;) {
+        parallel_for(levelStart[level], levelStart[level + 1], 1024, [&](size_t i) {
+            BvhNode& node = nodeStorage[order[i]];
+            if (node.count == 0) {
+                const BvhNode& left = nodeStorage[node.leftFirst];
+                const BvhNode& right = nodeStorage[node.leftFirst + 1];
+                node.bmin = min(left.bmin, right.bmin);
+                node.bmax = max(left.bmax, right.bmax);
+                return;
+            }
+            node.bmin = { INF, INF, INF };
+            node.bmax = { -INF, -INF, -INF };
+            for (uint32_t j = 0; j < node.count; j++) {
+                uint32_t prim = triIndexStorage[node.leftFirst + j];
+                for (int k = 0; k < 3; k++) {
+                    float3 p = vertex_position(*mesh, prim, k);
+                    node.bmin = min(node.bmin, p);
+                    node.bmax = max(node.bmax, p);
+                }
+            }
+        });
+    }
+}
+
+float Bvh::sahCost(float traversalCost) const
+{
+    if (nodeCount == 0)
+        return 0.0f;
+    double cost = 0.0;
+    for (uint32_t i = 0; i < nodeCount; i++) {
+        float area = surface_area(nodes[i].bmin, nodes[i].bmax);
+        cost += area * (nodes[i].count ? (double)nodes[i].count : traversalCost);
+    }
+    return (float)(cost / surface_area(nodes[0].bmin, nodes[0].bmax));
+}
+
+BvhUpdateKind BvhUpdatePolicy::update(Bvh& bvh, const BvhBuildOptions& options)
+{
+    if (builtCost > 0.0f) {
+        bvh.refit();
+        currentCost = bvh.sahCost(options.traversalCost);
+        if (currentCost <= rebuildThreshold * builtCost)
+            return BVH_REFIT;
+    }
+    bvh.build(*bvh.mesh, options);
+    builtCost = currentCost = bvh.sahCost(options.traversalCost);
+    return BVH_REBUILD;
+}
+
+uint64_t hash_mesh(const Mesh& mesh)
+{
+    uint64_t h = hash_bytes(mesh.verts.data(), mesh.verts.size() * sizeof(Vertex));
+    return hash_bytes(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t), h);
+}
+
+uint64_t hash_build_options(const BvhBuildOptions& options)
+{
+    return hash_bytes(&options, sizeof(options), bvhVersion);
+}
+
+bool Bvh::save(const char* filename, uint64_t meshHash, uint64_t optionsHash) const
+{
+    BvhFileHeader header = {};
+    memcpy(header.magic, bvhMagic, sizeof(bvhMagic));
+    header.version = bvhVersion;
+    header.nodeCount = nodeCount;
+    header.triCount = triCount;
+    header.triIndexCount = triIndexCount;
+    header.meshHash = meshHash;
+    header.optionsHash = optionsHash;
+
+    // Write to a temporary name first so a crash never leaves a truncated file behind.
+    std::string tempFilename = std::string(filename) + ".tmp";
+    std::ofstream os(tempFilename, std::ios_base::binary);
+    os.write((const char*)&header, sizeof(header));
+    os.write((const char*)nodes, (size_t)nodeCount * sizeof(BvhNode));
+    os.write((const char*)triIndices, (size_t)triIndexCount * sizeof(uint32_t));
+    os.close();
+    if (!os) {
+        remove(tempFilename.c_str());
+        return false;
+    }
+    remove(filename);
+    return rename(tempFilename.c_str(), filename) == 0;
+}
+
+static bool valid_bvh_file(const MappedFile& file, uint32_t triCount, uint64_t meshHash, uint64_t optionsHash)
+{
+    if (file.size < sizeof(BvhFileHeader))
+        return false;
+    const BvhFileHeader& header = *(const BvhFileHeader*)file.data;
+    if (memcmp(header.magic, bvhMagic, sizeof(bvhMagic)) != 0 || header.version != bvhVersion
+        || header.triCount != triCount || header.meshHash != meshHash || header.optionsHash != optionsHash)
+        return false;
+    if ((header.nodeCount == 0) != (triCount == 0) || header.triIndexCount < triCount)
+        return false;
+    if (file.size != sizeof(header) + (uint64_t)header.nodeCount * sizeof(BvhNode) + (uint64_t)header.triIndexCount * sizeof(uint32_t))
+        return false;
+
+    // Traversal follows these indices without checking them.
+    const BvhNode* nodes = (const BvhNode*)(&header + 1);
+    const uint32_t* triIndices = (const uint32_t*)(nodes + header.nodeCount);
+    for (uint32_t i = 0; i < header.triIndexCount; i++) {
+        if (triIndices[i] >= triCount)
+            return false;
+    }
+    return valid_bvh_nodes(nodes, header.nodeCount, header.triIndexCount);
+}
+
+bool Bvh::open(const char* meshFilename, const Mesh& mesh_, const BvhBuildOptions& options)
+{
+    std::string cacheFilename = std::string(meshFilename) + ".bvh";
+    uint64_t meshHash = hash_mesh(mesh_);
+    uint64_t optionsHash = hash_build_options(options);
+    uint32_t meshTriCount = (uint32_t)(mesh_.indices.size() / 3);
+
+    if (!file.open(cacheFilename.c_str()) || !valid_bvh_file(file, meshTriCount, meshHash, optionsHash)) {
+        build(mesh_, options);
+        if (!save(cacheFilename.c_str(), meshHash, optionsHash)
+            || !file.open(cacheFilename.c_str()) || !valid_bvh_file(file, meshTriCount, meshHash, optionsHash)) {
+            file.close();
+            return false;
+        }
+    }
+
+    // Point into the mapping; pages are only read in as traversal touches them.
+    const BvhFileHeader& header = *(const BvhFileHeader*)file.data;
+    mesh = &mesh_;
+    nodeCount = header.nodeCount;
+    triCount = header.triCount;
+    triIndexCount = header.triIndexCount;
+    nodes = (const BvhNode*)(&header + 1);
+    triIndices = (const uint32_t*)(nodes + nodeCount);
+    depth = bvh_depth(nodes, nodeCount);
+    nodeStorage = std::vector<BvhNode>();
+    triIndexStorage = std::vector<uint32_t>();
+    return true;
+}
+
+bool Bvh::intersect(const Ray& ray_, RayCull cull, Hit& hit, BvhTraversalStats* stats) const
+{
+    if (nodeCount == 0)
+        return false;
+
+    Ray ray = ray_;
+    float3 invDir = { 1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z };
+    if (intersect_aabb(ray, invDir, nodes[0]) == INF)
+        return false;
+
+    // Near child first, so at most one entry per level is waiting. Trees
+    // deeper than the fixed stack get one on the heap.
+    bool found = false;
+    uint32_t localStack[maxStackDepth];
+    std::vector<uint32_t> heapStack;
+    uint32_t* stack = localStack;
+    if (depth > (uint32_t)maxStackDepth) {
+        heapStack.resize(depth);
+        stack = heapStack.data();
+    }
+    int sp = 0;
+    const BvhNode* node = &nodes[0];
+    for (;;) {
+        if (stats) {
+            stats->nodes++;
+            stats->triangles += node->count;
+        }
+        if (node->count) {
+            for (uint32_t i = 0; i < node->count; i++) {
+                uint32_t prim = triIndices[node->leftFirst + i];
+                float t, u, v;
+                if (intersect_triangle(ray, vertex_position(*mesh, prim, 0), vertex_position(*mesh, prim, 1),
+                        vertex_position(*mesh, prim, 2), cull, t, u, v)) {
+                    ray.tmax = t;
+                    hit = { t, u, v, prim };
+                    found = true;
+                }
+            }
+            if (sp == 0)
+                break;
+            node = &nodes[stack[--sp]];
+            continue;
+        }
+
+        uint32_t c0 = node->leftFirst, c1 = c0 + 1;
+        float d0 = intersect_aabb(ray, invDir, nodes[c0]);
+        float d1 = intersect_aabb(ray, invDir, nodes[c1]);
+        if (d0 > d1) {
+            std::swap(d0, d1);
+            std::swap(c0, c1);
+        }
+        if (d0 == INF) {
+            if (sp == 0)
+                break;
+            node = &nodes[stack[--sp]];
+        } else {
+            node = &nodes[c0];
+            if (d1 != INF)
+                stack[sp++] = c1;
+        }
+    }
+    return found;
+}
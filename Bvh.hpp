@@ -0,0 +1,223 @@
+#pragma once
+
+#include "MappedFile.hpp"
+#include "Math.hpp"
+#include "Mesh.hpp"
+#include <stdint.h>
+#include <vector>
+
+struct Ray
+{
+    float3 origin;
+    float3 dir;
+    float tmin;
+    float tmax;
+};
+
+// Mirrors the RAY_FLAG_CULL_* flags the shaders pass to TraceRay. As in DXR,
+// a triangle is front facing when it winds clockwise seen from the ray origin.
+enum RayCull
+{
+    CULL_NONE,
+    CULL_BACK_FACING,
+    CULL_FRONT_FACING,
+};
+
+struct Hit
+{
+    float t;
+    float u, v; // weights of vertices 1 and 2, like BuiltInTriangleIntersectionAttributes
+    uint32_t prim;
+};
+
+enum BvhBuilder
+{
+    BVH_BUILDER_SAH,  // binned SAH: slower to build, cheaper to traverse
+    BVH_BUILDER_LBVH, // Morton-ordered linear BVH: builds in a fraction of the time
+    BVH_BUILDER_SBVH, // SAH with spatial splits: slowest build, fewest node visits on sliver triangles
+};
+
+struct BvhBuildOptions
+{
+    int maxLeafSize = 4;
+    int binCount = 16;
+    float traversalCost = 1.0f; // relative to one triangle test
+    BvhBuilder builder = BVH_BUILDER_SAH;
+    int mortonBits = 30;        // LBVH key length: 30 or 63
+    float splitBudget = 0.3f;   // SBVH: extra triangle references allowed, as a fraction of the triangles
+    float splitAlpha = 1e-5f;   // SBVH: try spatial splits once child overlap exceeds this fraction of the root area
+    int treeletIterations = 0;  // Bvh::optimize iterations run after building, 0 for none
+    int treeletSize = 7;        // subtrees per treelet in those iterations
+};
+
+struct BvhNode
+{
+    float3 bmin;
+    uint32_t leftFirst; // first child (the second follows it) or first triangle
+    float3 bmax;
+    uint32_t count;     // triangles in a leaf, 0 for interior nodes
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode is stored in cache files");
+
+// Work done by one or more intersect() calls.
+struct BvhTraversalStats
+{
+    uint64_t nodes = 0;     // nodes entered
+    uint64_t triangles = 0; // triangle tests
+};
+
+// Header of a BVH cache file. The node array follows, then triIndices.
+struct BvhFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t triCount;
+    uint32_t triIndexCount;
+    uint64_t meshHash;    // verts and indices
+    uint64_t optionsHash; // BvhBuildOptions
+};
+
+// Bounding volume hierarchy over a Mesh's triangles, built with binned SAH or
+// as an LBVH, as the build options choose.
+// Nodes refer to each other by index only, so the arrays are position
+// independent and can be used straight from a mapped cache file.
+struct Bvh
+{
+    void build(const Mesh& mesh, const BvhBuildOptions& options = {});
+    bool intersect(const Ray& ray, RayCull cull, Hit& hit, BvhTraversalStats* stats = nullptr) const;
+
+    // Map the cache saved next to the mesh as "<meshFilename>.bvh", or build
+    // and save it when it is missing, damaged, or was made from different
+    // mesh data or build options. Fails only if building succeeded but the
+    // result could not be saved or mapped, in which case the built tree is kept.
+    bool open(const char* meshFilename, const Mesh& mesh, const BvhBuildOptions& options = {});
+    bool save(const char* filename, uint64_t meshHash, uint64_t optionsHash) const;
+
+    // Recompute every node's bounds from the mesh's current vertex positions,
+    // keeping the topology. Levels are processed deepest first, each in
+    // parallel. A tree mapped from a cache file is copied into storage first.
+    // Leaves of a spatial-split tree grow back to whole-triangle bounds.
+    void refit();
+    // Treelet restructuring (Karras and Aila 2013): every interior node with
+    // enough triangles below it has its treelet of up to treeletSize subtrees
+    // rearranged into the topology of least SAH cost. Nodes of one depth are
+    // independent, so each depth is done in parallel, deepest first. Each
+    // further iteration only revisits nodes with twice as many triangles.
+    void optimize(int treeletSize = 7, int iterations = 3, float traversalCost = 1.0f);
+    // Copy a tree mapped from a cache file into storage so it can be changed.
+    void detach();
+    // Expected cost of a random ray, in triangle tests, by the surface area
+    // heuristic. Refitting a deforming mesh makes this grow.
+    float sahCost(float traversalCost = 1.0f) const;
+
+    const Mesh* mesh = nullptr;
+    double buildMs = 0.0; // time spent in the last build()
+    const BvhNode* nodes = nullptr;
+    uint32_t nodeCount = 0;
+    const uint32_t* triIndices = nullptr;
+    uint32_t triIndexCount = 0; // exceeds triCount when spatial splits put a triangle in several leaves
+    uint32_t triCount = 0;
+    uint32_t depth = 0; // of the deepest leaf, the root being depth 0; sizes the traversal stack
+
+    // Backing memory for the arrays above: vectors after build(), the file
+    // after a successful open().
+    std::vector<BvhNode> nodeStorage;
+    std::vector<uint32_t> triIndexStorage;
+    MappedFile file;
+};
+
+enum BvhUpdateKind
+{
+    BVH_REFIT,
+    BVH_REBUILD,
+};
+
+// Keeps a Bvh current for a mesh whose vertices move every frame. Refitting
+// is cheap but the tree degrades as triangles drift, so once the SAH cost
+// exceeds rebuildThreshold times the cost right after the last full build,
+// the tree is rebuilt. The result also tells the GPU side whether to do a
+// PERFORM_UPDATE of its acceleration structure or a full build.
+struct BvhUpdatePolicy
+{
+    BvhUpdateKind update(Bvh& bvh, const BvhBuildOptions& options = {});
+
+    float rebuildThreshold = 1.3f;
+    float builtCost = 0.0f;   // 0 until the first update, which always rebuilds
+    float currentCost = 0.0f;
+};
+
+// Build over arbitrary primitives given by their bounds and centroids, with
+// the builder the options select. primIndices receives the leaf order. Shared
+// by Bvh and the top level of Scene. Spatial splits need the triangles
+// themselves, so BVH_BUILDER_SBVH falls back to plain SAH here.
+void build_bvh_nodes(uint32_t count, const float3* primMin, const float3* primMax, const float3* centroids,
+    const BvhBuildOptions& options, std::vector<BvhNode>& nodes, std::vector<uint32_t>& primIndices);
+void build_lbvh_nodes(uint32_t count, const float3* primMin, const float3* primMax, const float3* centroids,
+    const BvhBuildOptions& options, std::vector<BvhNode>& nodes, std::vector<uint32_t>& primIndices);
+// Spatial-split build over the mesh's triangles. Straddling triangles are
+// clipped into both children, so primIndices can name a triangle more than once.
+void build_sbvh_nodes(const Mesh& mesh, const BvhBuildOptions& options, std::vector<BvhNode>& nodes,
+    std::vector<uint32_t>& primIndices);
+
+// Node indices grouped by depth, root first: level i is
+// order[levelStart[i]..levelStart[i + 1]).
+void bvh_levels(const BvhNode* nodes, uint32_t nodeCount, std::vector<uint32_t>& order, std::vector<size_t>& levelStart);
+// Depth of the deepest leaf, the root being depth 0.
+uint32_t bvh_depth(const BvhNode* nodes, uint32_t nodeCount);
+// Whether nodes form a tree of interior nodes and leaves that only refer to
+// nodes and triangle indices that exist, with every node reached once.
+bool valid_bvh_nodes(const BvhNode* nodes, uint32_t nodeCount, uint32_t triIndexCount);
+
+// Stable parallel LSD radix sort of keys, carrying values along. Only the low
+// keyBits bits of each key are sorted on.
+void radix_sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int keyBits);
+
+uint64_t hash_mesh(const Mesh& mesh);
+uint64_t hash_build_options(const BvhBuildOptions& options);
+
+inline float3 vertex_position(const Mesh& mesh, uint32_t prim, int corner)
+{
+    const float* p = mesh.verts[mesh.indices[3 * prim + corner]].position;
+    return { p[0], p[1], p[2] };
+}
+
+inline float3 vertex_normal(const Mesh& mesh, uint32_t prim, int corner)
+{
+    const float* n = mesh.verts[mesh.indices[3 * prim + corner]].norm;
+    return { n[0], n[1], n[2] };
+}
+
+// Interpolated vertex normal at a hit, as SurfaceNormal in RayTracing.hlsl.
+inline float3 surface_normal(const Mesh& mesh, uint32_t prim, float u, float v)
+{
+    float3 A = vertex_normal(mesh, prim, 0);
+    float3 B = vertex_normal(mesh, prim, 1);
+    float3 C = vertex_normal(mesh, prim, 2);
+    return normalize(A + u * (B - A) + v * (C - A));
+}
+
+inline float surface_area(float3 bmin, float3 bmax)
+{
+    float3 e = bmax - bmin;
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+// Distance at which the ray enters the box, or 1e30f if it misses it within
+// [tmin, tmax].
+inline float intersect_aabb(const Ray& ray, float3 invDir, float3 bmin, float3 bmax)
+{
+    float tx1 = (bmin.x - ray.origin.x) * invDir.x, tx2 = (bmax.x - ray.origin.x) * invDir.x;
+    float ty1 = (bmin.y - ray.origin.y) * invDir.y, ty2 = (bmax.y - ray.origin.y) * invDir.y;
+    float tz1 = (bmin.z - ray.origin.z) * invDir.z, tz2 = (bmax.z - ray.origin.z) * invDir.z;
+    float tnear = fmaxf(fmaxf(fminf(tx1, tx2), fminf(ty1, ty2)), fminf(tz1, tz2));
+    float tfar = fminf(fminf(fmaxf(tx1, tx2), fmaxf(ty1, ty2)), fmaxf(tz1, tz2));
+    return tfar >= tnear && tfar > ray.tmin && tnear < ray.tmax ? tnear : 1e30f;
+}
+
+inline float intersect_aabb(const Ray& ray, float3 invDir, const BvhNode& node)
+{
+    return intersect_aabb(ray, invDir, node.bmin, node.bmax);
+}
+
+bool intersect_triangle(const Ray& ray, float3 v0, float3 v1, float3 v2, RayCull cull, float& t, float& u, float& v);
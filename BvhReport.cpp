@@ -0,0 +1,151 @@
+#include "BvhReport.hpp"
+#include "Camera.hpp"
+#include "CompressedBvh.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+static float volume(float3 bmin, float3 bmax)
+{
+    float3 e = max(bmax - bmin, { 0.0f, 0.0f, 0.0f });
+    return e.x * e.y * e.z;
+}
+
+// JSON has no NaN or infinity; a degenerate tree's SAH cost can be either.
+static std::string json_number(double v)
+{
+    if (!std::isfinite(v))
+        return "null";
+    std::ostringstream os;
+    os << v;
+    return os.str();
+}
+
+static void write_histogram(std::ostream& os, const std::vector<uint32_t>& histogram)
+{
+    os << "[";
+    for (size_t i = 0; i < histogram.size(); i++)
+        os << (i ? ", " : "") << histogram[i];
+    os << "]";
+}
+
+BvhReport inspect_bvh(const Bvh& bvh, int orbitFrames, int raysPerSide, float traversalCost)
+{
+    BvhReport report;
+    report.triCount = bvh.triCount;
+    report.triIndexCount = bvh.triIndexCount;
+    report.nodeCount = bvh.nodeCount;
+    report.buildMs = bvh.buildMs;
+    report.sahCost = bvh.sahCost(traversalCost);
+    report.memoryBytes = (uint64_t)bvh.nodeCount * sizeof(BvhNode) + (uint64_t)bvh.triIndexCount * sizeof(uint32_t);
+    if (bvh.nodeCount == 0)
+        return report;
+
+    CompressedBvh compressed;
+    compressed.build(bvh);
+    report.compressedMemoryBytes = compressed.memoryBytes();
+
+    double overlapSum = 0.0, emptySum = 0.0;
+    uint32_t interiorCount = 0, volumeCount = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, 0 } };
+    while (!stack.empty()) {
+        uint32_t index = stack.back().first, depth = stack.back().second;
+        stack.pop_back();
+        const BvhNode& node = bvh.nodes[index];
+        if (node.count) {
+            report.leafCount++;
+            if (report.depthHistogram.size() <= depth)
+                report.depthHistogram.resize(depth + 1);
+            report.depthHistogram[depth]++;
+            if (report.leafSizeHistogram.size() <= node.count)
+                report.leafSizeHistogram.resize(node.count + 1);
+            report.leafSizeHistogram[node.count]++;
+            continue;
+        }
+
+        const BvhNode& left = bvh.nodes[node.leftFirst];
+        const BvhNode& right = bvh.nodes[node.leftFirst + 1];
+        float3 imin = max(left.bmin, right.bmin), imax = min(left.bmax, right.bmax);
+        float area = surface_area(node.bmin, node.bmax);
+        if (area > 0.0f && imin.x <= imax.x && imin.y <= imax.y && imin.z <= imax.z)
+            overlapSum += surface_area(imin, imax) / area;
+        interiorCount++;
+        float v = volume(node.bmin, node.bmax);
+        if (v > 0.0f) {
+            float covered = volume(left.bmin, left.bmax) + volume(right.bmin, right.bmax) - volume(imin, imax);
+            emptySum += std::max(0.0f, 1.0f - covered / v);
+            volumeCount++;
+        }
+        stack.push_back({ node.leftFirst, depth + 1 });
+        stack.push_back({ node.leftFirst + 1, depth + 1 });
+    }
+    report.overlap = interiorCount ? (float)(overlapSum / interiorCount) : 0.0f;
+    report.emptySpace = volumeCount ? (float)(emptySum / volumeCount) : 0.0f;
+
+    // drawFrame advances the orbit angle by 0.01 per frame starting at 0.01.
+    std::vector<BvhTraversalStats> frameStats(orbitFrames);
+    std::vector<uint32_t> frameHits(orbitFrames);
+    parallel_for(0, orbitFrames, 1, [&](size_t frame) {
+        Camera camera = orbit_camera(0.01f + 6.2832f * frame / orbitFrames);
+        for (int y = 0; y < raysPerSide; y++) {
+            for (int x = 0; x < raysPerSide; x++) {
+                Ray ray = { camera.origin, pixel_ray(camera, x, y, raysPerSide, raysPerSide), 0.0f, 1e30f };
+                Hit hit;
+                frameHits[frame] += bvh.intersect(ray, CULL_NONE, hit, &frameStats[frame]);
+            }
+        }
+    });
+    BvhTraversalStats total;
+    uint32_t hits = 0;
+    for (int frame = 0; frame < orbitFrames; frame++) {
+        total.nodes += frameStats[frame].nodes;
+        total.triangles += frameStats[frame].triangles;
+        hits += frameHits[frame];
+    }
+    report.rayCount = (uint32_t)(orbitFrames * raysPerSide * raysPerSide);
+    if (report.rayCount) {
+        report.hitFraction = (float)hits / report.rayCount;
+        report.nodesPerRay = (double)total.nodes / report.rayCount;
+        report.trianglesPerRay = (double)total.triangles / report.rayCount;
+    }
+    return report;
+}
+
+std::string to_json(const BvhReport& report)
+{
+    std::ostringstream os;
+    os << "{\n";
+    os << "  \"triCount\": " << report.triCount << ",\n";
+    os << "  \"triIndexCount\": " << report.triIndexCount << ",\n";
+    os << "  \"nodeCount\": " << report.nodeCount << ",\n";
+    os << "  \"leafCount\": " << report.leafCount << ",\n";
+    os << "  \"buildMs\": " << json_number(report.buildMs) << ",\n";
+    os << "  \"sahCost\": " << json_number(report.sahCost) << ",\n";
+    os << "  \"depthHistogram\": ";
+    write_histogram(os, report.depthHistogram);
+    os << ",\n  \"leafSizeHistogram\": ";
+    write_histogram(os, report.leafSizeHistogram);
+    os << ",\n";
+    os << "  \"overlap\": " << json_number(report.overlap) << ",\n";
+    os << "  \"emptySpace\": " << json_number(report.emptySpace) << ",\n";
+    os << "  \"memoryBytes\": " << report.memoryBytes << ",\n";
+    os << "  \"compressedMemoryBytes\": " << report.compressedMemoryBytes << ",\n";
+    os << "  \"rayCount\": " << report.rayCount << ",\n";
+    os << "  \"hitFraction\": " << json_number(report.hitFraction) << ",\n";
+    os << "  \"nodesPerRay\": " << json_number(report.nodesPerRay) << ",\n";
+    os << "  \"trianglesPerRay\": " << json_number(report.trianglesPerRay) << "\n";
+    os << "}\n";
+    return os.str();
+}
+
+bool write_json(const BvhReport& report, const char* filename)
+{
+    std::ofstream os(filename, std::ios_base::binary);
+    if (!os.is_open())
+        return false;
+    os << to_json(report);
+    return (bool)os;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Bvh.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Quality figures for one Bvh, for comparing builders and tracking a mesh's
+// tree across changes.
+struct BvhReport
+{
+    uint32_t triCount = 0;
+    uint32_t triIndexCount = 0;
+    uint32_t nodeCount = 0;
+    uint32_t leafCount = 0;
+    double buildMs = 0.0;
+    float sahCost = 0.0f;
+
+    std::vector<uint32_t> depthHistogram;    // leaves at each depth, the root being depth 0
+    std::vector<uint32_t> leafSizeHistogram; // leaves holding each number of triangles
+    float overlap = 0.0f;    // mean over interior nodes of area(left & right) / area(node)
+    float emptySpace = 0.0f; // mean over interior nodes of the volume fraction neither child covers
+
+    uint64_t memoryBytes = 0;           // nodes and triangle indices
+    uint64_t compressedMemoryBytes = 0; // the same tree as a CompressedBvh
+
+    // Camera rays replayed from the drawFrame orbit.
+    uint32_t rayCount = 0;
+    float hitFraction = 0.0f;
+    double nodesPerRay = 0.0;
+    double trianglesPerRay = 0.0;
+};
+
+// Walk the tree, then cast raysPerSide x raysPerSide primary rays from each of
+// orbitFrames cameras spread evenly around the orbit. The mesh is taken to
+// sit at the origin untransformed, as the glass shell does.
+BvhReport inspect_bvh(const Bvh& bvh, int orbitFrames = 16, int raysPerSide = 64, float traversalCost = 1.0f);
+
+std::string to_json(const BvhReport& report);
+bool write_json(const BvhReport& report, const char* filename);
@@ -0,0 +1,127 @@
+#include "Camera.hpp"
+
+float4x4 inverse(const float4x4& a)
+{
+    // Cofactor expansion via 2x2 sub-determinants.
+    const float* m = &a.m[0][0];
+    float s0 = m[0] * m[5] - m[4] * m[1];
+    float s1 = m[0] * m[6] - m[4] * m[2];
+    float s2 = m[0] * m[7] - m[4] * m[3];
+    float s3 = m[1] * m[6] - m[5] * m[2];
+    float s4 = m[1] * m[7] - m[5] * m[3];
+    float s5 = m[2] * m[7] - m[6] * m[3];
+    float c5 = m[10] * m[15] - m[14] * m[11];
+    float c4 = m[9] * m[15] - m[13] * m[11];
+    float c3 = m[9] * m[14] - m[13] * m[10];
+    float c2 = m[8] * m[15] - m[12] * m[11];
+    float c1 = m[8] * m[14] - m[12] * m[10];
+    float c0 = m[8] * m[13] - m[12] * m[9];
+    float invDet = 1.0f / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+
+    float4x4 r;
+    r.m[0][0] = (m[5] * c5 - m[6] * c4 + m[7] * c3) * invDet;
+    r.m[0][1] = (-m[1] * c5 + m[2] * c4 - m[3] * c3) * invDet;
+    r.m[0][2] = (m[13] * s5 - m[14] * s4 + m[15] * s3) * invDet;
+    r.m[0][3] = (-m[9] * s5 + m[10] * s4 - m[11] * s3) * invDet;
+    r.m[1][0] = (-m[4] * c5 + m[6] * c2 - m[7] * c1) * invDet;
+    r.m[1][1] = (m[0] * c5 - m[2] * c2 + m[3] * c1) * invDet;
+    r.m[1][2] = (-m[12] * s5 + m[14] * s2 - m[15] * s1) * invDet;
+    r.m[1][3] = (m[8] * s5 - m[10] * s2 + m[11] * s1) * invDet;
+    r.m[2][0] = (m[4] * c4 - m[5] * c2 + m[7] * c0) * invDet;
+    r.m[2][1] = (-m[0] * c4 + m[1] * c2 - m[3] * c0) * invDet;
+    r.m[2][2] = (m[12] * s4 - m[13] * s2 + m[15] * s0) * invDet;
+    r.m[2][3] = (-m[8] * s4 + m[9] * s2 - m[11] * s0) * invDet;
+    r.m[3][0] = (-m[4] * c3 + m[5] * c1 - m[6] * c0) * invDet;
+    r.m[3][1] = (m[0] * c3 - m[1] * c1 + m[2] * c0) * invDet;
+    r.m[3][2] = (-m[12] * s3 + m[13] * s1 - m[14] * s0) * invDet;
+    r.m[3][3] = (m[8] * s3 - m[9] * s1 + m[10] * s0) * invDet;
+    return r;
+}
+
+float4x4 perspective_fov_lh(float fovY, float aspect, float nearZ, float farZ)
+{
+    float h = cosf(0.5f * fovY) / sinf(0.5f * fovY);
+    float w = h / aspect;
+    float range = farZ / (farZ - nearZ);
+    return { {
+        { w, 0.0f, 0.0f, 0.0f },
+        { 0.0f, h, 0.0f, 0.0f },
+        { 0.0f, 0.0f, range, 1.0f },
+        { 0.0f, 0.0f, -range * nearZ, 0.0f },
+    } };
+}
+
+float4x4 look_at_lh(float3 eye, float3 focus, float3 up)
+{
+    float3 r2 = normalize(focus - eye);
+    float3 r0 = normalize(cross(up, r2));
+    float3 r1 = cross(r2, r0);
+    return { {
+        { r0.x, r1.x, r2.x, 0.0f },
+        { r0.y, r1.y, r2.y, 0.0f },
+        { r0.z, r1.z, r2.z, 0.0f },
+        { -dot(r0, eye), -dot(r1, eye), -dot(r2, eye), 1.0f },
+    } };
+}
+
+float4x4 translation(float3 v)
+{
+    return { {
+        { 1.0f, 0.0f, 0.0f, 0.0f },
+        { 0.0f, 1.0f, 0.0f, 0.0f },
+        { 0.0f, 0.0f, 1.0f, 0.0f },
+        { v.x, v.y, v.z, 1.0f },
+    } };
+}
+
+Camera camera_from_inverse(const float4x4& projInv, float3 origin)
+{
+    // The shader reads the row-major XMMATRIX as column-major, so it sees the
+    // transpose: mul(float4(sx, sy, 0, 1), proj_inv) picks out columns 0, 1 and 3.
+    Camera camera;
+    camera.origin = origin;
+    camera.a = { projInv.m[0][0], projInv.m[1][0], projInv.m[2][0] };
+    camera.b = { projInv.m[0][1], projInv.m[1][1], projInv.m[2][1] };
+    camera.c = { projInv.m[0][3], projInv.m[1][3], projInv.m[2][3] };
+    return camera;
+}
+
+Camera orbit_camera(float angle)
+{
+    float4x4 proj = perspective_fov_lh(52.0f / 180.0f * 3.1415f, 1.333f, 1.0f, 125.0f);
+    float3 origin = { 5 * cosf(angle), 0.0f, 5 * sinf(angle) };
+    float4x4 world = translation(origin);
+    float4x4 view = look_at_lh({ cosf(-angle), 0.0f, sinf(-angle) }, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    return camera_from_inverse(inverse(proj * world * view), origin);
+}
+
+Camera look_at_camera(float3 eye, float3 focus)
+{
+    // Same frustum as orbit_camera: 52 degrees vertically at 4:3.
+    float h = tanf(0.5f * 52.0f / 180.0f * 3.1415f);
+    float3 forward = normalize(focus - eye);
+    // Screen x runs along forward x up, as it does for the orbit.
+    float3 right = normalize(cross(forward, float3{ 0.0f, 1.0f, 0.0f }));
+    float3 up = cross(right, forward);
+    Camera camera;
+    camera.origin = eye;
+    camera.a = (1.333f * h) * right;
+    camera.b = h * up;
+    camera.c = forward;
+    return camera;
+}
+
+float4 project(const Camera& camera, float3 p)
+{
+    // Invert sx*a + sy*b + c = k*(p - origin) with Cramer's rule. Numerators and
+    // the shared denominator are linear in p, so this is a projective map.
+    float3 d = camera.origin - p;
+    float3 bd = cross(camera.b, d);
+    float det = dot(camera.a, bd);
+    float nx = -dot(camera.c, bd);
+    float ny = -dot(camera.a, cross(camera.c, d));
+
+    // Scale so w is the distance along the centre ray.
+    float scale = -dot(cross(camera.a, camera.b), normalize(camera.c));
+    return { nx / scale, ny / scale, 0.0f, det / scale };
+}
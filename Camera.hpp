@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Math.hpp"
+
+// Pinhole camera in the form GenerateCameraRay in RayTracing.hlsl uses: the ray
+// through screen position (sx, sy) in [-1,1] has direction sx*a + sy*b + c.
+struct Camera
+{
+    float3 origin;
+    float3 a, b, c;
+};
+
+// Camera for the inverse view-projection matrix the GPU receives as proj_inv.
+Camera camera_from_inverse(const float4x4& projInv, float3 origin);
+
+// The orbit drawFrame animates, at the given angle.
+Camera orbit_camera(float angle);
+
+// Camera looking from eye at focus with +y up, with the orbit camera's field
+// of view and aspect ratio.
+Camera look_at_camera(float3 eye, float3 focus);
+
+inline float3 camera_ray(const Camera& camera, float sx, float sy)
+{
+    return normalize(sx * camera.a + sy * camera.b + camera.c);
+}
+
+// Ray direction through the centre of pixel (x, y), as in GenerateCameraRay.
+inline float3 pixel_ray(const Camera& camera, int x, int y, int width, int height)
+{
+    float sx = (x + 0.5f) / width * 2.0f - 1.0f;
+    float sy = -((y + 0.5f) / height * 2.0f - 1.0f);
+    return camera_ray(camera, sx, sy);
+}
+
+// Project a world-space point to homogeneous clip space so that x/w, y/w is the
+// screen position whose camera ray passes through the point and w is its
+// depth along the centre ray. Shader1.hlsl does the same in VSMain.
+float4 project(const Camera& camera, float3 p);
+
+// DirectXMath-compatible builders used to reproduce the GPU matrices.
+float4x4 perspective_fov_lh(float fovY, float aspect, float nearZ, float farZ);
+float4x4 look_at_lh(float3 eye, float3 focus, float3 up);
+float4x4 translation(float3 v);
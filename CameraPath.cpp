@@ -0,0 +1,47 @@
+#include "CameraPath.hpp"
+
+#include <fstream>
+#include <stdio.h>
+#include <string>
+
+bool CameraPath::load(const char* filename)
+{
+    std::ifstream is(filename);
+    if (!is.is_open())
+        return false;
+
+    keys.clear();
+    std::string line;
+    while (std::getline(is, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+        CameraKey key;
+        if (sscanf(line.c_str(), "%f %f %f %f %f %f %f", &key.frame, &key.eye.x, &key.eye.y, &key.eye.z,
+                &key.focus.x, &key.focus.y, &key.focus.z) != 7)
+            return false;
+        if (!keys.empty() && key.frame <= keys.back().frame)
+            return false;
+        keys.push_back(key);
+    }
+    return !keys.empty();
+}
+
+Camera CameraPath::at(int frame) const
+{
+    if (keys.empty())
+        return orbit_camera(0.01f + 0.01f * frame);
+
+    float f = (float)frame;
+    if (f <= keys.front().frame)
+        return look_at_camera(keys.front().eye, keys.front().focus);
+    if (f >= keys.back().frame)
+        return look_at_camera(keys.back().eye, keys.back().focus);
+    size_t i = 1;
+    while (keys[i].frame < f)
+        i++;
+    const CameraKey& k0 = keys[i - 1];
+    const CameraKey& k1 = keys[i];
+    float s = (f - k0.frame) / (k1.frame - k0.frame);
+    return look_at_camera(k0.eye + s * (k1.eye - k0.eye), k0.focus + s * (k1.focus - k0.focus));
+}
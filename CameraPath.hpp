@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Camera.hpp"
+#include <vector>
+
+struct CameraKey
+{
+    float frame;
+    float3 eye;
+    float3 focus;
+};
+
+// Camera for each frame of a sequence: the drawFrame orbit when there are no
+// keys, otherwise the keys interpolated linearly and held before the first
+// and after the last.
+struct CameraPath
+{
+    // One key per line: frame eyeX eyeY eyeZ focusX focusY focusZ. Blank
+    // lines and lines starting with # are skipped. Keys must be in frame order.
+    bool load(const char* filename);
+    Camera at(int frame) const;
+
+    std::vector<CameraKey> keys;
+};
@@ -0,0 +1,253 @@
+#include "CompressedBvh.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+constexpr float INF = 1e30f;
+constexpr uint32_t maxLeafTriangles = compressedInternal - 1;
+constexpr uint32_t noNode = ~0u;
+constexpr int maxStackSize = 4 * 128;
+
+namespace {
+
+// A subtree waiting to become a child slot: a node of the source Bvh, or a
+// run of its triangles too long for one leaf slot.
+struct Item
+{
+    float3 bmin, bmax;
+    uint32_t node; // source interior node, or noNode for a triangle run
+    uint32_t first, count;
+};
+
+struct StackEntry
+{
+    uint32_t node;
+    float t;
+};
+
+} // namespace
+
+static inline float exp2i(int e)
+{
+    uint32_t bits = (uint32_t)(e + 127) << 23;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline float dequantize(float origin, int q, float scale)
+{
+    return origin + (float)q * scale;
+}
+
+static Item make_item(const Bvh& bvh, uint32_t index)
+{
+    const BvhNode& node = bvh.nodes[index];
+    if (node.count)
+        return { node.bmin, node.bmax, noNode, node.leftFirst, node.count };
+    return { node.bmin, node.bmax, index, 0, 0 };
+}
+
+static bool is_leaf_item(const Item& item)
+{
+    return item.node == noNode && item.count <= maxLeafTriangles;
+}
+
+// Children of an item that needs a node of its own. A long triangle run is
+// cut into equal runs that keep its box.
+static int expand_item(const Bvh& bvh, const Item& item, Item* out)
+{
+    if (item.node != noNode) {
+        uint32_t left = bvh.nodes[item.node].leftFirst;
+        out[0] = make_item(bvh, left);
+        out[1] = make_item(bvh, left + 1);
+        return 2;
+    }
+    uint32_t step = std::max((item.count + compressedWidth - 1) / compressedWidth, 1u);
+    int n = 0;
+    for (uint32_t first = 0; first < item.count; first += step)
+        out[n++] = { item.bmin, item.bmax, noNode, item.first + first, std::min(step, item.count - first) };
+    return n;
+}
+
+void CompressedBvh::build(const Bvh& bvh)
+{
+    mesh = bvh.mesh;
+    nodes.clear();
+    triIndices.clear();
+    if (bvh.nodeCount == 0)
+        return;
+    // Collapsing never deepens the tree, and each node leaves at most
+    // compressedWidth - 1 of its children waiting.
+    stackSize = (compressedWidth - 1) * bvh.depth + compressedWidth;
+    nodes.reserve(bvh.nodeCount / 2 + 1);
+    triIndices.reserve(bvh.triIndexCount);
+
+    std::vector<std::pair<uint32_t, Item>> stack = { { 0, make_item(bvh, 0) } };
+    nodes.emplace_back();
+    while (!stack.empty()) {
+        uint32_t index = stack.back().first;
+        Item item = stack.back().second;
+        stack.pop_back();
+
+        // Open up the largest interior child until the node is full. A leaf
+        // root becomes the single child of the root.
+        Item children[compressedWidth];
+        int childCount = 0;
+        if (is_leaf_item(item))
+            children[childCount++] = item;
+        else
+            childCount = expand_item(bvh, item, children);
+        while (childCount < compressedWidth) {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (int i = 0; i < childCount; i++) {
+                float area = surface_area(children[i].bmin, children[i].bmax);
+                if (children[i].node != noNode && area > bestArea) {
+                    best = i;
+                    bestArea = area;
+                }
+            }
+            if (best < 0)
+                break;
+            uint32_t left = bvh.nodes[children[best].node].leftFirst;
+            children[best] = make_item(bvh, left);
+            children[childCount++] = make_item(bvh, left + 1);
+        }
+
+        CompressedNode node = {};
+        float3 bmin = { INF, INF, INF }, bmax = { -INF, -INF, -INF };
+        for (int i = 0; i < childCount; i++) {
+            bmin = min(bmin, children[i].bmin);
+            bmax = max(bmax, children[i].bmax);
+        }
+        node.origin = bmin;
+        float scale[3];
+        for (int axis = 0; axis < 3; axis++) {
+            float lo = component(bmin, axis), hi = component(bmax, axis);
+            int e = hi > lo ? (int)ceilf(log2f((hi - lo) / 255.0f)) : 0;
+            e = std::max(-126, std::min(127, e));
+            while (e < 127 && dequantize(lo, 255, exp2i(e)) < hi)
+                e++;
+            node.exponent[axis] = (int8_t)e;
+            scale[axis] = exp2i(e);
+        }
+
+        uint32_t interiorCount = 0;
+        for (int i = 0; i < childCount; i++)
+            interiorCount += !is_leaf_item(children[i]);
+        node.childBase = (uint32_t)nodes.size();
+        node.triBase = (uint32_t)triIndices.size();
+        uint32_t nextChild = node.childBase;
+        for (int i = 0; i < childCount; i++) {
+            const Item& child = children[i];
+            for (int axis = 0; axis < 3; axis++) {
+                float o = component(node.origin, axis);
+                float cmin = component(child.bmin, axis), cmax = component(child.bmax, axis);
+                int qlo = std::max(0, std::min(255, (int)floorf((cmin - o) / scale[axis])));
+                int qhi = std::max(0, std::min(255, (int)ceilf((cmax - o) / scale[axis])));
+                while (qlo > 0 && dequantize(o, qlo, scale[axis]) > cmin)
+                    qlo--;
+                while (qhi < 255 && dequantize(o, qhi, scale[axis]) < cmax)
+                    qhi++;
+                node.qmin[axis][i] = (uint8_t)qlo;
+                node.qmax[axis][i] = (uint8_t)qhi;
+            }
+            if (is_leaf_item(child)) {
+                node.meta[i] = (uint8_t)child.count;
+                triIndices.insert(triIndices.end(), bvh.triIndices + child.first, bvh.triIndices + child.first + child.count);
+            } else {
+                node.meta[i] = compressedInternal;
+                stack.push_back({ nextChild++, child });
+            }
+        }
+        nodes[index] = node;
+        nodes.resize(nodes.size() + interiorCount);
+    }
+}
+
+bool CompressedBvh::intersect(const Ray& ray_, RayCull cull, Hit& hit, BvhTraversalStats* stats) const
+{
+    if (nodes.empty())
+        return false;
+
+    Ray ray = ray_;
+    float3 invDir = { 1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z };
+    bool found = false;
+    StackEntry localStack[maxStackSize];
+    std::vector<StackEntry> heapStack;
+    StackEntry* stack = localStack;
+    if (stackSize > (uint32_t)maxStackSize) {
+        heapStack.resize(stackSize);
+        stack = heapStack.data();
+    }
+    int sp = 0;
+    uint32_t index = 0;
+    for (;;) {
+        const CompressedNode& node = nodes[index];
+        float3 scale = { exp2i(node.exponent[0]), exp2i(node.exponent[1]), exp2i(node.exponent[2]) };
+        if (stats)
+            stats->nodes++;
+
+        // Leaves are tested as soon as their box is hit; interior children
+        // are collected and visited nearest first.
+        StackEntry next[compressedWidth];
+        int nextCount = 0;
+        uint32_t child = node.childBase, tri = node.triBase;
+        for (int i = 0; i < compressedWidth; i++) {
+            uint8_t meta = node.meta[i];
+            if (meta == 0)
+                continue;
+            float3 bmin = { dequantize(node.origin.x, node.qmin[0][i], scale.x), dequantize(node.origin.y, node.qmin[1][i], scale.y),
+                dequantize(node.origin.z, node.qmin[2][i], scale.z) };
+            float3 bmax = { dequantize(node.origin.x, node.qmax[0][i], scale.x), dequantize(node.origin.y, node.qmax[1][i], scale.y),
+                dequantize(node.origin.z, node.qmax[2][i], scale.z) };
+            float t = intersect_aabb(ray, invDir, bmin, bmax);
+            if (meta == compressedInternal) {
+                if (t != INF)
+                    next[nextCount++] = { child, t };
+                child++;
+                continue;
+            }
+            if (t != INF) {
+                if (stats)
+                    stats->triangles += meta;
+                for (uint32_t j = 0; j < meta; j++) {
+                    uint32_t prim = triIndices[tri + j];
+                    float ht, u, v;
+                    if (intersect_triangle(ray, vertex_position(*mesh, prim, 0), vertex_position(*mesh, prim, 1),
+                            vertex_position(*mesh, prim, 2), cull, ht, u, v)) {
+                        ray.tmax = ht;
+                        hit = { ht, u, v, prim };
+                        found = true;
+                    }
+                }
+            }
+            tri += meta;
+        }
+
+        // Farthest first, so the nearest child is popped next. Insertion sort
+        // is cheapest for at most compressedWidth entries.
+        for (int i = 1; i < nextCount; i++) {
+            StackEntry entry = next[i];
+            int j = i;
+            for (; j > 0 && next[j - 1].t < entry.t; j--)
+                next[j] = next[j - 1];
+            next[j] = entry;
+        }
+        for (int i = 0; i < nextCount; i++)
+            stack[sp++] = next[i];
+
+        // Entries found before a closer hit shortened the ray may be stale.
+        for (;;) {
+            if (sp == 0)
+                return found;
+            StackEntry entry = stack[--sp];
+            if (entry.t < ray.tmax) {
+                index = entry.node;
+                break;
+            }
+        }
+    }
+}
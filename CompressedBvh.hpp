@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Bvh.hpp"
+#include <stdint.h>
+#include <vector>
+
+constexpr int compressedWidth = 4;
+constexpr uint8_t compressedInternal = 0xff; // CompressedNode::meta of an interior child
+
+// Four-wide node whose child boxes are quantized to 8 bits per plane within
+// the node's own box: a plane lies at origin + q * 2^exponent on its axis.
+// Quantization always rounds outwards, so a child box only ever grows.
+struct CompressedNode
+{
+    float3 origin;
+    int8_t exponent[3];
+    uint8_t pad;
+    uint32_t childBase;                   // first interior child; the others follow it
+    uint32_t triBase;                     // first triangle of the first leaf child; the others follow it
+    uint8_t meta[compressedWidth];        // 0 for an empty slot, compressedInternal, or a leaf's triangle count
+    uint8_t qmin[3][compressedWidth];
+    uint8_t qmax[3][compressedWidth];
+};
+static_assert(sizeof(CompressedNode) == 52, "CompressedNode layout");
+
+// Read-only compact copy of a Bvh for tracing: binary nodes are collapsed
+// into four-wide ones and their fp32 bounds replaced by the quantized ones,
+// which takes a node array about a quarter the size of the Bvh's.
+struct CompressedBvh
+{
+    void build(const Bvh& bvh);
+    bool intersect(const Ray& ray, RayCull cull, Hit& hit, BvhTraversalStats* stats = nullptr) const;
+    size_t memoryBytes() const { return nodes.size() * sizeof(CompressedNode) + triIndices.size() * sizeof(uint32_t); }
+
+    const Mesh* mesh = nullptr;
+    uint32_t stackSize = 0; // traversal stack entries the tree can need
+    std::vector<CompressedNode> nodes;
+    std::vector<uint32_t> triIndices;
+};
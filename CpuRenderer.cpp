@@ -0,0 +1,229 @@
+#include "CpuRenderer.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+constexpr int shadeTileSize = 16;
+
+namespace {
+
+struct Payload
+{
+    float3 color;
+    float3 mask;
+    bool outside;
+    unsigned count;
+    TraversalCost* cost; // null unless counting
+};
+
+} // namespace
+
+static float3 reflect_ray(float3 I, float3 N)
+{
+    return I - 2.0f * dot(N, I) * N;
+}
+
+static bool refract_ray(float3& R, float3 I, float3 N, float eta)
+{
+    float k = 1.0f - eta * eta * (1.0f - dot(N, I) * dot(N, I));
+    if (k < 0.0f)
+        return false;
+    R = normalize(eta * I - (eta * dot(N, I) + sqrtf(k)) * N);
+    return true;
+}
+
+static void add_cost(TraversalCost& cost, const BvhTraversalStats& stats)
+{
+    cost.nodes += (uint32_t)stats.nodes;
+    cost.triangles += (uint32_t)stats.triangles;
+    cost.rays++;
+}
+
+static void trace_ray(const CpuRenderer& renderer, const Ray& ray, RayCull cull, Payload& payload);
+
+// Same as ShadeSurface in RayTracing.hlsl.
+static void shade_surface(const CpuRenderer& renderer, Payload& payload, float3 intersection, float3 I, float3 N)
+{
+    if (payload.count >= 5)
+        return;
+
+    float R0 = (0.2f / 2.2f) * (0.2f / 2.2f);
+    float R = R0 * (1.0f - R0) * powf(1.0f - dot(I, payload.outside ? N : -N), 5);
+
+    float3 dir1;
+    if (refract_ray(dir1, I, payload.outside ? N : -N, payload.outside ? (1.0f / 1.3f) : 1.3f)) {
+        Payload payload2 = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }, !payload.outside, payload.count + 1, payload.cost };
+        trace_ray(renderer, { intersection, dir1, 0.001f, 1000.0f }, payload2.outside ? CULL_BACK_FACING : CULL_FRONT_FACING, payload2);
+        payload.color += (1 - R) * payload2.color;
+    }
+
+    if (payload.count < 2) {
+        float3 dir2 = normalize(reflect_ray(I, payload.outside ? N : -N));
+        Payload payload2 = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }, payload.outside, payload.count + 1, payload.cost };
+        trace_ray(renderer, { intersection, dir2, 0.001f, 1000.0f }, payload2.outside ? CULL_BACK_FACING : CULL_FRONT_FACING, payload2);
+        payload.color += R * payload2.color;
+    }
+}
+
+static float3 environment(const CpuRenderer& renderer, float3 dir)
+{
+    return renderer.cubeEnvMap ? renderer.envMap->lookupCube(dir) : renderer.envMap->lookup(dir);
+}
+
+// TraceRay followed by ClosestHit or Miss.
+static void trace_ray(const CpuRenderer& renderer, const Ray& ray, RayCull cull, Payload& payload)
+{
+    SceneHit hit;
+    BvhTraversalStats stats;
+    bool found = renderer.scene->intersect(ray, cull, 0xff, hit, payload.cost ? &stats : nullptr);
+    if (payload.cost)
+        add_cost(*payload.cost, stats);
+    if (!found) {
+        payload.color = payload.mask * environment(renderer, ray.dir);
+        return;
+    }
+    float3 intersection = ray.origin + hit.hit.t * ray.dir;
+    shade_surface(renderer, payload, intersection, ray.dir, renderer.scene->surfaceNormal(hit));
+}
+
+// Mark the shading tiles that the projected bounds of at least one instance
+// overlap. Bounds reaching behind the camera cover the whole screen.
+static std::vector<uint8_t> covered_tiles(const Scene& scene, const Camera& camera, int width, int height, int tilesX, int tilesY)
+{
+    std::vector<uint8_t> covered((size_t)tilesX * tilesY, 0);
+    for (const Instance& instance : scene.instances) {
+        const Bvh& bvh = *scene.meshes[instance.mesh];
+        if (bvh.nodeCount == 0)
+            continue;
+        float3 bmin = bvh.nodes[0].bmin, bmax = bvh.nodes[0].bmax;
+        float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+        bool behind = false;
+        for (int corner = 0; corner < 8 && !behind; corner++) {
+            float3 p = { corner & 1 ? bmax.x : bmin.x, corner & 2 ? bmax.y : bmin.y, corner & 4 ? bmax.z : bmin.z };
+            float4 clip = project(camera, transform_point(instance.transform, p));
+            if (clip.w <= 1e-4f) {
+                behind = true;
+                break;
+            }
+            float x = (clip.x / clip.w + 1.0f) * 0.5f * width;
+            float y = (1.0f - clip.y / clip.w) * 0.5f * height;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+        }
+        if (behind) {
+            std::fill(covered.begin(), covered.end(), 1);
+            break;
+        }
+
+        // A pixel's ray passes through its centre; one pixel of margin absorbs rounding.
+        int x0 = std::max(0, (int)floorf(minX) - 1), x1 = std::min(width - 1, (int)ceilf(maxX) + 1);
+        int y0 = std::max(0, (int)floorf(minY) - 1), y1 = std::min(height - 1, (int)ceilf(maxY) + 1);
+        if (x0 > x1 || y0 > y1)
+            continue;
+        for (int ty = y0 / shadeTileSize; ty <= y1 / shadeTileSize; ty++)
+            for (int tx = x0 / shadeTileSize; tx <= x1 / shadeTileSize; tx++)
+                covered[ty * tilesX + tx] = 1;
+    }
+    return covered;
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+RenderStats CpuRenderer::render(const Camera& camera, Image& image, RenderMode mode, TraversalCostMap* costs) const
+{
+    int width = image.width, height = image.height;
+    int tilesX = (width + shadeTileSize - 1) / shadeTileSize;
+    int tilesY = (height + shadeTileSize - 1) / shadeTileSize;
+    if (costs)
+        costs->resize(width, height);
+
+    RenderStats stats = {};
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<uint8_t> covered;
+    if (screenBoundsEarlyOut)
+        covered = covered_tiles(*scene, camera, width, height, tilesX, tilesY);
+    else
+        covered.assign((size_t)tilesX * tilesY, 1);
+    size_t skippedPixels = 0;
+    for (size_t tile = 0; tile < covered.size(); tile++) {
+        if (!covered[tile]) {
+            int x0 = (int)(tile % tilesX) * shadeTileSize, y0 = (int)(tile / tilesX) * shadeTileSize;
+            skippedPixels += (size_t)(std::min(width, x0 + shadeTileSize) - x0) * (std::min(height, y0 + shadeTileSize) - y0);
+        }
+    }
+    stats.skippedFraction = width > 0 && height > 0 ? (float)skippedPixels / ((size_t)width * height) : 0.0f;
+
+    // Only tiles some mesh may cover are visited pixel by pixel.
+    auto forEachTile = [&](auto&& fn) {
+        parallel_for(0, (size_t)tilesX * tilesY, 1, [&](size_t tile) {
+            if (!covered[tile])
+                return;
+            int x0 = (int)(tile % tilesX) * shadeTileSize, y0 = (int)(tile / tilesX) * shadeTileSize;
+            for (int y = y0; y < std::min(height, y0 + shadeTileSize); y++)
+                for (int x = x0; x < std::min(width, x0 + shadeTileSize); x++)
+                    fn(x, y);
+        });
+    };
+
+    GBuffer gbuffer;
+    gbuffer.resize(width, height);
+    if (mode == RENDER_HYBRID) {
+        rasterize(*scene, camera, gbuffer);
+    } else {
+        forEachTile([&](int x, int y) {
+            Ray ray = { camera.origin, pixel_ray(camera, x, y, width, height), 0.0001f, 100.0f };
+            SceneHit hit;
+            BvhTraversalStats traversal;
+            bool found = scene->intersect(ray, CULL_BACK_FACING, 0xff, hit, costs ? &traversal : nullptr);
+            if (costs)
+                add_cost(costs->pixels[y * width + x], traversal);
+            if (found) {
+                GBufferSample& sample = gbuffer.samples[y * width + x];
+                sample.t = hit.hit.t;
+                sample.normal = scene->surfaceNormal(hit);
+                sample.front = true;
+            }
+        });
+    }
+    stats.primaryMs = elapsed_ms(start);
+
+    start = std::chrono::steady_clock::now();
+    parallel_for(0, (size_t)tilesX * tilesY, 1, [&](size_t tile) {
+        if (covered[tile])
+            return;
+        int x0 = (int)(tile % tilesX) * shadeTileSize, y0 = (int)(tile / tilesX) * shadeTileSize;
+        int x1 = std::min(width, x0 + shadeTileSize);
+        float3 dirs[shadeTileSize];
+        for (int y = y0; y < std::min(height, y0 + shadeTileSize); y++) {
+            for (int x = x0; x < x1; x++)
+                dirs[x - x0] = pixel_ray(camera, x, y, width, height);
+            if (cubeEnvMap) {
+                for (int x = x0; x < x1; x++)
+                    image.at(x, y) = envMap->lookupCube(dirs[x - x0]);
+            } else {
+                envMap->lookupMany(dirs, &image.at(x0, y), x1 - x0);
+            }
+        }
+    });
+    forEachTile([&](int x, int y) {
+        float3 dir = pixel_ray(camera, x, y, width, height);
+        const GBufferSample& sample = gbuffer.samples[y * width + x];
+        if (sample.t < 0.0f) {
+            image.at(x, y) = environment(*this, dir);
+            return;
+        }
+        Payload payload = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }, sample.front, 0, costs ? &costs->pixels[y * width + x] : nullptr };
+        shade_surface(*this, payload, camera.origin + sample.t * dir, dir, sample.normal);
+        image.at(x, y) = payload.color;
+    });
+    stats.shadeMs = elapsed_ms(start);
+    return stats;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Camera.hpp"
+#include "EnvMap.hpp"
+#include "Image.hpp"
+#include "Rasterizer.hpp"
+#include "Scene.hpp"
+#include "TraversalCost.hpp"
+
+enum RenderMode
+{
+    RENDER_TRACED, // primary visibility by casting camera rays
+    RENDER_HYBRID, // primary visibility by rasterizing into a G-buffer
+};
+
+struct RenderStats
+{
+    double primaryMs; // ray casts or rasterization
+    double shadeMs;   // refraction/reflection rays and environment lookups
+    float skippedFraction; // pixels whose tile lies outside every mesh's screen footprint
+};
+
+// CPU port of RayTracing.hlsl. Both modes produce the same image up to
+// rasterization vs. ray-cast precision, so their costs can be compared.
+struct CpuRenderer
+{
+    // With costs given, also count each pixel's traversal work into it. The
+    // counting costs a null check per node when it is off.
+    RenderStats render(const Camera& camera, Image& image, RenderMode mode = RENDER_TRACED, TraversalCostMap* costs = nullptr) const;
+
+    const Scene* scene = nullptr;
+    const EnvMap* envMap = nullptr;
+    // Send tiles that no instance's projected bounds reach straight to the
+    // environment map, without casting their primary rays.
+    bool screenBoundsEarlyOut = true;
+    // Look up misses in the environment map's baked cube map, which needs a
+    // divide per lookup instead of atan2/acos. Call envMap->bakeCubeMap first.
+    bool cubeEnvMap = false;
+};
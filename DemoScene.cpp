@@ -0,0 +1,46 @@
+#include "DemoScene.hpp"
+
+#include <math.h>
+#include <string>
+
+bool load_demo_scene(const char* directory, unsigned instanceGridSide, std::vector<Mesh>& meshes, std::vector<Instance>& instances)
+{
+    std::string prefix = std::string(directory) + "/";
+    meshes.clear();
+    instances.clear();
+    meshes.resize(instanceGridSide ? 2 : 1);
+    if (!meshes[0].load((prefix + "shell.obj").c_str()))
+        return false;
+    instances.push_back({ { { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } } }, 0, 0xff, 0 });
+    if (instanceGridSide) {
+        if (!meshes[1].load((prefix + "sphere.obj").c_str()))
+            return false;
+        float span = 30.0f, spacing = span / instanceGridSide, scale = 0.15f * spacing;
+        for (unsigned i = 0; i < instanceGridSide; i++) {
+            for (unsigned j = 0; j < instanceGridSide; j++) {
+                float angle = 0.37f * (i * instanceGridSide + j);
+                float c = cosf(angle) * scale, s = sinf(angle) * scale;
+                float x = -0.5f * span + (i + 0.5f) * spacing, z = -0.5f * span + (j + 0.5f) * spacing;
+                instances.push_back({ { { { c, 0, s, x }, { 0, scale, 0, -2.5f }, { -s, 0, c, z } } }, 1, 0xff, 2 });
+            }
+        }
+    }
+    return true;
+}
+
+bool CpuDemoScene::load(const char* directory, unsigned instanceGridSide, const BvhBuildOptions& options)
+{
+    if (!load_demo_scene(directory, instanceGridSide, meshes, scene.instances))
+        return false;
+    if (!envMap.load((std::string(directory) + "/envmap.png").c_str()))
+        return false;
+    bvhs.clear();
+    scene.meshes.clear();
+    for (const Mesh& mesh : meshes) {
+        bvhs.emplace_back(new Bvh);
+        bvhs.back()->build(mesh, options);
+        scene.meshes.push_back(bvhs.back().get());
+    }
+    scene.build();
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "EnvMap.hpp"
+#include "Mesh.hpp"
+#include "Scene.hpp"
+#include <memory>
+#include <vector>
+
+// The demo's content: the glass shell in the middle, plus a side x side grid
+// of small spheres on the floor when instanceGridSide is nonzero. meshes[0] is
+// the shell, and an instance's hitGroupOffset is 2 * mesh. The D3D12 backend
+// and the headless tools both start from this.
+bool load_demo_scene(const char* directory, unsigned instanceGridSide, std::vector<Mesh>& meshes, std::vector<Instance>& instances);
+
+// The demo scene made ready for the CPU renderer: one Bvh per mesh, the
+// two-level Scene over them and the environment map from envmap.png.
+struct CpuDemoScene
+{
+    bool load(const char* directory, unsigned instanceGridSide, const BvhBuildOptions& options = {});
+
+    std::vector<Mesh> meshes;
+    std::vector<std::unique_ptr<Bvh>> bvhs;
+    Scene scene;
+    EnvMap envMap;
+};
@@ -0,0 +1,67 @@
+#include "DescriptorAllocator.hpp"
+
+void DescriptorAllocator::reset(uint32_t persistentCount_, uint32_t frameCount_, uint32_t frameSize_)
+{
+    persistentCount = persistentCount_;
+    frameCount = frameCount_;
+    frameSize = frameSize_;
+    generations.assign(persistentCount, 1);
+    allocated.assign(persistentCount, 0);
+    // Hand out low indices first.
+    freeSlots.resize(persistentCount);
+    for (uint32_t i = 0; i < persistentCount; i++)
+        freeSlots[i] = persistentCount - 1 - i;
+    pendingFrees.clear();
+    currentFrame = 0;
+    frameUsed = 0;
+}
+
+bool DescriptorAllocator::allocate(DescriptorHandle& handle)
+{
+    if (freeSlots.empty())
+        return false;
+    uint32_t index = freeSlots.back();
+    freeSlots.pop_back();
+    allocated[index] = 1;
+    handle.index = index;
+    handle.generation = generations[index];
+    return true;
+}
+
+bool DescriptorAllocator::valid(DescriptorHandle handle) const
+{
+    return handle.index < persistentCount && allocated[handle.index] && generations[handle.index] == handle.generation;
+}
+
+bool DescriptorAllocator::free(DescriptorHandle handle, uint64_t fenceValue)
+{
+    if (!valid(handle))
+        return false;
+    allocated[handle.index] = 0;
+    generations[handle.index]++;
+    pendingFrees.push_back({ fenceValue, handle.index });
+    return true;
+}
+
+void DescriptorAllocator::retire(uint64_t completedFenceValue)
+{
+    while (!pendingFrees.empty() && pendingFrees.front().fenceValue <= completedFenceValue) {
+        freeSlots.push_back(pendingFrees.front().index);
+        pendingFrees.pop_front();
+    }
+}
+
+void DescriptorAllocator::beginFrame(unsigned frame)
+{
+    currentFrame = frame;
+    frameUsed = 0;
+}
+
+bool DescriptorAllocator::allocateFrame(uint32_t count, uint32_t& firstIndex)
+{
+    if (currentFrame >= frameCount || count > frameSize - frameUsed)
+        return false;
+    firstIndex = persistentCount + currentFrame * frameSize + frameUsed;
+    frameUsed += count;
+    return true;
+}
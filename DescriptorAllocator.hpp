@@ -0,0 +1,60 @@
+#pragma once
+
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+// A persistent descriptor slot. The generation changes every time the slot
+// is freed, so a handle kept past its free() no longer resolves.
+struct DescriptorHandle
+{
+    uint32_t index = ~0u;
+    uint32_t generation = 0;
+};
+
+// Slot bookkeeping for one shader-visible descriptor heap, which starts with
+// a persistent region and ends with a linear region per frame context:
+//
+//   [0, persistentCount)                 views that live across frames
+//   persistentCount + frame * frameSize  views written for one frame only
+//
+// Shaders index the heap directly, so a slot's heap index is what they get
+// to see. Freed persistent slots are only reused once the fence value of
+// the last frame that could read them has completed, as in UploadRing. Only
+// indices are tracked; the heap itself lives elsewhere.
+struct DescriptorAllocator
+{
+    void reset(uint32_t persistentCount_, uint32_t frameCount_, uint32_t frameSize_);
+
+    bool allocate(DescriptorHandle& handle);
+    // The slot becomes free once fenceValue has completed. False for a stale
+    // or invalid handle.
+    bool free(DescriptorHandle handle, uint64_t fenceValue);
+    void retire(uint64_t completedFenceValue);
+    bool valid(DescriptorHandle handle) const;
+
+    // Start recording into a frame context; its previous frame must be done.
+    void beginFrame(unsigned frame);
+    // count consecutive slots in the current frame's region. False when the
+    // region is full.
+    bool allocateFrame(uint32_t count, uint32_t& firstIndex);
+
+    uint32_t capacity() const { return persistentCount + frameCount * frameSize; }
+    uint32_t persistentUsed() const { return persistentCount - (uint32_t)freeSlots.size() - (uint32_t)pendingFrees.size(); }
+
+    struct PendingFree
+    {
+        uint64_t fenceValue;
+        uint32_t index;
+    };
+
+    uint32_t persistentCount = 0;
+    uint32_t frameCount = 0;
+    uint32_t frameSize = 0;
+    std::vector<uint32_t> generations;
+    std::vector<uint8_t> allocated;
+    std::vector<uint32_t> freeSlots; // taken from the back
+    std::deque<PendingFree> pendingFrees;
+    unsigned currentFrame = 0;
+    uint32_t frameUsed = 0;
+};
@@ -0,0 +1,122 @@
+#include "DxcShaderCompiler.hpp"
+#include <stdio.h>
+
+static std::wstring widen(const std::string& s)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), nullptr, 0);
+    std::wstring w(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), &w[0], length);
+    return w;
+}
+
+static std::string narrow(const wchar_t* w)
+{
+    int length = WideCharToMultiByte(CP_UTF8, 0, w, -1, nullptr, 0, nullptr, nullptr);
+    std::string s(length > 0 ? length - 1 : 0, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, w, -1, &s[0], length, nullptr, nullptr);
+    return s;
+}
+
+// Passes every include on to the default handler and notes the files it
+// opened. Lives on the stack for one Compile call, so it is not refcounted.
+struct RecordingIncludeHandler : IDxcIncludeHandler
+{
+    IDxcIncludeHandler* inner;
+    std::vector<std::string>* includes;
+
+    HRESULT STDMETHODCALLTYPE LoadSource(LPCWSTR filename, IDxcBlob** source) override
+    {
+        HRESULT hr = inner->LoadSource(filename, source);
+        if (SUCCEEDED(hr))
+            includes->push_back(narrow(filename));
+        return hr;
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, void** object) override
+    {
+        if (iid == __uuidof(IDxcIncludeHandler) || iid == __uuidof(IUnknown)) {
+            *object = this;
+            return S_OK;
+        }
+        *object = nullptr;
+        return E_NOINTERFACE;
+    }
+    ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+    ULONG STDMETHODCALLTYPE Release() override { return 1; }
+};
+
+bool DxcShaderCompiler::create()
+{
+    return SUCCEEDED(dll.Initialize())
+        && SUCCEEDED(dll.CreateInstance(CLSID_DxcCompiler, compiler.GetAddressOf()))
+        && SUCCEEDED(dll.CreateInstance(CLSID_DxcLibrary, library.GetAddressOf()))
+        && SUCCEEDED(library->CreateIncludeHandler(&includeHandler));
+}
+
+std::string DxcShaderCompiler::version()
+{
+    ComPtr<IDxcVersionInfo> info;
+    UINT32 major = 0, minor = 0, flags = 0;
+    if (SUCCEEDED(compiler.As(&info)))
+        info->GetVersion(&major, &minor);
+    if (info)
+        info->GetFlags(&flags);
+    // Patch releases keep major.minor, so the commit tells DXC builds apart.
+    ComPtr<IDxcVersionInfo2> info2;
+    UINT32 commitCount = 0;
+    char* commitHash = nullptr;
+    if (SUCCEEDED(compiler.As(&info2)))
+        info2->GetCommitInfo(&commitCount, &commitHash);
+    char s[128];
+    snprintf(s, sizeof(s), "dxc %u.%u %x %u %s", major, minor, flags, commitCount, commitHash ? commitHash : "");
+    CoTaskMemFree(commitHash);
+    return s;
+}
+
+bool DxcShaderCompiler::compile(const ShaderCompileRequest& request, const std::string& source,
+    std::vector<uint8_t>& bytecode, std::vector<std::string>& includes, std::string& errors)
+{
+    ComPtr<IDxcBlobEncoding> sourceBlob;
+    if (FAILED(library->CreateBlobWithEncodingFromPinned(source.data(), (UINT32)source.size(), CP_UTF8, &sourceBlob))) {
+        errors = "cannot create source blob";
+        return false;
+    }
+
+    // DxcDefine only points at the strings, so keep the wide copies around.
+    std::vector<std::wstring> names, values;
+    for (const ShaderDefine& define : request.defines) {
+        names.push_back(widen(define.name));
+        values.push_back(widen(define.value));
+    }
+    std::vector<DxcDefine> defines;
+    for (size_t i = 0; i < names.size(); i++)
+        defines.push_back({ names[i].c_str(), values[i].c_str() });
+
+    RecordingIncludeHandler recorder;
+    recorder.inner = includeHandler.Get();
+    recorder.includes = &includes;
+
+    // Libraries have no entry point.
+    std::wstring entryPoint = widen(request.entryPoint);
+    ComPtr<IDxcOperationResult> result;
+    HRESULT hr = compiler->Compile(sourceBlob.Get(), widen(request.filename).c_str(),
+        entryPoint.empty() ? nullptr : entryPoint.c_str(), widen(request.profile).c_str(), nullptr, 0,
+        defines.data(), (UINT32)defines.size(), &recorder, &result);
+    HRESULT status = hr;
+    if (SUCCEEDED(hr))
+        result->GetStatus(&status);
+    if (FAILED(status)) {
+        ComPtr<IDxcBlobEncoding> errorBlob;
+        if (result && SUCCEEDED(result->GetErrorBuffer(&errorBlob)) && errorBlob)
+            errors.assign((const char*)errorBlob->GetBufferPointer(), errorBlob->GetBufferSize());
+        else
+            errors = "compilation failed";
+        return false;
+    }
+
+    ComPtr<IDxcBlob> blob;
+    result->GetResult(&blob);
+    const uint8_t* p = (const uint8_t*)blob->GetBufferPointer();
+    bytecode.assign(p, p + blob->GetBufferSize());
+    return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "stdafx.h"
+#include "ShaderCache.hpp"
+
+// ShaderCompiler on top of dxcompiler.dll, which must be next to the
+// executable since the system D3DCompiler cannot build DXR libraries.
+struct DxcShaderCompiler : ShaderCompiler
+{
+    bool create();
+
+    std::string version() override;
+    bool compile(const ShaderCompileRequest& request, const std::string& source,
+        std::vector<uint8_t>& bytecode, std::vector<std::string>& includes, std::string& errors) override;
+
+    dxc::DxcDllSupport dll;
+    ComPtr<IDxcCompiler> compiler;
+    ComPtr<IDxcLibrary> library;
+    ComPtr<IDxcIncludeHandler> includeHandler;
+};
@@ -0,0 +1,206 @@
+#include "EnvMap.hpp"
+#include "Texture.hpp"
+
+#include <algorithm>
+#include <string.h>
+
+constexpr float PI = 3.14159265f;
+
+// atan(t) for t in [0,1], odd minimax polynomial.
+static inline float atan_unit(float t)
+{
+    float t2 = t * t;
+    return t * (0.99997726f + t2 * (-0.33262347f + t2 * (0.19354346f + t2 * (-0.11643287f + t2 * (0.05265332f + t2 * -0.01172120f)))));
+}
+
+// acos(x) for x in [0,1], Abramowitz & Stegun 4.4.46.
+static inline float acos_unit(float x)
+{
+    float p = 1.5707963050f + x * (-0.2145988016f + x * (0.0889789874f + x * (-0.0501743046f
+        + x * (0.0308918810f + x * (-0.0170881256f + x * (0.0066700901f + x * -0.0012624911f))))));
+    return p * sqrtf(1.0f - x);
+}
+
+float fast_atan2(float y, float x)
+{
+    float ax = fabsf(x), ay = fabsf(y);
+    float mx = std::max(ax, ay), mn = std::min(ax, ay);
+    float r = atan_unit(mx > 0.0f ? mn / mx : 0.0f);
+    if (ay > ax)
+        r = 0.5f * PI - r;
+    if (x < 0.0f)
+        r = PI - r;
+    return y < 0.0f ? -r : r;
+}
+
+float fast_acos(float x)
+{
+    float r = acos_unit(std::min(fabsf(x), 1.0f));
+    return x < 0.0f ? PI - r : r;
+}
+
+void direction_to_uv(float3 dir, float& u, float& v)
+{
+    u = (fast_atan2(dir.x, dir.z) / PI + 1.0f) * 0.5f;
+    v = fast_acos(dir.y) / PI;
+}
+
+void direction_to_uv4(__m128 x, __m128 y, __m128 z, __m128& u, __m128& v)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 pi = _mm_set1_ps(PI);
+
+    // atan2(x, z), same octant folding as the scalar version.
+    __m128 ax = _mm_andnot_ps(signMask, z);
+    __m128 ay = _mm_andnot_ps(signMask, x);
+    __m128 mx = _mm_max_ps(ax, ay);
+    __m128 mn = _mm_min_ps(ax, ay);
+    __m128 t = _mm_and_ps(_mm_div_ps(mn, mx), _mm_cmpgt_ps(mx, _mm_setzero_ps()));
+    __m128 t2 = _mm_mul_ps(t, t);
+    __m128 p = _mm_set1_ps(-0.01172120f);
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(0.05265332f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(-0.11643287f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(0.19354346f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(-0.33262347f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(0.99997726f));
+    __m128 r = _mm_mul_ps(p, t);
+    __m128 swap = _mm_cmpgt_ps(ay, ax);
+    r = _mm_or_ps(_mm_and_ps(swap, _mm_sub_ps(_mm_set1_ps(0.5f * PI), r)), _mm_andnot_ps(swap, r));
+    __m128 negX = _mm_cmplt_ps(z, _mm_setzero_ps());
+    r = _mm_or_ps(_mm_and_ps(negX, _mm_sub_ps(pi, r)), _mm_andnot_ps(negX, r));
+    r = _mm_xor_ps(r, _mm_and_ps(signMask, x));
+    u = _mm_mul_ps(_mm_add_ps(_mm_div_ps(r, pi), one), _mm_set1_ps(0.5f));
+
+    // acos(y)
+    __m128 a = _mm_min_ps(_mm_andnot_ps(signMask, y), one);
+    __m128 q = _mm_set1_ps(-0.0012624911f);
+    q = _mm_add_ps(_mm_mul_ps(q, a), _mm_set1_ps(0.0066700901f));
+    q = _mm_add_ps(_mm_mul_ps(q, a), _mm_set1_ps(-0.0170881256f));
+    q = _mm_add_ps(_mm_mul_ps(q, a), _mm_set1_ps(0.0308918810f));
+    q = _mm_add_ps(_mm_mul_ps(q, a), _mm_set1_ps(-0.0501743046f));
+    q = _mm_add_ps(_mm_mul_ps(q, a), _mm_set1_ps(0.0889789874f));
+    q = _mm_add_ps(_mm_mul_ps(q, a), _mm_set1_ps(-0.2145988016f));
+    q = _mm_add_ps(_mm_mul_ps(q, a), _mm_set1_ps(1.5707963050f));
+    q = _mm_mul_ps(q, _mm_sqrt_ps(_mm_sub_ps(one, a)));
+    __m128 negY = _mm_cmplt_ps(y, _mm_setzero_ps());
+    q = _mm_or_ps(_mm_and_ps(negY, _mm_sub_ps(pi, q)), _mm_andnot_ps(negY, q));
+    v = _mm_div_ps(q, pi);
+}
+
+bool EnvMap::load(const char* filename)
+{
+    // Shares the baked file with the GPU texture loader.
+    BakedTexture image;
+    if (!image.open(filename))
+        return false;
+
+    width = image.mip(0).width;
+    height = image.mip(0).height;
+    texels.assign(image.texels(0), image.texels(0) + width * height * 3);
+    return true;
+}
+
+float3 EnvMap::lookup(float3 dir) const
+{
+    float u, v;
+    direction_to_uv(dir, u, v);
+    int tx = std::min((int)(u * width), width - 1);
+    int ty = std::min((int)(v * height), height - 1);
+    const float* p = &texels[3 * (ty * width + tx)];
+    return { p[0], p[1], p[2] };
+}
+
+void EnvMap::lookup4(__m128 x, __m128 y, __m128 z, float3 colors[4]) const
+{
+    __m128 u, v;
+    direction_to_uv4(x, y, z, u, v);
+
+    // SSE2 has no gather, so only the index math stays vectorized.
+    __m128i tx = _mm_cvttps_epi32(_mm_mul_ps(u, _mm_set1_ps((float)width)));
+    __m128i ty = _mm_cvttps_epi32(_mm_mul_ps(v, _mm_set1_ps((float)height)));
+    alignas(16) int ix[4], iy[4];
+    _mm_store_si128((__m128i*)ix, tx);
+    _mm_store_si128((__m128i*)iy, ty);
+    for (int i = 0; i < 4; i++) {
+        const float* p = &texels[3 * (std::min(iy[i], height - 1) * width + std::min(ix[i], width - 1))];
+        colors[i] = { p[0], p[1], p[2] };
+    }
+}
+
+void EnvMap::lookupMany(const float3* dirs, float3* colors, size_t count) const
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_setr_ps(dirs[i].x, dirs[i + 1].x, dirs[i + 2].x, dirs[i + 3].x);
+        __m128 y = _mm_setr_ps(dirs[i].y, dirs[i + 1].y, dirs[i + 2].y, dirs[i + 3].y);
+        __m128 z = _mm_setr_ps(dirs[i].z, dirs[i + 1].z, dirs[i + 2].z, dirs[i + 3].z);
+        lookup4(x, y, z, &colors[i]);
+    }
+    for (; i < count; i++)
+        colors[i] = lookup(dirs[i]);
+}
+
+// Face basis: direction for face-local coordinates (s,t) in [-1,1], D3D cube layout.
+static float3 cube_direction(int face, float s, float t)
+{
+    switch (face) {
+        case 0: return { 1.0f, -t, -s };
+        case 1: return { -1.0f, -t, s };
+        case 2: return { s, 1.0f, t };
+        case 3: return { s, -1.0f, -t };
+        case 4: return { s, -t, 1.0f };
+        default: return { -s, -t, -1.0f };
+    }
+}
+
+void EnvMap::bakeCubeMap(int faceSize)
+{
+    cubeSize = faceSize;
+    cubeTexels.resize(6 * faceSize * faceSize * 3);
+    for (int face = 0; face < 6; face++) {
+        for (int j = 0; j < faceSize; j++) {
+            for (int i = 0; i < faceSize; i++) {
+                float s = (i + 0.5f) / faceSize * 2.0f - 1.0f;
+                float t = (j + 0.5f) / faceSize * 2.0f - 1.0f;
+                float3 d = normalize(cube_direction(face, s, t));
+
+                // Baking is offline, so use the exact mapping here.
+                float u = (atan2f(d.x, d.z) / PI + 1.0f) * 0.5f;
+                float v = acosf(clamp(d.y, -1.0f, 1.0f)) / PI;
+                int tx = std::min((int)(u * width), width - 1);
+                int ty = std::min((int)(v * height), height - 1);
+                memcpy(&cubeTexels[3 * ((face * faceSize + j) * faceSize + i)],
+                    &texels[3 * (ty * width + tx)], sizeof(float) * 3);
+            }
+        }
+    }
+}
+
+float3 EnvMap::lookupCube(float3 dir) const
+{
+    float ax = fabsf(dir.x), ay = fabsf(dir.y), az = fabsf(dir.z);
+    int face;
+    float sc, tc, ma;
+    if (ax >= ay && ax >= az) {
+        face = dir.x > 0.0f ? 0 : 1;
+        sc = dir.x > 0.0f ? -dir.z : dir.z;
+        tc = -dir.y;
+        ma = ax;
+    } else if (ay >= az) {
+        face = dir.y > 0.0f ? 2 : 3;
+        sc = dir.x;
+        tc = dir.y > 0.0f ? dir.z : -dir.z;
+        ma = ay;
+    } else {
+        face = dir.z > 0.0f ? 4 : 5;
+        sc = dir.z > 0.0f ? dir.x : -dir.x;
+        tc = -dir.y;
+        ma = az;
+    }
+    float inv = 0.5f / ma;
+    int i = std::min((int)((sc * inv + 0.5f) * cubeSize), cubeSize - 1);
+    int j = std::min((int)((tc * inv + 0.5f) * cubeSize), cubeSize - 1);
+    const float* p = &cubeTexels[3 * ((face * cubeSize + j) * cubeSize + i)];
+    return { p[0], p[1], p[2] };
+}
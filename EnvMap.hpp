@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Math.hpp"
+#include <vector>
+#include <emmintrin.h>
+
+// Direction to lat-long texture coordinates, matching Miss in RayTracing.hlsl.
+// Uses polynomial atan2/acos: |atan error| < 2e-6 rad, |acos error| < 5e-7 rad,
+// well under a texel for any map that fits in memory.
+float fast_atan2(float y, float x);
+float fast_acos(float x);
+void direction_to_uv(float3 dir, float& u, float& v);
+void direction_to_uv4(__m128 x, __m128 y, __m128 z, __m128& u, __m128& v);
+
+struct EnvMap
+{
+    bool load(const char* filename);
+    float3 lookup(float3 dir) const;
+    void lookup4(__m128 x, __m128 y, __m128 z, float3 colors[4]) const;
+    void lookupMany(const float3* dirs, float3* colors, size_t count) const;
+
+    // Re-project into six faces so lookups need a divide instead of atan2/acos.
+    void bakeCubeMap(int faceSize);
+    float3 lookupCube(float3 dir) const;
+
+    int width = 0;
+    int height = 0;
+    std::vector<float> texels; // RGB, row-major
+
+    int cubeSize = 0;
+    std::vector<float> cubeTexels; // RGB, faces +X -X +Y -Y +Z -Z
+};
@@ -0,0 +1,26 @@
+#include "FrameContexts.hpp"
+
+#include <algorithm>
+
+void FrameContexts::reset(unsigned count_)
+{
+    count = std::max(count_, 1u);
+    current = 0;
+    submitted = 0;
+    last = 0;
+    fenceValues.assign(count, 0);
+}
+
+unsigned FrameContexts::begin(uint64_t& waitFenceValue)
+{
+    current = (unsigned)(submitted % count);
+    waitFenceValue = fenceValues[current];
+    return current;
+}
+
+void FrameContexts::end(uint64_t fenceValue)
+{
+    fenceValues[current] = fenceValue;
+    last = fenceValue;
+    submitted++;
+}
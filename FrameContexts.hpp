@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Bookkeeping for recording a frame while the GPU still runs earlier ones.
+// Frames cycle through count contexts, each standing for the per-frame
+// resources the backend keeps (command allocator, readback slot). A context
+// can be recorded into again once the fence value signalled after the
+// previous frame that used it has completed. Only fence values are tracked,
+// so the queue can be real or simulated.
+struct FrameContexts
+{
+    void reset(unsigned count_);
+
+    // Context for the next frame, and the fence value to wait for before
+    // reusing it; 0 when the context has not been submitted yet.
+    unsigned begin(uint64_t& waitFenceValue);
+
+    // The frame in the current context was submitted, and the queue signals
+    // fenceValue once it is done.
+    void end(uint64_t fenceValue);
+
+    // Fence value that covers every frame submitted so far.
+    uint64_t lastFence() const { return last; }
+
+    unsigned count = 0;
+    unsigned current = 0;
+    uint64_t submitted = 0; // frames ended so far
+    uint64_t last = 0;
+    std::vector<uint64_t> fenceValues; // per context, of its latest frame
+};
@@ -0,0 +1,97 @@
+#include "GpuBufferPool.hpp"
+
+#include <algorithm>
+
+void GpuBufferPool::create(ComPtr<ID3D12Device5>& device_, D3D12_HEAP_TYPE heapType_, D3D12_RESOURCE_FLAGS flags_,
+    D3D12_RESOURCE_STATES state_, UINT64 blockSize_, const wchar_t* name_)
+{
+    device = device_;
+    heapType = heapType_;
+    flags = flags_;
+    state = state_;
+    blockSize = blockSize_;
+    name = name_;
+    blocks.clear();
+}
+
+bool GpuBufferPool::allocate(UINT64 size, UINT64 alignment, GpuBufferRange& range)
+{
+    uint32_t block = 0;
+    UINT64 offset;
+    while (block < blocks.size() && !blocks[block].allocator.allocate(size, alignment, offset))
+        block++;
+
+    if (block == blocks.size()) {
+        const UINT64 resourceAlignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+        UINT64 width = std::max(blockSize, (size + resourceAlignment - 1) & ~(resourceAlignment - 1));
+
+        D3D12_RESOURCE_DESC resourceDesc;
+        resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+        resourceDesc.Alignment = 0;
+        resourceDesc.Width = width;
+        resourceDesc.Height = 1;
+        resourceDesc.DepthOrArraySize = 1;
+        resourceDesc.MipLevels = 1;
+        resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
+        resourceDesc.SampleDesc.Count = 1;
+        resourceDesc.SampleDesc.Quality = 0;
+        resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+        resourceDesc.Flags = flags;
+
+        D3D12_HEAP_PROPERTIES heapProperties;
+        heapProperties.Type = heapType;
+        heapProperties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
+        heapProperties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+        heapProperties.CreationNodeMask = 1;
+        heapProperties.VisibleNodeMask = 1;
+
+        Block newBlock;
+        if (FAILED(device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
+                state, nullptr, IID_PPV_ARGS(&newBlock.buffer))))
+            return false;
+        newBlock.buffer->SetName(name);
+        // Upload blocks stay mapped for their whole life.
+        newBlock.data = nullptr;
+        if (heapType == D3D12_HEAP_TYPE_UPLOAD) {
+            D3D12_RANGE readRange = {};
+            newBlock.buffer->Map(0, &readRange, (void**)&newBlock.data);
+        }
+        newBlock.allocator.reset(width);
+        blocks.push_back(std::move(newBlock));
+        if (!blocks.back().allocator.allocate(size, alignment, offset))
+            return false;
+    }
+
+    Block& b = blocks[block];
+    range.resource = b.buffer.Get();
+    range.offset = offset;
+    range.size = size;
+    range.address = b.buffer->GetGPUVirtualAddress() + offset;
+    range.data = b.data ? b.data + offset : nullptr;
+    range.block = block;
+    return true;
+}
+
+void GpuBufferPool::free(GpuBufferRange& range)
+{
+    if (!range.resource)
+        return;
+    blocks[range.block].allocator.free(range.offset);
+    range = {};
+}
+
+HeapAllocatorStats GpuBufferPool::stats() const
+{
+    HeapAllocatorStats total = {};
+    for (const Block& block : blocks) {
+        HeapAllocatorStats s = block.allocator.stats();
+        total.totalBytes += s.totalBytes;
+        total.usedBytes += s.usedBytes;
+        total.freeBytes += s.freeBytes;
+        total.largestFreeBlock = std::max(total.largestFreeBlock, s.largestFreeBlock);
+        total.allocationCount += s.allocationCount;
+        total.freeBlockCount += s.freeBlockCount;
+    }
+    total.fragmentation = total.freeBytes ? 1.0f - (float)total.largestFreeBlock / total.freeBytes : 0.0f;
+    return total;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "stdafx.h"
+#include "HeapAllocator.hpp"
+#include <vector>
+
+// A suballocated piece of one of a pool's buffers.
+struct GpuBufferRange
+{
+    ID3D12Resource* resource = nullptr; // the whole block, for barriers
+    UINT64 offset = 0;
+    UINT64 size = 0;
+    D3D12_GPU_VIRTUAL_ADDRESS address = 0;
+    char* data = nullptr;               // mapped memory, upload pools only
+    uint32_t block = 0;
+};
+
+// Buffer ranges carved out of large committed buffers that share a heap
+// type, resource flags and initial state. Every committed resource is
+// aligned to 64 KB, so small buffers such as shader tables waste far less
+// memory as ranges of one block. Blocks are added as needed; a request
+// larger than blockSize gets a block of its own size.
+struct GpuBufferPool
+{
+    void create(ComPtr<ID3D12Device5>& device_, D3D12_HEAP_TYPE heapType_, D3D12_RESOURCE_FLAGS flags_,
+        D3D12_RESOURCE_STATES state_, UINT64 blockSize_, const wchar_t* name_);
+    bool allocate(UINT64 size, UINT64 alignment, GpuBufferRange& range);
+    void free(GpuBufferRange& range);
+    // Summed over the blocks; largestFreeBlock is the largest in any block.
+    HeapAllocatorStats stats() const;
+
+    struct Block
+    {
+        ComPtr<ID3D12Resource> buffer;
+        char* data;
+        HeapAllocator allocator;
+    };
+
+    ComPtr<ID3D12Device5> device;
+    D3D12_HEAP_TYPE heapType;
+    D3D12_RESOURCE_FLAGS flags;
+    D3D12_RESOURCE_STATES state;
+    UINT64 blockSize;
+    const wchar_t* name;
+    std::vector<Block> blocks;
+};
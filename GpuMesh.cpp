@@ -0,0 +1,50 @@
+#include "GpuMesh.hpp"
+
+D3D12_RAYTRACING_GEOMETRY_DESC GpuMesh::raytracingGeometry() const
+{
+    D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc;
+    geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+    geometryDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_NO_DUPLICATE_ANYHIT_INVOCATION;
+    geometryDesc.Triangles.VertexBuffer.StartAddress = vb.address;
+    geometryDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(Vertex);
+    geometryDesc.Triangles.VertexCount = vertexCount;
+    geometryDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+    geometryDesc.Triangles.IndexBuffer = ib.address;
+    geometryDesc.Triangles.IndexFormat = DXGI_FORMAT_R32_UINT;
+    geometryDesc.Triangles.IndexCount = indexCount;
+    geometryDesc.Triangles.Transform3x4 = 0;
+    return geometryDesc;
+}
+
+bool GpuMesh::upload(GpuBufferPool& pool, const Mesh& mesh)
+{
+    vertexCount = (UINT)mesh.verts.size();
+    indexCount = (UINT)mesh.indices.size();
+
+    // Both are read as raw buffers by the hit groups as well.
+    if (!pool.allocate(vertexCount * sizeof(Vertex), D3D12_RAW_UAV_SRV_BYTE_ALIGNMENT, vb) ||
+        !pool.allocate(indexCount * sizeof(uint32_t), D3D12_RAW_UAV_SRV_BYTE_ALIGNMENT, ib))
+        return false;
+    memcpy(vb.data, mesh.verts.data(), vb.size);
+    memcpy(ib.data, mesh.indices.data(), ib.size);
+    return true;
+}
+
+void GpuMesh::draw(ComPtr<ID3D12GraphicsCommandList5>& cmd, UINT instanceCount)
+{
+    cmd->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    D3D12_INDEX_BUFFER_VIEW indexView;
+    indexView.BufferLocation = ib.address;
+    indexView.Format = DXGI_FORMAT_R32_UINT;
+    indexView.SizeInBytes = indexCount * sizeof(uint32_t);
+    cmd->IASetIndexBuffer(&indexView);
+
+    D3D12_VERTEX_BUFFER_VIEW vertexView;
+    vertexView.BufferLocation = vb.address;
+    vertexView.StrideInBytes = sizeof(Vertex);
+    vertexView.SizeInBytes = vertexCount * sizeof(Vertex);
+    cmd->IASetVertexBuffers(0, 1, &vertexView);
+
+    cmd->DrawIndexedInstanced(indexCount, instanceCount, 0, 0, 0);
+}
\ No newline at end of file
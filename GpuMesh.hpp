@@ -0,0 +1,20 @@
+#pragma once
+
+#include "stdafx.h"
+#include "GpuBufferPool.hpp"
+#include "Mesh.hpp"
+
+// D3D12 vertex and index buffers holding a copy of a Mesh, for the BLAS build,
+// the hit group records and the raster pass. Both are ranges of an upload
+// pool, so the CPU can rewrite the vertices in place.
+struct GpuMesh
+{
+    bool upload(GpuBufferPool& pool, const Mesh& mesh);
+    D3D12_RAYTRACING_GEOMETRY_DESC raytracingGeometry() const;
+    void draw(ComPtr<ID3D12GraphicsCommandList5>& cmd, UINT instanceCount = 1);
+
+    GpuBufferRange vb;
+    GpuBufferRange ib;
+    UINT vertexCount = 0;
+    UINT indexCount = 0;
+};
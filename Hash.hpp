@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// 64-bit content hash for cache keys. Not cryptographic; it only has to make
+// accidental collisions between different asset versions unlikely.
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0)
+{
+    const uint64_t prime = 0x100000001b3ull;
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t h = 0xcbf29ce484222325ull ^ (seed * prime) ^ size;
+    for (; size >= 8; size -= 8, p += 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * prime;
+        h ^= h >> 31;
+    }
+    for (; size > 0; size--, p++)
+        h = (h ^ *p) * prime;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
@@ -0,0 +1,165 @@
+#include "BatchRender.hpp"
+#include "DemoScene.hpp"
+#include "RenderFarm.hpp"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Renders a range of frames along a camera path with the CPU renderer, several
+// frames at once, and writes them as PPM files. For machines without a window
+// or a DXR device. With --serve the frames are rendered by --worker processes
+// instead.
+static const char* counterNames[] = { "nodes", "triangles", "rays" };
+
+// Debug render: a false-colour heatmap of the nodes each pixel's rays entered,
+// and power-of-two histograms of every counter.
+static bool write_cost_report(const CpuRenderer& renderer, const Camera& camera, const BatchOptions& options, const char* filename)
+{
+    Image image, heatmap;
+    image.resize(options.width, options.height);
+    TraversalCostMap costs;
+    renderer.render(camera, image, options.mode, &costs);
+    cost_heatmap(costs, COUNT_NODES, 0, heatmap);
+    if (!write_ppm(heatmap, filename)) {
+        fprintf(stderr, "cannot write the heatmap to %s\n", filename);
+        return false;
+    }
+
+    for (int counter = COUNT_NODES; counter <= COUNT_RAYS; counter++) {
+        std::vector<uint32_t> histogram = cost_histogram(costs, (TraversalCounter)counter);
+        uint64_t total = 0;
+        for (size_t i = 0; i < costs.pixels.size(); i++)
+            total += costs.value(i, (TraversalCounter)counter);
+        printf("%s per pixel: mean %.1f\n", counterNames[counter], (double)total / std::max<size_t>(costs.pixels.size(), 1));
+        for (size_t bucket = 0; bucket < histogram.size(); bucket++) {
+            char range[32];
+            if (bucket < 2)
+                snprintf(range, sizeof(range), "%u", (uint32_t)bucket);
+            else
+                snprintf(range, sizeof(range), "%u-%u", 1u << (bucket - 1), (uint32_t)((1ull << bucket) - 1));
+            printf("  %12s  %u\n", range, histogram[bucket]);
+        }
+    }
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: refraction-headless [options]\n"
+        "  --data <dir>       directory holding shell.obj, sphere.obj and envmap.png (default ..)\n"
+        "  --grid <n>         n x n instance grid of spheres around the shell (default 0)\n"
+        "  --size <w>x<h>     image size (default 1024x768)\n"
+        "  --first <n>        first frame to render (default 0)\n"
+        "  --frames <n>       frames to render (default 1)\n"
+        "  --path <file>      camera keyframes, one \"frame eyeX eyeY eyeZ focusX focusY focusZ\"\n"
+        "                     per line (default: the drawFrame orbit)\n"
+        "  --hybrid           rasterize primary visibility instead of tracing it\n"
+        "  --env-cube <n>     bake the environment map into n x n cube faces and look misses up there\n"
+        "  --output <prefix>  write <prefix>NNNN.ppm per frame (default frame)\n"
+        "  --cost <file>      render only the first frame, counting each pixel's traversal work; write a\n"
+        "                     heatmap of BVH nodes visited to <file> and print histograms of every counter\n"
+        "  --serve <address>  hand the frames to workers connecting at unix:<path> or <host>:<port>\n"
+        "  --timeout <s>      with --serve, drop a worker that holds a frame this long (default 60)\n"
+        "  --worker <address> render frames for the coordinator at address; other options are ignored\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* data = "..";
+    const char* pathFile = nullptr;
+    const char* serve = nullptr;
+    const char* costFile = nullptr;
+    double timeout = 60.0;
+    unsigned grid = 0;
+    int envCubeSize = 0;
+    BatchOptions options;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--data") && hasValue)
+            data = argv[++i];
+        else if (!strcmp(argv[i], "--grid") && hasValue)
+            grid = (unsigned)atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--size") && hasValue && sscanf(argv[i + 1], "%dx%d", &options.width, &options.height) == 2)
+            i++;
+        else if (!strcmp(argv[i], "--first") && hasValue)
+            options.firstFrame = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && hasValue)
+            options.frameCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--path") && hasValue)
+            pathFile = argv[++i];
+        else if (!strcmp(argv[i], "--hybrid"))
+            options.mode = RENDER_HYBRID;
+        else if (!strcmp(argv[i], "--env-cube") && hasValue)
+            envCubeSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--output") && hasValue)
+            options.outputPrefix = argv[++i];
+        else if (!strcmp(argv[i], "--cost") && hasValue)
+            costFile = argv[++i];
+        else if (!strcmp(argv[i], "--serve") && hasValue)
+            serve = argv[++i];
+        else if (!strcmp(argv[i], "--timeout") && hasValue)
+            timeout = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--worker") && hasValue)
+            return run_worker(argv[i + 1]) ? 0 : 1;
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (options.width <= 0 || options.height <= 0 || options.frameCount <= 0 || envCubeSize < 0) {
+        usage();
+        return 1;
+    }
+
+    CameraPath path;
+    if (pathFile && !path.load(pathFile)) {
+        fprintf(stderr, "cannot read camera keyframes from %s\n", pathFile);
+        return 1;
+    }
+
+    if (serve) {
+        FarmJob job;
+        job.dataDirectory = data;
+        job.instanceGridSide = grid;
+        job.envCubeSize = (uint32_t)envCubeSize;
+        job.batch = options;
+        job.keys = path.keys;
+        FarmStats stats;
+        if (!run_coordinator(serve, job, timeout, stats))
+            return 1;
+        printf("%d frames in %.2f s, %.2f frames/s; latency p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", stats.batch.frames,
+            stats.batch.seconds, stats.batch.framesPerSecond, stats.batch.p50Ms, stats.batch.p90Ms, stats.batch.p99Ms, stats.batch.maxMs);
+        printf("%u workers joined, %u lost, %u frames reissued; pixels compressed %.1fx\n", stats.workersJoined, stats.workersLost,
+            stats.framesReissued, stats.compressedBytes ? (double)stats.rawBytes / stats.compressedBytes : 0.0);
+        return 0;
+    }
+
+    CpuDemoScene demo;
+    if (!demo.load(data, grid)) {
+        fprintf(stderr, "cannot load the scene from %s\n", data);
+        return 1;
+    }
+
+    CpuRenderer renderer;
+    renderer.scene = &demo.scene;
+    renderer.envMap = &demo.envMap;
+    if (envCubeSize) {
+        demo.envMap.bakeCubeMap(envCubeSize);
+        renderer.cubeEnvMap = true;
+    }
+    if (costFile)
+        return write_cost_report(renderer, path.at(options.firstFrame), options, costFile) ? 0 : 1;
+    BatchStats stats;
+    if (!render_batch(renderer, path, options, stats)) {
+        fprintf(stderr, "cannot write frames to %s\n", options.outputPrefix.c_str());
+        return 1;
+    }
+    printf("%d frames in %.2f s, %.2f frames/s; latency p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", stats.frames,
+        stats.seconds, stats.framesPerSecond, stats.p50Ms, stats.p90Ms, stats.p99Ms, stats.maxMs);
+    return 0;
+}
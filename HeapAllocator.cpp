@@ -0,0 +1,217 @@
+#include "HeapAllocator.hpp"
+
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Leftovers smaller than this stay with the allocation instead of becoming
+// free blocks of their own.
+constexpr uint64_t minBlockSize = 16;
+
+static inline int highest_bit(uint64_t x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(x);
+#endif
+}
+
+static inline int lowest_bit(uint64_t x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+// Size class of a block: sizes below secondLevelCount get a list each, then
+// every power of two is split into secondLevelCount lists.
+static void size_class(uint64_t size, int& firstLevel, int& secondLevel)
+{
+    if (size < HeapAllocator::secondLevelCount) {
+        firstLevel = 0;
+        secondLevel = (int)size;
+        return;
+    }
+    int bit = highest_bit(size);
+    firstLevel = bit - HeapAllocator::secondLevelBits + 1;
+    secondLevel = (int)(size >> (bit - HeapAllocator::secondLevelBits)) - HeapAllocator::secondLevelCount;
+}
+
+void HeapAllocator::reset(uint64_t capacity_)
+{
+    capacity = capacity_;
+    usedBytes = 0;
+    blocks.clear();
+    unusedBlocks.clear();
+    allocations.clear();
+    firstLevelMap = 0;
+    std::fill(&secondLevelMap[0], &secondLevelMap[firstLevelCount], 0);
+    if (capacity)
+        insertFree(newBlock(0, capacity));
+}
+
+uint32_t HeapAllocator::newBlock(uint64_t offset, uint64_t size)
+{
+    uint32_t index;
+    if (unusedBlocks.empty()) {
+        index = (uint32_t)blocks.size();
+        blocks.emplace_back();
+    } else {
+        index = unusedBlocks.back();
+        unusedBlocks.pop_back();
+    }
+    blocks[index] = { offset, size, none, none, none, none, false };
+    return index;
+}
+
+void HeapAllocator::insertFree(uint32_t block)
+{
+    int fl, sl;
+    size_class(blocks[block].size, fl, sl);
+    uint32_t head = (secondLevelMap[fl] >> sl) & 1 ? freeLists[fl][sl] : none;
+    blocks[block].free = true;
+    blocks[block].prevFree = none;
+    blocks[block].nextFree = head;
+    if (head != none)
+        blocks[head].prevFree = block;
+    freeLists[fl][sl] = block;
+    firstLevelMap |= 1ull << fl;
+    secondLevelMap[fl] |= 1u << sl;
+}
+
+void HeapAllocator::removeFree(uint32_t block)
+{
+    Block& b = blocks[block];
+    if (b.prevFree != none) {
+        blocks[b.prevFree].nextFree = b.nextFree;
+    } else {
+        int fl, sl;
+        size_class(b.size, fl, sl);
+        freeLists[fl][sl] = b.nextFree;
+        if (b.nextFree == none) {
+            secondLevelMap[fl] &= ~(1u << sl);
+            if (!secondLevelMap[fl])
+                firstLevelMap &= ~(1ull << fl);
+        }
+    }
+    if (b.nextFree != none)
+        blocks[b.nextFree].prevFree = b.prevFree;
+    b.free = false;
+}
+
+uint32_t HeapAllocator::split(uint32_t block, uint64_t size)
+{
+    uint32_t rest = newBlock(blocks[block].offset + size, blocks[block].size - size);
+    blocks[block].size = size;
+    blocks[rest].prevPhysical = block;
+    blocks[rest].nextPhysical = blocks[block].nextPhysical;
+    if (blocks[rest].nextPhysical != none)
+        blocks[blocks[rest].nextPhysical].prevPhysical = rest;
+    blocks[block].nextPhysical = rest;
+    return rest;
+}
+
+void HeapAllocator::merge(uint32_t block, uint32_t next)
+{
+    blocks[block].size += blocks[next].size;
+    blocks[block].nextPhysical = blocks[next].nextPhysical;
+    if (blocks[next].nextPhysical != none)
+        blocks[blocks[next].nextPhysical].prevPhysical = block;
+    unusedBlocks.push_back(next);
+}
+
+bool HeapAllocator::allocate(uint64_t size, uint64_t alignment, uint64_t& offset)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)))
+        return false;
+    size = std::max<uint64_t>(size, 1);
+    uint64_t needed = size + alignment - 1;
+    if (needed < size || needed > capacity)
+        return false;
+
+    // Round up to the next size class, so any block in the list found fits.
+    if (needed >= secondLevelCount) {
+        uint64_t rounded = needed + (1ull << (highest_bit(needed) - secondLevelBits)) - 1;
+        if (rounded < needed)
+            return false;
+        needed = rounded;
+    }
+    int fl, sl;
+    size_class(needed, fl, sl);
+    uint32_t secondMap = secondLevelMap[fl] & (~0u << sl);
+    if (!secondMap) {
+        uint64_t firstMap = firstLevelMap & (~0ull << (fl + 1));
+        if (!firstMap)
+            return false;
+        fl = lowest_bit(firstMap);
+        secondMap = secondLevelMap[fl];
+    }
+    sl = lowest_bit(secondMap);
+    uint32_t block = freeLists[fl][sl];
+    removeFree(block);
+
+    // Padding in front of an aligned start goes back on the free lists.
+    uint64_t aligned = (blocks[block].offset + alignment - 1) & ~(alignment - 1);
+    if (aligned > blocks[block].offset) {
+        uint32_t padding = block;
+        block = split(padding, aligned - blocks[padding].offset);
+        insertFree(padding);
+    }
+    if (blocks[block].size - size >= minBlockSize)
+        insertFree(split(block, size));
+
+    usedBytes += blocks[block].size;
+    allocations[aligned] = block;
+    offset = aligned;
+    return true;
+}
+
+void HeapAllocator::free(uint64_t offset)
+{
+    auto it = allocations.find(offset);
+    if (it == allocations.end())
+        return;
+    uint32_t block = it->second;
+    allocations.erase(it);
+    usedBytes -= blocks[block].size;
+
+    uint32_t next = blocks[block].nextPhysical;
+    if (next != none && blocks[next].free) {
+        removeFree(next);
+        merge(block, next);
+    }
+    uint32_t prev = blocks[block].prevPhysical;
+    if (prev != none && blocks[prev].free) {
+        removeFree(prev);
+        merge(prev, block);
+        block = prev;
+    }
+    insertFree(block);
+}
+
+HeapAllocatorStats HeapAllocator::stats() const
+{
+    HeapAllocatorStats s = {};
+    s.totalBytes = capacity;
+    s.usedBytes = usedBytes;
+    s.freeBytes = capacity - usedBytes;
+    s.allocationCount = (uint32_t)allocations.size();
+    s.freeBlockCount = (uint32_t)(blocks.size() - unusedBlocks.size() - allocations.size());
+    // The largest block is in the highest non-empty list.
+    if (firstLevelMap) {
+        int fl = highest_bit(firstLevelMap);
+        int sl = highest_bit(secondLevelMap[fl]);
+        for (uint32_t block = freeLists[fl][sl]; block != none; block = blocks[block].nextFree)
+            s.largestFreeBlock = std::max(s.largestFreeBlock, blocks[block].size);
+    }
+    s.fragmentation = s.freeBytes ? 1.0f - (float)s.largestFreeBlock / s.freeBytes : 0.0f;
+    return s;
+}
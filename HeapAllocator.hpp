@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+struct HeapAllocatorStats
+{
+    uint64_t totalBytes;
+    uint64_t usedBytes;        // including alignment slack kept with allocations
+    uint64_t freeBytes;
+    uint64_t largestFreeBlock;
+    uint32_t allocationCount;
+    uint32_t freeBlockCount;
+    // 1 - largestFreeBlock / freeBytes: 0 when the free space is one block,
+    // close to 1 when it is scattered over many small ones.
+    float fragmentation;
+};
+
+// Two-level segregated fit (TLSF) allocator over a range of capacity bytes.
+// Free blocks sit in lists by size class: the first level is the power of
+// two, the second splits that range linearly into 16. A bitmap per level
+// finds a list holding a large enough block in constant time, and freed
+// blocks merge with free neighbours at once. Only offsets are handed out, so
+// the memory itself can be a GPU heap, a buffer or anything else.
+struct HeapAllocator
+{
+    void reset(uint64_t capacity_);
+
+    // False if no free block can hold size bytes at the alignment, which must
+    // be a power of two.
+    bool allocate(uint64_t size, uint64_t alignment, uint64_t& offset);
+
+    // Release the allocation that allocate() returned offset for.
+    void free(uint64_t offset);
+
+    HeapAllocatorStats stats() const;
+
+    static constexpr int secondLevelBits = 4;
+    static constexpr int secondLevelCount = 1 << secondLevelBits;
+    static constexpr int firstLevelCount = 64 - secondLevelBits + 1;
+    static constexpr uint32_t none = ~0u;
+
+    struct Block
+    {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t prevPhysical; // neighbours in address order
+        uint32_t nextPhysical;
+        uint32_t prevFree;     // neighbours in the free list, if free
+        uint32_t nextFree;
+        bool free;
+    };
+
+    uint32_t newBlock(uint64_t offset, uint64_t size);
+    void insertFree(uint32_t block);
+    void removeFree(uint32_t block);
+    // Put the first size bytes of block in a block of their own; the rest
+    // becomes a new free block that is returned.
+    uint32_t split(uint32_t block, uint64_t size);
+    // Absorb next, which must follow block in memory, into block.
+    void merge(uint32_t block, uint32_t next);
+
+    uint64_t capacity = 0;
+    uint64_t usedBytes = 0;
+    std::vector<Block> blocks;
+    std::vector<uint32_t> unusedBlocks;  // entries of blocks to recycle
+    std::unordered_map<uint64_t, uint32_t> allocations; // offset to block
+    uint64_t firstLevelMap = 0;
+    uint32_t secondLevelMap[firstLevelCount] = {};
+    uint32_t freeLists[firstLevelCount][secondLevelCount];
+};
@@ -0,0 +1,35 @@
+#include "Image.hpp"
+
+#include <fstream>
+
+static unsigned char to_unorm8(float c)
+{
+    return (unsigned char)(clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+void to_rgb8(const Image& image, unsigned char* rgb)
+{
+    for (size_t i = 0; i < image.pixels.size(); i++) {
+        rgb[3 * i + 0] = to_unorm8(image.pixels[i].x);
+        rgb[3 * i + 1] = to_unorm8(image.pixels[i].y);
+        rgb[3 * i + 2] = to_unorm8(image.pixels[i].z);
+    }
+}
+
+bool write_ppm(const Image& image, const char* filename)
+{
+    std::vector<unsigned char> rgb(image.pixels.size() * 3);
+    to_rgb8(image, rgb.data());
+    return write_ppm(rgb.data(), image.width, image.height, filename);
+}
+
+bool write_ppm(const unsigned char* rgb, int width, int height, const char* filename)
+{
+    std::ofstream os(filename, std::ios_base::binary);
+    if (!os.is_open())
+        return false;
+
+    os << "P6\n" << width << " " << height << "\n255\n";
+    os.write((const char*)rgb, (size_t)width * height * 3);
+    return (bool)os;
+}
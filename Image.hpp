@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Math.hpp"
+#include <vector>
+
+// Linear RGB framebuffer for the CPU renderer.
+struct Image
+{
+    void resize(int width_, int height_) { width = width_; height = height_; pixels.assign(width * height, { 0.0f, 0.0f, 0.0f }); }
+    float3& at(int x, int y) { return pixels[y * width + x]; }
+    const float3& at(int x, int y) const { return pixels[y * width + x]; }
+
+    int width = 0;
+    int height = 0;
+    std::vector<float3> pixels;
+};
+
+// Saturate to 8 bits per channel the way the GPU's R8G8B8A8_UNORM target does.
+void to_rgb8(const Image& image, unsigned char* rgb);
+
+// Binary PPM (P6), readable by every image tool without extra dependencies.
+bool write_ppm(const Image& image, const char* filename);
+bool write_ppm(const unsigned char* rgb, int width, int height, const char* filename);
@@ -0,0 +1,215 @@
+#include "Bvh.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <thread>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+constexpr float INF = 1e30f;
+constexpr size_t sortBlockSize = 1 << 16;
+constexpr int radixBits = 8;
+constexpr int radixSize = 1 << radixBits;
+
+static inline int count_leading_zeros(uint64_t x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    return _BitScanReverse64(&index, x) ? 63 - (int)index : 64;
+#else
+    return x ? __builtin_clzll(x) : 64;
+#endif
+}
+
+// Spread the low bits of x so that there are two zero bits between each.
+static inline uint64_t expand_bits(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+void radix_sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int keyBits)
+{
+    size_t count = keys.size();
+    size_t blockCount = (count + sortBlockSize - 1) / sortBlockSize;
+    std::vector<uint64_t> keysOut(count);
+    std::vector<uint32_t> valuesOut(count);
+    std::vector<size_t> offsets(blockCount * radixSize);
+
+    for (int shift = 0; shift < keyBits; shift += radixBits) {
+        // Per-block digit histograms.
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallel_for(0, blockCount, 1, [&](size_t block) {
+            size_t* histogram = &offsets[block * radixSize];
+            size_t last = std::min(count, (block + 1) * sortBlockSize);
+            for (size_t i = block * sortBlockSize; i < last; i++)
+                histogram[(keys[i] >> shift) & (radixSize - 1)]++;
+        });
+
+        // Exclusive scan in digit-major, block-minor order gives each block
+        // its first output slot per digit, which keeps the sort stable. A
+        // pass in which every key has the same digit changes nothing.
+        size_t sum = 0;
+        bool trivial = false;
+        for (int digit = 0; digit < radixSize; digit++) {
+            size_t digitTotal = 0;
+            for (size_t block = 0; block < blockCount; block++) {
+                size_t n = offsets[block * radixSize + digit];
+                offsets[block * radixSize + digit] = sum;
+                sum += n;
+                digitTotal += n;
+            }
+            trivial |= digitTotal == count;
+        }
+        if (trivial)
+            continue;
+
+        parallel_for(0, blockCount, 1, [&](size_t block) {
+            size_t* next = &offsets[block * radixSize];
+            size_t last = std::min(count, (block + 1) * sortBlockSize);
+            for (size_t i = block * sortBlockSize; i < last; i++) {
+                size_t slot = next[(keys[i] >> shift) & (radixSize - 1)]++;
+                keysOut[slot] = keys[i];
+                valuesOut[slot] = values[i];
+            }
+        });
+        keys.swap(keysOut);
+        values.swap(valuesOut);
+    }
+}
+
+namespace {
+
+// Internal node of the Karras hierarchy. It covers sorted primitives
+// [first, last]; the left child covers [first, split].
+struct RadixNode
+{
+    uint32_t first;
+    uint32_t last;
+    uint32_t split;
+};
+
+} // namespace
+
+void build_lbvh_nodes(uint32_t count, const float3* primMin, const float3* primMax, const float3* centroids,
+    const BvhBuildOptions& options, std::vector<BvhNode>& nodes, std::vector<uint32_t>& primIndices)
+{
+    nodes.clear();
+    primIndices.resize(count);
+    if (count == 0)
+        return;
+
+    // Morton codes of the centroids, quantized within the centroid bounds.
+    float3 cmin = { INF, INF, INF }, cmax = { -INF, -INF, -INF };
+    for (uint32_t i = 0; i < count; i++) {
+        cmin = min(cmin, centroids[i]);
+        cmax = max(cmax, centroids[i]);
+    }
+    int axisBits = options.mortonBits > 30 ? 21 : 10;
+    float cells = (float)((1u << axisBits) - 1);
+    float3 extent = cmax - cmin;
+    float3 scale = { extent.x > 0.0f ? cells / extent.x : 0.0f, extent.y > 0.0f ? cells / extent.y : 0.0f,
+        extent.z > 0.0f ? cells / extent.z : 0.0f };
+    std::vector<uint64_t> codes(count);
+    parallel_for(0, count, 4096, [&](size_t i) {
+        float3 p = (centroids[i] - cmin) * scale;
+        codes[i] = expand_bits((uint64_t)p.x) << 2 | expand_bits((uint64_t)p.y) << 1 | expand_bits((uint64_t)p.z);
+        primIndices[i] = (uint32_t)i;
+    });
+    int keyBits = 3 * axisBits;
+    radix_sort(codes, primIndices, keyBits);
+
+    // Karras 2012: every internal node is found independently from the sorted
+    // codes. Equal codes are told apart by their position.
+    auto delta = [&](int64_t i, int64_t j) -> int {
+        if (j < 0 || j >= (int64_t)count)
+            return -1;
+        uint64_t x = codes[i] ^ codes[j];
+        return x ? count_leading_zeros(x << (64 - keyBits)) : keyBits + count_leading_zeros((uint64_t)(i ^ j));
+    };
+    std::vector<RadixNode> radixNodes(count > 1 ? count - 1 : 0);
+    parallel_for(0, radixNodes.size(), 4096, [&](size_t index) {
+        int64_t i = (int64_t)index;
+        int64_t d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+        int minDelta = delta(i, i - d);
+        int64_t maxLength = 2;
+        while (delta(i, i + maxLength * d) > minDelta)
+            maxLength *= 2;
+        int64_t length = 0;
+        for (int64_t t = maxLength / 2; t >= 1; t /= 2) {
+            if (delta(i, i + (length + t) * d) > minDelta)
+                length += t;
+        }
+        int64_t j = i + length * d;
+
+        int nodeDelta = delta(i, j);
+        int64_t split = 0;
+        for (int64_t t = (length + 1) / 2;; t = (t + 1) / 2) {
+            if (delta(i, i + (split + t) * d) > nodeDelta)
+                split += t;
+            if (t == 1)
+                break;
+        }
+        radixNodes[index] = { (uint32_t)std::min(i, j), (uint32_t)std::max(i, j), (uint32_t)(i + split * d + std::min<int64_t>(d, 0)) };
+    });
+
+    // Convert to the Bvh layout: children stored in pairs, and any subtree
+    // small enough becomes one leaf, which works because every subtree covers
+    // a contiguous run of the sorted primitives.
+    uint32_t maxLeafSize = (uint32_t)std::max(options.maxLeafSize, 1);
+    nodes.reserve(2 * (size_t)count);
+    BvhNode root = {};
+    root.leftFirst = 0;
+    root.count = count;
+    nodes.push_back(root);
+    struct Pending
+    {
+        uint32_t node;
+        uint32_t radix;
+    };
+    std::vector<Pending> stack = { { 0, 0 } };
+    while (!stack.empty()) {
+        Pending pending = stack.back();
+        stack.pop_back();
+        BvhNode& node = nodes[pending.node];
+        if (node.count <= maxLeafSize)
+            continue;
+
+        const RadixNode& radix = radixNodes[pending.radix];
+        BvhNode left = {}, right = {};
+        left.leftFirst = radix.first;
+        left.count = radix.split - radix.first + 1;
+        right.leftFirst = radix.split + 1;
+        right.count = radix.last - radix.split;
+        uint32_t leftIndex = (uint32_t)nodes.size();
+        node.leftFirst = leftIndex;
+        node.count = 0;
+        nodes.push_back(left);
+        nodes.push_back(right);
+        stack.push_back({ leftIndex + 1, radix.split + 1 });
+        stack.push_back({ leftIndex, radix.split });
+    }
+
+    // Children always follow their parent, so one backwards sweep sets the bounds.
+    for (size_t i = nodes.size(); i-- > 0;) {
+        BvhNode& node = nodes[i];
+        if (node.count == 0) {
+            node.bmin = min(nodes[node.leftFirst].bmin, nodes[node.leftFirst + 1].bmin);
+            node.bmax = max(nodes[node.leftFirst].bmax, nodes[node.leftFirst + 1].bmax);
+            continue;
+        }
+        node.bmin = { INF, INF, INF };
+        node.bmax = { -INF, -INF, -INF };
+        for (uint32_t j = 0; j < node.count; j++) {
+            uint32_t prim = primIndices[node.leftFirst + j];
+            node.bmin = min(node.bmin, primMin[prim]);
+            node.bmax = max(node.bmax, primMax[prim]);
+        }
+    }
+}
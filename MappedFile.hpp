@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+// Read-only memory mapping of a whole file.
+struct MappedFile
+{
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const char* filename);
+    void close();
+
+    const void* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
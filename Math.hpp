@@ -0,0 +1,85 @@
+#pragma once
+
+#include <math.h>
+
+// Small vector type for the CPU side. Named after its HLSL counterpart so code
+// ported from RayTracing.hlsl reads the same.
+struct float3
+{
+    float x, y, z;
+};
+
+struct float4
+{
+    float x, y, z, w;
+};
+
+inline float3 operator+(float3 a, float3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+inline float3 operator-(float3 a, float3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline float3 operator-(float3 a) { return { -a.x, -a.y, -a.z }; }
+inline float3 operator*(float3 a, float3 b) { return { a.x * b.x, a.y * b.y, a.z * b.z }; }
+inline float3 operator*(float3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+inline float3 operator*(float s, float3 a) { return { a.x * s, a.y * s, a.z * s }; }
+inline float3 operator/(float3 a, float s) { return a * (1.0f / s); }
+inline float3& operator+=(float3& a, float3 b) { a = a + b; return a; }
+
+inline float dot(float3 a, float3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float3 cross(float3 a, float3 b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+inline float length(float3 a) { return sqrtf(dot(a, a)); }
+inline float3 normalize(float3 a) { return a / length(a); }
+
+inline float3 min(float3 a, float3 b) { return { fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z) }; }
+inline float3 max(float3 a, float3 b) { return { fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z) }; }
+inline float component(float3 a, int axis) { return axis == 0 ? a.x : (axis == 1 ? a.y : a.z); }
+
+inline float clamp(float x, float lo, float hi) { return x < lo ? lo : (x > hi ? hi : x); }
+
+// Row-major 4x4 matrix using the DirectXMath conventions (row vectors, so
+// a * b applies a first), so CPU cameras match the XMMATRIX values the GPU gets.
+struct float4x4
+{
+    float m[4][4];
+};
+
+inline float4x4 operator*(const float4x4& a, const float4x4& b)
+{
+    float4x4 r;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+    return r;
+}
+
+float4x4 inverse(const float4x4& a);
+
+// Affine transform laid out like D3D12_RAYTRACING_INSTANCE_DESC::Transform:
+// three rows acting on column vectors, the last column is the translation.
+struct float3x4
+{
+    float m[3][4];
+};
+
+inline float3 transform_point(const float3x4& t, float3 p)
+{
+    return { t.m[0][0] * p.x + t.m[0][1] * p.y + t.m[0][2] * p.z + t.m[0][3],
+        t.m[1][0] * p.x + t.m[1][1] * p.y + t.m[1][2] * p.z + t.m[1][3],
+        t.m[2][0] * p.x + t.m[2][1] * p.y + t.m[2][2] * p.z + t.m[2][3] };
+}
+
+inline float3 transform_vector(const float3x4& t, float3 v)
+{
+    return { t.m[0][0] * v.x + t.m[0][1] * v.y + t.m[0][2] * v.z,
+        t.m[1][0] * v.x + t.m[1][1] * v.y + t.m[1][2] * v.z,
+        t.m[2][0] * v.x + t.m[2][1] * v.y + t.m[2][2] * v.z };
+}
+
+// Multiply by the transpose of the 3x3 part. With the inverse transform this
+// carries normals from object to world space.
+inline float3 transform_normal_transposed(const float3x4& t, float3 n)
+{
+    return { t.m[0][0] * n.x + t.m[1][0] * n.y + t.m[2][0] * n.z,
+        t.m[0][1] * n.x + t.m[1][1] * n.y + t.m[2][1] * n.z,
+        t.m[0][2] * n.x + t.m[1][2] * n.y + t.m[2][2] * n.z };
+}
+
+float3x4 inverse(const float3x4& t);
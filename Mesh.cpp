@@ -1,6 +1,9 @@
 #include "Mesh.hpp"
 
 #include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <string>
 #include <vector>
 
 bool Mesh::load(const char* filename)
@@ -35,79 +38,3 @@ bool Mesh::load(const char* filename)
     }
     return true;
 }
-
-D3D12_RAYTRACING_GEOMETRY_DESC Mesh::raytracingGeometry() const
-{
-    D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc;
-    geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-    geometryDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_NO_DUPLICATE_ANYHIT_INVOCATION;
-    geometryDesc.Triangles.VertexBuffer.StartAddress = vb->GetGPUVirtualAddress();
-    geometryDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(Vertex);
-    geometryDesc.Triangles.VertexCount = verts.size();
-    geometryDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-    geometryDesc.Triangles.IndexBuffer = ib->GetGPUVirtualAddress();
-    geometryDesc.Triangles.IndexFormat = DXGI_FORMAT_R32_UINT;
-    geometryDesc.Triangles.IndexCount = indices.size();
-    geometryDesc.Triangles.Transform3x4 = 0;
-    return geometryDesc;
-}
-
-void Mesh::upload(ComPtr<ID3D12Device5>& device)
-{
-    D3D12_RESOURCE_DESC resourceDesc;
-    resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-    resourceDesc.Alignment = 0;
-    resourceDesc.Width = verts.size() * sizeof(Vertex);
-    resourceDesc.Height = 1;
-    resourceDesc.DepthOrArraySize = 1;
-    resourceDesc.MipLevels = 1;
-    resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
-    resourceDesc.SampleDesc.Count = 1;
-    resourceDesc.SampleDesc.Quality = 0;
-    resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-    resourceDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
-
-    D3D12_HEAP_PROPERTIES heapProperties;
-    heapProperties.Type = D3D12_HEAP_TYPE_UPLOAD;
-    heapProperties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-    heapProperties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-    heapProperties.CreationNodeMask = 1;
-    heapProperties.VisibleNodeMask = 1;
-
-    device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
-        D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&vb));
-
-    // Copy the triangle data to the vertex buffer.
-    UINT8* pVertexDataBegin;
-    D3D12_RANGE readRange = { 0, 0 };        // We do not intend to read from this resource on the CPU.
-    vb->Map(0, &readRange, reinterpret_cast<void**>(&pVertexDataBegin));
-    memcpy(pVertexDataBegin, verts.data(), resourceDesc.Width);
-    vb->Unmap(0, nullptr);
-
-    resourceDesc.Width = indices.size() * sizeof(uint32_t);
-    device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
-        D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&ib));
-
-    ib->Map(0, &readRange, reinterpret_cast<void**>(&pVertexDataBegin));
-    memcpy(pVertexDataBegin, indices.data(), resourceDesc.Width);
-    ib->Unmap(0, nullptr);
-}
-
-void Mesh::draw(ComPtr<ID3D12Device5>& device, ComPtr<ID3D12GraphicsCommandList5>& cmd)
-{
-    cmd->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-    D3D12_INDEX_BUFFER_VIEW indexView;
-    indexView.BufferLocation = ib->GetGPUVirtualAddress();
-    indexView.Format = DXGI_FORMAT_R32_UINT;
-    indexView.SizeInBytes = indices.size() * sizeof(uint32_t);
-    cmd->IASetIndexBuffer(&indexView);
-
-    D3D12_VERTEX_BUFFER_VIEW vertexView;
-    vertexView.BufferLocation = vb->GetGPUVirtualAddress();
-    vertexView.StrideInBytes = sizeof(Vertex);
-    vertexView.SizeInBytes = verts.size() * sizeof(Vertex);
-    cmd->IASetVertexBuffers(0, 1, &vertexView);
-
-    cmd->DrawIndexedInstanced(indices.size(), 1, 0, 0, 0);
-}
\ No newline at end of file
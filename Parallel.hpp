@@ -0,0 +1,49 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Set while a thread works for a parallel_for that runs on several threads.
+inline thread_local bool insideParallelFor = false;
+
+// Run fn(i) for every i in [begin, end) on all hardware threads. Work is handed
+// out in chunks of `grain` indices so uneven items still balance. A call made
+// from inside another parallel_for's fn runs inline, so the outer loop's
+// threads are not oversubscribed.
+template <typename F>
+void parallel_for(size_t begin, size_t end, size_t grain, F&& fn)
+{
+    if (begin >= end)
+        return;
+    if (insideParallelFor) {
+        for (size_t i = begin; i < end; i++)
+            fn(i);
+        return;
+    }
+    grain = std::max<size_t>(grain, 1);
+    size_t chunks = (end - begin + grain - 1) / grain;
+    size_t threadCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), chunks);
+
+    std::atomic<size_t> next(begin);
+    auto worker = [&]() {
+        insideParallelFor = threadCount > 1;
+        for (;;) {
+            size_t first = next.fetch_add(grain);
+            if (first >= end)
+                break;
+            size_t last = std::min(first + grain, end);
+            for (size_t i = first; i < last; i++)
+                fn(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++)
+        threads.emplace_back(worker);
+    worker();
+    insideParallelFor = false;
+    for (auto& thread : threads)
+        thread.join();
+}
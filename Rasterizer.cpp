@@ -0,0 +1,198 @@
+#include "Rasterizer.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+
+constexpr int tileSize = 32;
+constexpr size_t binChunks = 64;
+constexpr float nearDepth = 0.01f;
+
+namespace {
+
+struct ClipVertex
+{
+    float4 clip;
+    float3 bary; // position within the source triangle
+};
+
+// A triangle after projection and near-plane clipping. Corners keep their
+// barycentric position in the source triangle so attributes resolve later.
+struct ScreenTriangle
+{
+    float x[3], y[3];
+    float invW[3];
+    float3 bary[3];
+    uint32_t instance;
+    uint32_t prim;
+    int minX, minY, maxX, maxY;
+};
+
+struct Fragment
+{
+    float depth;
+    float3 bary;
+    uint32_t instance;
+    uint32_t prim;
+};
+
+} // namespace
+
+static inline float edge(float ax, float ay, float bx, float by, float px, float py)
+{
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+static int clip_near(const ClipVertex* in, ClipVertex* out)
+{
+    int count = 0;
+    for (int i = 0; i < 3; i++) {
+        const ClipVertex& a = in[i];
+        const ClipVertex& b = in[(i + 1) % 3];
+        float da = a.clip.w - nearDepth, db = b.clip.w - nearDepth;
+        if (da >= 0.0f)
+            out[count++] = a;
+        if ((da >= 0.0f) != (db >= 0.0f)) {
+            float s = da / (da - db);
+            ClipVertex& v = out[count++];
+            v.clip = { a.clip.x + s * (b.clip.x - a.clip.x), a.clip.y + s * (b.clip.y - a.clip.y),
+                0.0f, a.clip.w + s * (b.clip.w - a.clip.w) };
+            v.bary = a.bary + s * (b.bary - a.bary);
+        }
+    }
+    return count;
+}
+
+void rasterize(const Scene& scene, const Camera& camera, GBuffer& gbuffer)
+{
+    int width = gbuffer.width, height = gbuffer.height;
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    size_t tileCount = (size_t)tilesX * tilesY;
+
+    // Triangles of all instances are numbered consecutively, instance by instance.
+    std::vector<size_t> firstTriangle(scene.instances.size() + 1, 0);
+    for (size_t i = 0; i < scene.instances.size(); i++)
+        firstTriangle[i + 1] = firstTriangle[i] + scene.meshes[scene.instances[i].mesh]->triCount;
+    size_t triCount = firstTriangle.back();
+
+    // Setup and binning: each chunk of triangles fills its own bins, and tiles
+    // later walk the chunks in order, so the result does not depend on timing.
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(binChunks, triCount));
+    std::vector<std::vector<ScreenTriangle>> triangles(chunkCount);
+    std::vector<std::vector<std::vector<uint32_t>>> bins(chunkCount, std::vector<std::vector<uint32_t>>(tileCount));
+    parallel_for(0, chunkCount, 1, [&](size_t chunk) {
+        size_t first = triCount * chunk / chunkCount;
+        size_t last = triCount * (chunk + 1) / chunkCount;
+        uint32_t instance = (uint32_t)(std::upper_bound(firstTriangle.begin(), firstTriangle.end(), first) - firstTriangle.begin() - 1);
+        for (size_t triangle = first; triangle < last; triangle++) {
+            while (triangle >= firstTriangle[instance + 1])
+                instance++;
+            uint32_t prim = (uint32_t)(triangle - firstTriangle[instance]);
+            const float3x4& transform = scene.instances[instance].transform;
+            const Mesh& mesh = *scene.meshes[scene.instances[instance].mesh]->mesh;
+            ClipVertex corners[3];
+            for (int k = 0; k < 3; k++) {
+                corners[k].clip = project(camera, transform_point(transform, vertex_position(mesh, prim, k)));
+                corners[k].bary = { k == 0 ? 1.0f : 0.0f, k == 1 ? 1.0f : 0.0f, k == 2 ? 1.0f : 0.0f };
+            }
+            ClipVertex polygon[4];
+            int polygonSize = clip_near(corners, polygon);
+
+            for (int fan = 1; fan + 1 < polygonSize; fan++) {
+                const ClipVertex* v[3] = { &polygon[0], &polygon[fan], &polygon[fan + 1] };
+                ScreenTriangle tri;
+                tri.instance = instance;
+                tri.prim = prim;
+                float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+                for (int k = 0; k < 3; k++) {
+                    tri.invW[k] = 1.0f / v[k]->clip.w;
+                    tri.x[k] = (v[k]->clip.x * tri.invW[k] + 1.0f) * 0.5f * width;
+                    tri.y[k] = (1.0f - v[k]->clip.y * tri.invW[k]) * 0.5f * height;
+                    tri.bary[k] = v[k]->bary;
+                    minX = std::min(minX, tri.x[k]);
+                    maxX = std::max(maxX, tri.x[k]);
+                    minY = std::min(minY, tri.y[k]);
+                    maxY = std::max(maxY, tri.y[k]);
+                }
+                if (edge(tri.x[0], tri.y[0], tri.x[1], tri.y[1], tri.x[2], tri.y[2]) == 0.0f)
+                    continue;
+
+                // Pixels whose centres fall inside the bounding box.
+                tri.minX = std::max(0, (int)ceilf(minX - 0.5f));
+                tri.minY = std::max(0, (int)ceilf(minY - 0.5f));
+                tri.maxX = std::min(width - 1, (int)floorf(maxX - 0.5f));
+                tri.maxY = std::min(height - 1, (int)floorf(maxY - 0.5f));
+                if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+                    continue;
+
+                uint32_t index = (uint32_t)triangles[chunk].size();
+                triangles[chunk].push_back(tri);
+                for (int ty = tri.minY / tileSize; ty <= tri.maxY / tileSize; ty++)
+                    for (int tx = tri.minX / tileSize; tx <= tri.maxX / tileSize; tx++)
+                        bins[chunk][ty * tilesX + tx].push_back(index);
+            }
+        }
+    });
+
+    parallel_for(0, tileCount, 1, [&](size_t tile) {
+        int x0 = (int)(tile % tilesX) * tileSize, y0 = (int)(tile / tilesX) * tileSize;
+        int x1 = std::min(width, x0 + tileSize), y1 = std::min(height, y0 + tileSize);
+        Fragment fragments[tileSize * tileSize];
+        for (Fragment& f : fragments)
+            f.depth = 1e30f;
+
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            for (uint32_t index : bins[chunk][tile]) {
+                const ScreenTriangle& tri = triangles[chunk][index];
+                float area = edge(tri.x[0], tri.y[0], tri.x[1], tri.y[1], tri.x[2], tri.y[2]);
+                float invArea = 1.0f / area;
+                int minX = std::max(x0, tri.minX), maxX = std::min(x1 - 1, tri.maxX);
+                int minY = std::max(y0, tri.minY), maxY = std::min(y1 - 1, tri.maxY);
+                for (int y = minY; y <= maxY; y++) {
+                    float py = y + 0.5f;
+                    for (int x = minX; x <= maxX; x++) {
+                        float px = x + 0.5f;
+                        // Normalising by the signed area accepts both windings.
+                        float l0 = edge(tri.x[1], tri.y[1], tri.x[2], tri.y[2], px, py) * invArea;
+                        float l1 = edge(tri.x[2], tri.y[2], tri.x[0], tri.y[0], px, py) * invArea;
+                        float l2 = edge(tri.x[0], tri.y[0], tri.x[1], tri.y[1], px, py) * invArea;
+                        if (l0 < 0.0f || l1 < 0.0f || l2 < 0.0f)
+                            continue;
+
+                        float w0 = l0 * tri.invW[0], w1 = l1 * tri.invW[1], w2 = l2 * tri.invW[2];
+                        float invDepth = w0 + w1 + w2;
+                        Fragment& f = fragments[(y - y0) * tileSize + (x - x0)];
+                        if (1.0f / invDepth >= f.depth)
+                            continue;
+                        f.depth = 1.0f / invDepth;
+                        f.bary = (w0 * tri.bary[0] + w1 * tri.bary[1] + w2 * tri.bary[2]) / invDepth;
+                        f.instance = tri.instance;
+                        f.prim = tri.prim;
+                    }
+                }
+            }
+        }
+
+        // Attributes are only resolved for the surviving fragment of each pixel.
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                const Fragment& f = fragments[(y - y0) * tileSize + (x - x0)];
+                GBufferSample& sample = gbuffer.samples[y * width + x];
+                if (f.depth == 1e30f) {
+                    sample.t = -1.0f;
+                    continue;
+                }
+                // Facing is decided in object space, as the ray tracer does.
+                const Mesh& mesh = *scene.meshes[scene.instances[f.instance].mesh]->mesh;
+                float3 a = vertex_position(mesh, f.prim, 0);
+                float3 b = vertex_position(mesh, f.prim, 1);
+                float3 c = vertex_position(mesh, f.prim, 2);
+                float3 p = f.bary.x * a + f.bary.y * b + f.bary.z * c;
+                float3 eye = transform_point(scene.worldToObject[f.instance], camera.origin);
+                sample.t = length(transform_point(scene.instances[f.instance].transform, p) - camera.origin);
+                sample.normal = scene.surfaceNormal({ { sample.t, f.bary.y, f.bary.z, f.prim }, f.instance });
+                sample.front = dot(cross(b - a, c - a), p - eye) < 0.0f;
+            }
+        }
+    });
+}
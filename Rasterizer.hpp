@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include <vector>
+
+// What the camera sees at each pixel centre. This is the CPU counterpart of the
+// hybrid mode's G-buffer target written by Shader1.hlsl.
+struct GBufferSample
+{
+    float t = -1.0f;    // distance along the pixel's camera ray, < 0 where nothing was hit
+    float3 normal = {}; // interpolated vertex normal
+    bool front = false; // front facing by the DXR winding convention
+};
+
+struct GBuffer
+{
+    void resize(int width_, int height_) { width = width_; height = height_; samples.assign(width * height, GBufferSample()); }
+
+    int width = 0;
+    int height = 0;
+    std::vector<GBufferSample> samples;
+};
+
+// Tile-binned software rasterizer. Triangles are set up and binned into screen
+// tiles in parallel, then each tile is rasterized independently with its own
+// depth buffer, so no pixel is ever touched by two threads.
+void rasterize(const Scene& scene, const Camera& camera, GBuffer& gbuffer);
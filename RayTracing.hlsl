@@ -1,6 +1,17 @@
 struct SceneConstants {
 	float4x4 proj_inv;
+	float4x4 prev_proj_inv;
 	float4 camera_loc;
+	float4 prev_camera_loc;
+	uint frame_index;
+	uint refresh_interval;
+	uint reprojection;
+	uint history_valid;
+	uint hybrid;
+	// Slots of the views below in the descriptor heap.
+	uint render_target_index;
+	uint env_map_index;
+	uint gbuffer_index;
 };
 struct Vertex {
 	float3 position;
@@ -9,13 +20,29 @@ struct Vertex {
 };
 
 ConstantBuffer<SceneConstants> sceneConstants : register(b0);
-RWTexture2D<float4> RenderTarget : register(u0);
 RaytracingAccelerationStructure Scene : register(t0);
-StructuredBuffer<uint> Indices : register(t1, space0);
-StructuredBuffer<Vertex> Vertices : register(t2, space0);
-Texture2D<float4> EnvironmentMap : register(t3);
+// Local root arguments: the buffers of the mesh whose hit group record is in use.
+StructuredBuffer<uint> Indices : register(t0, space1);
+StructuredBuffer<Vertex> Vertices : register(t1, space1);
+// The whole descriptor heap, bindless: views are found by the indices in
+// sceneConstants, which are the same for every thread.
+Texture2D<float4> Textures[] : register(t0, space2);
+RWTexture2D<float4> Images[] : register(u0, space2);
 SamplerState Sampler : register(s0);
 
+// Primary hit of every pixel for the last two frames, indexed by frame parity.
+struct HistorySample {
+	float3 position;
+	uint hit;
+	float3 normal;
+	float pad;
+	float3 color;
+	float pad2;
+};
+RWStructuredBuffer<HistorySample> History : register(u1);
+// Running count of pixels whose path was reused; read back by the CPU.
+RWByteAddressBuffer Stats : register(u2);
+
 struct Payload {
 	float3 color;
 	float3 mask;
@@ -23,6 +50,12 @@ struct Payload {
 	uint count;
 };
 
+// Primary visibility only: the surface is shaded from RayGen.
+struct PrimaryPayload {
+	float3 normal;
+	float t;
+};
+
 // Generate a ray in world space for a camera pixel corresponding to an index from the dispatched 2D grid.
 inline void GenerateCameraRay(uint2 index, out float3 dir, out float3 origin)
 {
@@ -39,30 +72,6 @@ inline void GenerateCameraRay(uint2 index, out float3 dir, out float3 origin)
 	dir = normalize(R.xyz);
 }
 
-[shader("raygeneration")]
-void RayGen()
-{
-	float3 origin,dir;
-
-	GenerateCameraRay(DispatchRaysIndex().xy, dir, origin);
-
-	RayDesc ray;
-	ray.Origin = origin;
-	ray.Direction = dir;
-	ray.TMin = 0.0001;
-	ray.TMax = 100.0;
-
-	Payload payload;
-	payload.color = float3(0.0,0.0,0.0);
-	payload.mask = float3(1.0,1.0,1.0);
-	payload.outside = true;
-	payload.count = 0;
-	TraceRay(Scene, RAY_FLAG_CULL_BACK_FACING_TRIANGLES, 0xff, 0, 0, 0, ray, payload);
-
-	RenderTarget[DispatchRaysIndex().xy] = float4(payload.color.xyz,1.0);
-
-}
-
 float3 ReflectRay(float3 I, float3 N) {
 	return I - 2.0 * dot(N, I) * N;
 }
@@ -76,23 +85,27 @@ bool RefractRay(out float3 R, float3 I, float3 N, float eta) {
 }
 
 
-[shader("closesthit")]
-void ClosestHit(inout Payload payload, BuiltInTriangleIntersectionAttributes attrs)
+float3 SurfaceNormal(BuiltInTriangleIntersectionAttributes attrs)
 {
-	if (payload.count < 5) {
-		float3 A = Vertices[Indices[PrimitiveIndex() * 3 + 0]].norm;
-		float3 B = Vertices[Indices[PrimitiveIndex() * 3 + 1]].norm;
-		float3 C = Vertices[Indices[PrimitiveIndex() * 3 + 2]].norm;
-		float3 N = normalize(A + attrs.barycentrics.x*(B-A) + attrs.barycentrics.y*(C-A));
+	float3 A = Vertices[Indices[PrimitiveIndex() * 3 + 0]].norm;
+	float3 B = Vertices[Indices[PrimitiveIndex() * 3 + 1]].norm;
+	float3 C = Vertices[Indices[PrimitiveIndex() * 3 + 2]].norm;
+	float3 N = A + attrs.barycentrics.x*(B-A) + attrs.barycentrics.y*(C-A);
+	// Object to world space through the inverse transpose of the instance transform.
+	return normalize(mul(N, (float3x3)WorldToObject3x4()));
+}
 
-		float3 intersection = WorldRayOrigin() + RayTCurrent() * WorldRayDirection();
-		
+// Shade a surface hit by a ray with direction I. Called from ClosestHit and,
+// for primary hits, directly from RayGen.
+void ShadeSurface(inout Payload payload, float3 intersection, float3 I, float3 N)
+{
+	if (payload.count < 5) {
 		float3 dir1;
 
 		float R0 = (0.2 / 2.2) * (0.2 / 2.2);
-		float R = R0 * (1.0 - R0) * pow(1.0 - dot(WorldRayDirection(), payload.outside ? N : -N), 5);
+		float R = R0 * (1.0 - R0) * pow(1.0 - dot(I, payload.outside ? N : -N), 5);
 
-		if (RefractRay(dir1, WorldRayDirection(), payload.outside? N:-N, payload.outside ? (1.0/1.3) : 1.3)) {
+		if (RefractRay(dir1, I, payload.outside? N:-N, payload.outside ? (1.0/1.3) : 1.3)) {
 			RayDesc ray;
 			ray.Origin = intersection;
 			ray.Direction = dir1;
@@ -100,6 +113,7 @@ void ClosestHit(inout Payload payload, BuiltInTriangleIntersectionAttributes att
 			ray.TMax = 1000.0;
 
 			Payload payload2;
+			payload2.color = float3(0.0,0.0,0.0);
 			payload2.count = payload.count+1;
 			payload2.mask = float3(1.0,1.0,1.0);
 			payload2.outside = !payload.outside;
@@ -110,11 +124,12 @@ void ClosestHit(inout Payload payload, BuiltInTriangleIntersectionAttributes att
 		if (payload.count < 2) {
 			RayDesc ray;
 			ray.Origin = intersection;
-			ray.Direction = normalize(ReflectRay(WorldRayDirection(), payload.outside ? N : -N));
+			ray.Direction = normalize(ReflectRay(I, payload.outside ? N : -N));
 			ray.TMin = 0.001;
 			ray.TMax = 1000.0;
 
 			Payload payload2;
+			payload2.color = float3(0.0,0.0,0.0);
 			payload2.count = payload.count+1;
 			payload2.mask = float3(1.0,1.0,1.0);
 			payload2.outside = payload.outside;
@@ -124,14 +139,158 @@ void ClosestHit(inout Payload payload, BuiltInTriangleIntersectionAttributes att
 	}
 }
 
-[shader("miss")]
-void Miss(inout Payload payload)
+[shader("closesthit")]
+void ClosestHit(inout Payload payload, BuiltInTriangleIntersectionAttributes attrs)
+{
+	float3 intersection = WorldRayOrigin() + RayTCurrent() * WorldRayDirection();
+	ShadeSurface(payload, intersection, WorldRayDirection(), SurfaceNormal(attrs));
+}
+
+[shader("closesthit")]
+void PrimaryHit(inout PrimaryPayload payload, BuiltInTriangleIntersectionAttributes attrs)
 {
+	payload.normal = SurfaceNormal(attrs);
+	payload.t = RayTCurrent();
+}
+
+// Polynomial atan2/acos, kept in sync with EnvMap.cpp so both renderers pick
+// the same texel. |atan error| < 2e-6 rad, |acos error| < 5e-7 rad.
+float FastAtan2(float y, float x) {
+	float ax = abs(x), ay = abs(y);
+	float t = min(ax, ay) / max(max(ax, ay), 1e-30);
+	float t2 = t * t;
+	float r = t * (0.99997726 + t2 * (-0.33262347 + t2 * (0.19354346 + t2 * (-0.11643287 + t2 * (0.05265332 + t2 * -0.01172120)))));
+	r = ay > ax ? 1.57079633 - r : r;
+	r = x < 0.0 ? 3.14159265 - r : r;
+	return y < 0.0 ? -r : r;
+}
+
+float FastAcos(float x) {
+	float a = min(abs(x), 1.0);
+	float p = 1.5707963050 + a * (-0.2145988016 + a * (0.0889789874 + a * (-0.0501743046
+		+ a * (0.0308918810 + a * (-0.0170881256 + a * (0.0066700901 + a * -0.0012624911))))));
+	p *= sqrt(1.0 - a);
+	return x < 0.0 ? 3.14159265 - p : p;
+}
+
+float3 EnvironmentColor(float3 r)
+{
+	Texture2D<float4> EnvironmentMap = Textures[sceneConstants.env_map_index];
 	uint width,height;
 	EnvironmentMap.GetDimensions(width, height);
-	float3 r = WorldRayDirection();
-	float theta = width*(atan2(r.x,r.z) / 3.14159 + 1.0)/2;
-	float phi   = height*(acos(r.y) / 3.14159);
-	payload.color = payload.mask * EnvironmentMap[float2(theta,phi)];
-	((WorldRayDirection().x*WorldRayDirection().y* WorldRayDirection().z >0)? 1.0 : 0.0);
+	float theta = min(width*(FastAtan2(r.x,r.z) / 3.14159265 + 1.0)/2, width - 1);
+	float phi   = min(height*(FastAcos(r.y) / 3.14159265), height - 1);
+	return EnvironmentMap[float2(theta,phi)].xyz;
+}
+
+[shader("miss")]
+void Miss(inout Payload payload)
+{
+	payload.color = payload.mask * EnvironmentColor(WorldRayDirection());
+}
+
+[shader("miss")]
+void PrimaryMiss(inout PrimaryPayload payload)
+{
+	payload.t = -1.0;
+}
+
+// Find the pixel of the previous frame whose camera ray passes through X.
+// GenerateCameraRay is linear in the screen position, so this solves
+// sx*a + sy*b + c = k*(X - origin) for (sx, sy, k) by Cramer's rule.
+bool PreviousPixel(float3 X, out uint2 pixel)
+{
+	float3 a = sceneConstants.prev_proj_inv[0].xyz;
+	float3 b = sceneConstants.prev_proj_inv[1].xyz;
+	float3 c = sceneConstants.prev_proj_inv[3].xyz;
+	float3 d = sceneConstants.prev_camera_loc.xyz - X;
+	float det = dot(a, cross(b, d));
+	if (abs(det) < 1e-12)
+		return false;
+	float sx = dot(-c, cross(b, d)) / det;
+	float sy = dot(a, cross(-c, d)) / det;
+	float k = dot(a, cross(b, -c)) / det;
+
+	float2 xy = (float2(sx, -sy) + 1.0) * 0.5 * DispatchRaysDimensions().xy;
+	pixel = uint2(xy);
+	return k > 0.0 && all(xy >= 0.0) && all(xy < DispatchRaysDimensions().xy);
+}
+
+[shader("raygeneration")]
+void RayGen()
+{
+	uint2 index = DispatchRaysIndex().xy;
+	uint pixelCount = DispatchRaysDimensions().x * DispatchRaysDimensions().y;
+	uint pixelIndex = index.y * DispatchRaysDimensions().x + index.x;
+	float3 origin,dir;
+
+	GenerateCameraRay(index, dir, origin);
+
+	RayDesc ray;
+	ray.Origin = origin;
+	ray.Direction = dir;
+	ray.TMin = 0.0001;
+	ray.TMax = 100.0;
+
+	PrimaryPayload primary;
+	primary.normal = float3(0.0,0.0,0.0);
+	primary.t = -1.0;
+	bool front = true;
+	if (sceneConstants.hybrid) {
+		// Hybrid mode: primary surfaces rasterized by Shader1.hlsl.
+		float4 g = Textures[sceneConstants.gbuffer_index][index];
+		primary.normal = g.xyz;
+		primary.t = g.w == 0.0 ? -1.0 : abs(g.w);
+		front = g.w > 0.0;
+	} else {
+		TraceRay(Scene, RAY_FLAG_CULL_BACK_FACING_TRIANGLES, 0xff, 1, 0, 1, ray, primary);
+	}
+
+	HistorySample sample;
+	sample.hit = primary.t >= 0.0;
+	sample.position = origin + max(primary.t, 0.0) * dir;
+	sample.normal = primary.normal;
+	sample.pad = 0.0;
+	sample.pad2 = 0.0;
+
+	if (!sample.hit) {
+		sample.color = EnvironmentColor(dir);
+	} else {
+		// Reuse last frame's path if this surface point was visible there too.
+		// Every pixel is still re-traced once per refresh_interval frames, staggered
+		// by a per-pixel hash, which bounds how stale a reused result can get.
+		bool reused = false;
+		uint2 prev;
+		uint stagger = (index.x * 73856093u) ^ (index.y * 19349663u);
+		if (sceneConstants.reprojection && sceneConstants.history_valid
+				&& (stagger + sceneConstants.frame_index) % sceneConstants.refresh_interval != 0
+				&& PreviousPixel(sample.position, prev)) {
+			uint prevParity = (sceneConstants.frame_index + 1) & 1;
+			HistorySample old = History[prevParity * pixelCount + prev.y * DispatchRaysDimensions().x + prev.x];
+			// The secondary path depends on the incoming ray too, so the surface
+			// point must also have been seen from nearly the same direction.
+			float tolerance = 0.002 * primary.t;
+			float3 oldDir = normalize(old.position - sceneConstants.prev_camera_loc.xyz);
+			if (old.hit && distance(old.position, sample.position) < tolerance && dot(old.normal, sample.normal) > 0.99
+					&& dot(oldDir, dir) > 0.9995) {
+				sample.color = old.color;
+				reused = true;
+			}
+		}
+
+		if (reused) {
+			Stats.InterlockedAdd(0, 1);
+		} else {
+			Payload payload;
+			payload.color = float3(0.0,0.0,0.0);
+			payload.mask = float3(1.0,1.0,1.0);
+			payload.outside = front;
+			payload.count = 0;
+			ShadeSurface(payload, sample.position, dir, sample.normal);
+			sample.color = payload.color;
+		}
+	}
+
+	History[(sceneConstants.frame_index & 1) * pixelCount + pixelIndex] = sample;
+	Images[sceneConstants.render_target_index][index] = float4(sample.color,1.0);
 }
@@ -1,20 +1,97 @@
 #include "RefractionDemo.hpp"
-#define STB_IMAGE_IMPLEMENTATION
+#include "Bvh.hpp"
+#include "DemoScene.hpp"
+#include "DescriptorAllocator.hpp"
+#include "DxcShaderCompiler.hpp"
+#include "FrameContexts.hpp"
+#include "GpuBufferPool.hpp"
+#include "GpuMesh.hpp"
+#include "Parallel.hpp"
+#include "ResourceStates.hpp"
+#include "Scene.hpp"
+#include "ShaderCache.hpp"
+#include "ShaderTable.hpp"
+#include "Texture.hpp"
+#include "UploadRing.hpp"
 #include "stb_image.h"
+#include <algorithm>
 #include <sstream>
 #include <fstream>
+#include <future>
 #include <vector>
 #include <assert.h>
+#include <stdio.h>
 
 constexpr int swapchainBufferCount = 2;
 
 int width, height;
 struct {
     DirectX::XMMATRIX proj_inv;
+    DirectX::XMMATRIX prev_proj_inv;
     DirectX::XMVECTOR camera_loc;
+    DirectX::XMVECTOR prev_camera_loc;
+    UINT frame_index;
+    UINT refresh_interval;
+    UINT reprojection;
+    UINT history_valid;
+    UINT hybrid;
+    UINT render_target_index;
+    UINT env_map_index;
+    UINT gbuffer_index;
 } sceneConstants;
 
-Mesh cubeMesh;
+// Must match HistorySample in RayTracing.hlsl.
+struct HistorySample
+{
+    float position[3];
+    UINT hit;
+    float normal[3];
+    float pad;
+    float color[3];
+    float pad2;
+};
+
+// Temporal reprojection: reuse last frame's path result where the primary hit
+// and view direction are unchanged, forcing a re-trace of each pixel every
+// refreshInterval frames.
+bool reprojectionEnabled = false;
+UINT reprojectionRefreshInterval = 8;
+UINT reusedPixelTotal;
+float reusedFraction;
+
+// Hybrid mode: rasterize primary visibility into a G-buffer and only trace
+// the secondary rays. See Shader1.hlsl for the G-buffer layout.
+bool hybridEnabled = false;
+
+// Unique meshes, each with one BLAS; meshes[0] is the glass shell. Instances
+// use the same description as the CPU Scene. Each mesh owns two hit group
+// records (one per ray type), so an instance's hitGroupOffset is 2 * mesh.
+std::vector<Mesh> meshes;
+std::vector<GpuMesh> gpuMeshes; // same order as meshes
+std::vector<Instance> instances;
+unsigned instanceGridSide = 0;
+
+// Must match InstanceRecord in Shader1.hlsl. Records are ordered by mesh so
+// each mesh is drawn with one instanced draw.
+struct InstanceRecord
+{
+    float3x4 objectToWorld;
+    float3x4 worldToObject;
+};
+std::vector<UINT> rasterFirstInstance; // per mesh, plus the total at the end
+
+// Vertex animation of the glass mesh. cubeBvh mirrors the bottom level
+// acceleration structure: its SAH cost after a refit decides whether the BLAS
+// gets a cheap PERFORM_UPDATE or a full rebuild. Nothing else on the CPU reads
+// it, so it is updated on a worker thread over its own copy of the mesh, and
+// each frame uses the decision made for the frame before.
+bool animationEnabled = false;
+float animationTime;
+std::vector<Vertex> restVerts;
+Mesh cubeBvhMesh;
+Bvh cubeBvh;
+BvhUpdatePolicy blasPolicy;
+std::future<BvhUpdateKind> pendingBlasUpdate;
 
 ComPtr<IDXGIFactory2> factory;
 ComPtr<ID3D12Device5> device;
@@ -28,48 +105,94 @@ ComPtr<ID3D12DescriptorHeap> rtvHeap;
 ComPtr<ID3D12DescriptorHeap> dsvHeap;
 ComPtr<ID3D12DescriptorHeap> srvHeap;
 
+// srvHeap holds every CBV/SRV/UAV the shaders use. RayTracing.hlsl indexes
+// it directly, with the indices passed in sceneConstants.
+constexpr UINT persistentDescriptorCount = 1024;
+constexpr UINT frameDescriptorCount = 64;
+DescriptorAllocator descriptors;
+DescriptorHandle renderTargetView;
+DescriptorHandle envMapView;
+DescriptorHandle gbufferView;
+
 ComPtr<ID3D12Fence> fence;
 HANDLE fenceEvent;
 volatile UINT64 fenceValue;
 
 ComPtr<ID3D12RootSignature> rootSignature;
 ComPtr<ID3D12RootSignature> localRootSignature;
+ComPtr<ID3D12RootSignature> rasterRootSignature;
 ComPtr<IDXGISwapChain3> swapchain;
 
 ComPtr<ID3D12Resource> depthStencilBuffer;
 ComPtr<ID3D12Resource> renderTargets[swapchainBufferCount];
 
-ComPtr<ID3D12Resource> cameraConstantBuffer;
+// Persistently mapped upload heap for data that changes every frame, such as
+// the scene constants.
+constexpr UINT64 uploadRingSize = 1 << 20;
+ComPtr<ID3D12Resource> uploadRingBuffer;
+char* uploadRingData;
+UploadRing uploadRing;
 ComPtr<ID3D12PipelineState> pipelineState;
 
 ComPtr<ID3D12CommandQueue> commandQueue;
-ComPtr<ID3D12CommandAllocator> commandAllocator;
+// Frames the CPU may record ahead of the GPU. Each in-flight frame has its
+// own command allocator and stats readback; its upload memory comes from
+// uploadRing.
+constexpr unsigned maxFramesInFlight = 4;
+unsigned framesInFlight = 2;
+FrameContexts frameContexts;
+ComPtr<ID3D12CommandAllocator> commandAllocators[maxFramesInFlight];
 ComPtr<ID3D12GraphicsCommandList5> commandList;
 
+// Buffers that live as long as the scene are ranges of a few large ones:
+// CPU-written data, acceleration structures and their build scratch.
+constexpr UINT64 bufferPoolBlockSize = 4 << 20;
+GpuBufferPool uploadPool;
+GpuBufferPool accelerationStructurePool;
+GpuBufferPool scratchPool;
+
 ComPtr<ID3D12Resource> rtTexture;
-ComPtr<ID3D12Resource> blasScratch;
-ComPtr<ID3D12Resource> blasResult;
-ComPtr<ID3D12Resource> tlasScratch;
-ComPtr<ID3D12Resource> tlasResult;
-ComPtr<ID3D12Resource> instanceDescs;
+std::vector<GpuBufferRange> blasScratch;
+std::vector<GpuBufferRange> blasResult;
+GpuBufferRange tlasScratch;
+GpuBufferRange tlasResult;
+GpuBufferRange instanceDescs;
+GpuBufferRange instanceRecords;
 ComPtr<ID3D12StateObject> rtPSO;
-ComPtr<ID3D12Resource> raygenTable;
-ComPtr<ID3D12Resource> hitTable;
-ComPtr<ID3D12Resource> missTable;
+GpuBufferRange shaderTableBuffer;
+ShaderTableLayout shaderTableLayout;
 ComPtr<ID3D12Resource> envMap;
+ComPtr<ID3D12Resource> historyBuffer;
+ComPtr<ID3D12Resource> statsBuffer;
+ComPtr<ID3D12Resource> statsReadback[maxFramesInFlight];
+ComPtr<ID3D12Resource> gbuffer;
+ComPtr<ID3D12DescriptorHeap> gbufferRtvHeap;
 
 ComPtr<ID3D12DescriptorHeap> descriptorHeap;
 
 
 
-void wait_until_finished()
+// Signal the fence once the queue has finished everything submitted so far.
+UINT64 signal_queue()
 {
     InterlockedIncrement(&fenceValue);
     commandQueue->Signal(fence.Get(), fenceValue);
-    fence->SetEventOnCompletion(fenceValue, fenceEvent);
+    return fenceValue;
+}
+
+void wait_for_fence(UINT64 value)
+{
+    if (fence->GetCompletedValue() >= value)
+        return;
+    fence->SetEventOnCompletion(value, fenceEvent);
     WaitForSingleObject(fenceEvent, INFINITE);
 }
 
+void wait_until_finished()
+{
+    wait_for_fence(signal_queue());
+}
+
 void create_upload_buffer(ID3D12Resource** resource, ComPtr<ID3D12Device5>& device, unsigned size)
 {
     D3D12_RESOURCE_DESC resourceDesc;
@@ -96,49 +219,112 @@ void create_upload_buffer(ID3D12Resource** resource, ComPtr<ID3D12Device5>& devi
         D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(resource));
 }
 
-void copy_to_buffer(ComPtr<ID3D12Resource>& resource, void* data, unsigned size)
+// Resources whose state changes between commands are registered here; the
+// barriers come from what the next commands need.
+ResourceStateTracker resourceStates;
+
+// Record the barriers for the state changes requested since the last call.
+void flush_barriers(ID3D12GraphicsCommandList* list)
 {
-    D3D12_RANGE range = {};
-    void* p;
-    resource->Map(0, &range, &p);
-    memcpy(p, data, size);
-    resource->Unmap(0, nullptr);
+    std::vector<ResourceBarrier> barriers = resourceStates.flush();
+    if (barriers.empty())
+        return;
+    std::vector<D3D12_RESOURCE_BARRIER> d3dBarriers(barriers.size());
+    for (size_t i = 0; i < barriers.size(); i++) {
+        ID3D12Resource* resource = (ID3D12Resource*)barriers[i].resource;
+        D3D12_RESOURCE_BARRIER& barrier = d3dBarriers[i];
+        barrier.Type = (D3D12_RESOURCE_BARRIER_TYPE)barriers[i].type;
+        barrier.Flags = (D3D12_RESOURCE_BARRIER_FLAGS)barriers[i].split;
+        if (barriers[i].type == BARRIER_UAV) {
+            barrier.UAV.pResource = resource;
+        } else {
+            barrier.Transition.pResource = resource;
+            barrier.Transition.Subresource = barriers[i].subresource;
+            barrier.Transition.StateBefore = (D3D12_RESOURCE_STATES)barriers[i].before;
+            barrier.Transition.StateAfter = (D3D12_RESOURCE_STATES)barriers[i].after;
+        }
+    }
+    list->ResourceBarrier((UINT)d3dBarriers.size(), d3dBarriers.data());
 }
 
-bool load_texture(ID3D12Resource** texture, ID3D12GraphicsCommandList* commandList, const char* filename)
+// Suballocate this frame's upload memory. When the ring is full, wait for the
+// GPU to finish the oldest frame still using it.
+void* allocate_upload(UINT64 size, UINT64 alignment, D3D12_GPU_VIRTUAL_ADDRESS& address)
 {
-    int x, y, n;
-    float* data = stbi_loadf(filename, &x, &y, &n, 3);
-
-    device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), D3D12_HEAP_FLAG_NONE,
-        &CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32G32B32_FLOAT, x, y),
-        D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(texture));
-    const UINT64 uploadBufferSize = GetRequiredIntermediateSize(*texture, 0, 1);
-
-    ComPtr<ID3D12Resource> uploadBuffer;
-    create_upload_buffer(uploadBuffer.GetAddressOf(), device, uploadBufferSize);
+    UINT64 offset;
+    while (!uploadRing.allocate(size, alignment, offset)) {
+        UINT64 oldest = uploadRing.oldestFence();
+        if (!oldest)
+            return nullptr;
+        wait_for_fence(oldest);
+        uploadRing.retire(fence->GetCompletedValue());
+    }
+    address = uploadRingBuffer->GetGPUVirtualAddress() + offset;
+    return uploadRingData + offset;
+}
 
-    copy_to_buffer(uploadBuffer, data, x * y * n);
+// Map the baked form of every file (baking in parallel on first run), then
+// copy the texels straight into upload buffers and to the GPU with a single
+// command list.
+bool load_textures(ID3D12Resource** textures, const char* const* filenames, size_t count, bool mipmaps)
+{
+    std::vector<BakedTexture> images(count);
+    std::atomic<bool> ok(true);
+    parallel_for(0, count, 1, [&](size_t i) {
+        if (!images[i].open(filenames[i], mipmaps))
+            ok = false;
+    });
+    if (!ok)
+        return false;
 
     ComPtr<ID3D12GraphicsCommandList> copyList;
-    device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, commandAllocator.Get(), nullptr, IID_PPV_ARGS(&copyList));
-
-    D3D12_SUBRESOURCE_DATA textureData = {};
-    textureData.pData = data;
-    textureData.RowPitch = x * 3 * sizeof(float);
-    textureData.SlicePitch = textureData.RowPitch * y;
-    UpdateSubresources(copyList.Get(), *texture, uploadBuffer.Get(), 0, 0, 1, &textureData);
+    device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, commandAllocators[0].Get(), nullptr, IID_PPV_ARGS(&copyList));
+
+    std::vector<ComPtr<ID3D12Resource>> uploadBuffers(count);
+    for (size_t i = 0; i < count; i++) {
+        const TextureFileHeader& header = images[i].header();
+        D3D12_RESOURCE_DESC textureDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32G32B32_FLOAT, header.width, header.height, 1, header.mipLevels);
+        device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), D3D12_HEAP_FLAG_NONE,
+            &textureDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&textures[i]));
+        resourceStates.track(textures[i], header.mipLevels, STATE_COPY_DEST);
+
+        std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> footprints(header.mipLevels);
+        UINT64 uploadBufferSize;
+        device->GetCopyableFootprints(&textureDesc, 0, header.mipLevels, 0, footprints.data(), nullptr, nullptr, &uploadBufferSize);
+        create_upload_buffer(uploadBuffers[i].GetAddressOf(), device, uploadBufferSize);
+
+        D3D12_RANGE range = {};
+        char* p;
+        uploadBuffers[i]->Map(0, &range, (void**)&p);
+        for (UINT level = 0; level < header.mipLevels; level++) {
+            const TextureMip& mip = images[i].mip(level);
+            const char* src = (const char*)images[i].texels(level);
+            size_t rowSize = mip.width * 3 * sizeof(float);
+            for (UINT y = 0; y < mip.height; y++)
+                memcpy(p + footprints[level].Offset + y * footprints[level].Footprint.RowPitch, src + y * rowSize, rowSize);
+
+            copyList->CopyTextureRegion(&CD3DX12_TEXTURE_COPY_LOCATION(textures[i], level), 0, 0, 0,
+                &CD3DX12_TEXTURE_COPY_LOCATION(uploadBuffers[i].Get(), footprints[level]), nullptr);
+        }
+        uploadBuffers[i]->Unmap(0, nullptr);
+        images[i].close();
+
+        resourceStates.transition(textures[i], STATE_NON_PIXEL_SHADER_RESOURCE | STATE_PIXEL_SHADER_RESOURCE);
+    }
+    flush_barriers(copyList.Get());
 
-    copyList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(*texture, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_ALL_SHADER_RESOURCE));
     copyList->Close();
     ID3D12CommandList* const commandLists[] = { copyList.Get() };
     commandQueue->ExecuteCommandLists(1, commandLists);
     wait_until_finished();
-
-    stbi_image_free(data);
     return true;
 }
 
+bool load_texture(ID3D12Resource** texture, const char* filename, bool mipmaps = false)
+{
+    return load_textures(texture, &filename, 1, mipmaps);
+}
+
 void createDevice()
 {
     UINT factoryFlags = 0;
@@ -211,6 +397,7 @@ void recreateSwapchain(HWND hwnd, int width, int height)
         swapchain->GetBuffer(i, IID_PPV_ARGS(&renderTargets[i]));
         device->CreateRenderTargetView(renderTargets[i].Get(), nullptr, ptr);
         renderTargets[i]->SetName(L"RenderTarget ");
+        resourceStates.track(renderTargets[i].Get(), 1, STATE_PRESENT);
         ptr.Offset(1, rtvDescriptorSize);
     }
 
@@ -243,11 +430,18 @@ void createSignatures()
 
     // Main root signature
     {
-    CD3DX12_ROOT_PARAMETER1 rp[4];
-    rp[0].InitAsDescriptorTable(1, &CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0));
+    // The whole descriptor heap is one table, seen as both textures and
+    // images. Slots may be empty or rewritten while unused.
+    const D3D12_DESCRIPTOR_RANGE_FLAGS bindless = D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE | D3D12_DESCRIPTOR_RANGE_FLAG_DATA_VOLATILE;
+    CD3DX12_DESCRIPTOR_RANGE1 heapRanges[2];
+    heapRanges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 2, bindless, 0);
+    heapRanges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, UINT_MAX, 0, 2, bindless, 0);
+    CD3DX12_ROOT_PARAMETER1 rp[5];
+    rp[0].InitAsDescriptorTable(_countof(heapRanges), heapRanges);
     rp[1].InitAsShaderResourceView(0);
     rp[2].InitAsConstantBufferView(0);
-    rp[3].InitAsDescriptorTable(1, &CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 3, 1));
+    rp[3].InitAsUnorderedAccessView(1);
+    rp[4].InitAsUnorderedAccessView(2);
     CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSigDesc;
     rootSigDesc.Init_1_1(_countof(rp), rp, 1, &CD3DX12_STATIC_SAMPLER_DESC(0), D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
@@ -259,137 +453,244 @@ void createSignatures()
 
     // Local root signature (for raytracing)
     {
+    // The hit groups of each mesh get its index and vertex buffers.
+    CD3DX12_ROOT_PARAMETER1 rp[2];
+    rp[0].InitAsShaderResourceView(0, 1);
+    rp[1].InitAsShaderResourceView(1, 1);
     CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC localRootSigDesc;
-    localRootSigDesc.Init_1_1(0, nullptr, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+    localRootSigDesc.Init_1_1(_countof(rp), rp, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
     localRootSigDesc.Desc_1_1.Flags = D3D12_ROOT_SIGNATURE_FLAG_LOCAL_ROOT_SIGNATURE;
     ComPtr<ID3DBlob> blob;
     D3D12SerializeVersionedRootSignature(&localRootSigDesc, &blob, nullptr);
     device->CreateRootSignature(0, blob->GetBufferPointer(), blob->GetBufferSize(), IID_PPV_ARGS(&localRootSignature));
     localRootSignature->SetName(L"Local Root Signature");
     }
+
+    // Raster root signature (for the hybrid G-buffer pass)
+    {
+    CD3DX12_ROOT_PARAMETER1 rp[5];
+    rp[0].InitAsConstantBufferView(0);
+    rp[1].InitAsShaderResourceView(1);
+    rp[2].InitAsShaderResourceView(2);
+    rp[3].InitAsShaderResourceView(3);
+    rp[4].InitAsConstants(1, 1);
+    CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSigDesc;
+    rootSigDesc.Init_1_1(_countof(rp), rp, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+
+    ComPtr<ID3DBlob> blob;
+    D3D12SerializeVersionedRootSignature(&rootSigDesc, &blob, nullptr);
+    device->CreateRootSignature(0, blob->GetBufferPointer(), blob->GetBufferSize(), IID_PPV_ARGS(&rasterRootSignature));
+    rasterRootSignature->SetName(L"Raster Root Signature");
+    }
 }
 
-void setupRaytracingAccelerationStructures()
+void setupRasterPipelineState()
 {
-    // A top and bottom level acceleration structure must be defined for the
-    // geometry. This is essentially a BVH.
+    ComPtr<ID3DBlob> vertexShader, pixelShader, error;
+    if (FAILED(D3DCompileFromFile(L"../Shader1.hlsl", nullptr, nullptr, "VSMain", "vs_5_1", 0, 0, &vertexShader, &error))
+        || FAILED(D3DCompileFromFile(L"../Shader1.hlsl", nullptr, nullptr, "PSMain", "ps_5_1", 0, 0, &pixelShader, &error))) {
+        OutputDebugStringA((char*)error->GetBufferPointer());
+        assert(0);
+    }
 
-    D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc = cubeMesh.raytracingGeometry();
+    D3D12_INPUT_ELEMENT_DESC inputLayout[] = {
+        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    };
+
+    // No culling: back faces are recorded too, so the traced bounces know
+    // whether the primary ray starts inside the glass.
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC desc = {};
+    desc.pRootSignature = rasterRootSignature.Get();
+    desc.VS = CD3DX12_SHADER_BYTECODE(vertexShader.Get());
+    desc.PS = CD3DX12_SHADER_BYTECODE(pixelShader.Get());
+    desc.InputLayout = { inputLayout, _countof(inputLayout) };
+    desc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+    desc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
+    desc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
+    desc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
+    desc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
+    desc.DSVFormat = DXGI_FORMAT_D32_FLOAT;
+    desc.NumRenderTargets = 1;
+    desc.RTVFormats[0] = DXGI_FORMAT_R32G32B32A32_FLOAT;
+    desc.SampleMask = UINT_MAX;
+    desc.SampleDesc.Count = 1;
+    device->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(&pipelineState));
+    pipelineState->SetName(L"G-Buffer PSO");
+}
 
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS bottomLevelInputs = {};
-    bottomLevelInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-    bottomLevelInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-    bottomLevelInputs.pGeometryDescs = &geometryDesc;
-    bottomLevelInputs.NumDescs = 1;
-    bottomLevelInputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> blasGeometry;
 
-    // Get the size of the resources we need to allocate for the acceleration structures.
-    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo;
-    device->GetRaytracingAccelerationStructurePrebuildInfo(&bottomLevelInputs, &prebuildInfo);
+D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS bottomLevelInputs(size_t mesh)
+{
+    blasGeometry.resize(meshes.size());
+    blasGeometry[mesh] = gpuMeshes[mesh].raytracingGeometry();
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
+    inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+    inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+    inputs.pGeometryDescs = &blasGeometry[mesh];
+    inputs.NumDescs = 1;
+    inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE
+        | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+    return inputs;
+}
 
-    D3D12_RESOURCE_DESC resourceDesc;
-    resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-    resourceDesc.Alignment = 0;
-    resourceDesc.Height = 1;
-    resourceDesc.DepthOrArraySize = 1;
-    resourceDesc.MipLevels = 1;
-    resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
-    resourceDesc.SampleDesc.Count = 1;
-    resourceDesc.SampleDesc.Quality = 0;
-    resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-    resourceDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS topLevelInputs()
+{
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
+    inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+    inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+    inputs.pGeometryDescs = nullptr;
+    inputs.NumDescs = (UINT)instances.size();
+    inputs.InstanceDescs = instanceDescs.address;
+    inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+    return inputs;
+}
 
-    D3D12_HEAP_PROPERTIES heapProperties;
-    heapProperties.Type = D3D12_HEAP_TYPE_DEFAULT;
-    heapProperties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-    heapProperties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-    heapProperties.CreationNodeMask = 1;
-    heapProperties.VisibleNodeMask = 1;
+// Record a build of a mesh's BLAS from its vertex buffer's current contents.
+// An update refits the existing structure in place instead of rebuilding it.
+void buildBottomLevel(size_t mesh, bool update)
+{
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
+    desc.Inputs = bottomLevelInputs(mesh);
+    if (update) {
+        desc.Inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+        desc.SourceAccelerationStructureData = blasResult[mesh].address;
+    }
+    desc.ScratchAccelerationStructureData = blasScratch[mesh].address;
+    desc.DestAccelerationStructureData = blasResult[mesh].address;
+    commandList->BuildRaytracingAccelerationStructure(&desc, 0, nullptr);
+    resourceStates.uavBarrier(blasResult[mesh].resource);
+}
 
-    resourceDesc.Width = prebuildInfo.ScratchDataSizeInBytes;
-    device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
-        D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&blasScratch));
-    resourceDesc.Width = prebuildInfo.ResultDataMaxSizeInBytes;
-    device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
-        D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nullptr, IID_PPV_ARGS(&blasResult));
-
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC bottomLevelDesc = {};
-    bottomLevelDesc.Inputs = bottomLevelInputs;
-    bottomLevelDesc.ScratchAccelerationStructureData = blasScratch->GetGPUVirtualAddress();
-    bottomLevelDesc.DestAccelerationStructureData = blasResult->GetGPUVirtualAddress();
-
-    commandList->BuildRaytracingAccelerationStructure(&bottomLevelDesc, 0, nullptr);
-    commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(blasResult.Get()));
-
-    D3D12_RAYTRACING_INSTANCE_DESC instanceDesc = {};
-    instanceDesc.Transform[0][0] = 1.0f;
-    instanceDesc.Transform[1][1] = 1.0f;
-    instanceDesc.Transform[2][2] = 1.0f;
-    instanceDesc.InstanceMask = 1;
-    instanceDesc.InstanceID = 0;
-    instanceDesc.Flags = 0;
-    instanceDesc.InstanceContributionToHitGroupIndex = 0;
-    instanceDesc.AccelerationStructure = blasResult->GetGPUVirtualAddress();
-    create_upload_buffer(instanceDescs.GetAddressOf(), device, sizeof(D3D12_RAYTRACING_INSTANCE_DESC));
-    copy_to_buffer(instanceDescs, &instanceDesc, sizeof(D3D12_RAYTRACING_INSTANCE_DESC));
-
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS topLevelInputs = {};
-    topLevelInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
-    topLevelInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-    topLevelInputs.pGeometryDescs = nullptr;
-    topLevelInputs.NumDescs = 1;
-    topLevelInputs.InstanceDescs = instanceDescs->GetGPUVirtualAddress();
-    topLevelInputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
-
-    resourceDesc.Width = prebuildInfo.ScratchDataSizeInBytes;
-    device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
-        D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&tlasScratch));
-    resourceDesc.Width = prebuildInfo.ResultDataMaxSizeInBytes;
-    device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
-        D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nullptr, IID_PPV_ARGS(&tlasResult));
+void buildTopLevel()
+{
+    // The bottom levels built before this all share one barrier.
+    flush_barriers(commandList.Get());
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
+    desc.Inputs = topLevelInputs();
+    desc.ScratchAccelerationStructureData = tlasScratch.address;
+    desc.DestAccelerationStructureData = tlasResult.address;
+    commandList->BuildRaytracingAccelerationStructure(&desc, 0, nullptr);
+    resourceStates.uavBarrier(tlasResult.resource);
+}
+
+// Load the demo content (see DemoScene.hpp) with the instance grid that
+// setInstanceGrid asked for, and give every mesh its GPU buffers.
+void createScene()
+{
+    load_demo_scene("..", instanceGridSide, meshes, instances);
+    gpuMeshes.resize(meshes.size());
+    for (size_t mesh = 0; mesh < meshes.size(); mesh++)
+        gpuMeshes[mesh].upload(uploadPool, meshes[mesh]);
+
+    std::vector<InstanceRecord> records;
+    rasterFirstInstance.assign(1, 0);
+    for (size_t mesh = 0; mesh < meshes.size(); mesh++) {
+        for (const Instance& instance : instances) {
+            if (instance.mesh == mesh)
+                records.push_back({ instance.transform, inverse(instance.transform) });
+        }
+        rasterFirstInstance.push_back((UINT)records.size());
+    }
+    uploadPool.allocate(records.size() * sizeof(InstanceRecord), D3D12_RAW_UAV_SRV_BYTE_ALIGNMENT, instanceRecords);
+    memcpy(instanceRecords.data, records.data(), records.size() * sizeof(InstanceRecord));
+}
+
+void setupRaytracingAccelerationStructures()
+{
+    // A top and bottom level acceleration structure must be defined for the
+    // geometry. This is essentially a BVH.
 
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC topLevelDesc = {};
-    topLevelDesc.Inputs = topLevelInputs;
-    topLevelDesc.ScratchAccelerationStructureData = tlasScratch->GetGPUVirtualAddress();
-    topLevelDesc.DestAccelerationStructureData = tlasResult->GetGPUVirtualAddress();
+    // Get the size of the resources we need to allocate for the acceleration structures.
+    const UINT64 alignment = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT;
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo;
+    blasScratch.resize(meshes.size());
+    blasResult.resize(meshes.size());
+    for (size_t mesh = 0; mesh < meshes.size(); mesh++) {
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = bottomLevelInputs(mesh);
+        device->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &prebuildInfo);
+
+        // The scratch buffer serves both full builds and updates.
+        scratchPool.allocate(std::max(prebuildInfo.ScratchDataSizeInBytes, prebuildInfo.UpdateScratchDataSizeInBytes), alignment, blasScratch[mesh]);
+        accelerationStructurePool.allocate(prebuildInfo.ResultDataMaxSizeInBytes, alignment, blasResult[mesh]);
+        buildBottomLevel(mesh, false);
+    }
 
-    commandList->BuildRaytracingAccelerationStructure(&topLevelDesc, 0, nullptr);
-    tlasResult->SetName(L"TopLevel Acceleration Struct Result");
-    tlasScratch->SetName(L"TopLevel Acceleration Struct Scratch");
-    blasResult->SetName(L"BottomLevel Acceleration Struct Result");
-    blasScratch->SetName(L"BottomLevel Acceleration Struct Scratch");
+    // InstanceID carries the mesh index; the shaders get per-mesh buffers
+    // from the hit group records that hitGroupOffset selects.
+    std::vector<D3D12_RAYTRACING_INSTANCE_DESC> instanceDescArray(instances.size());
+    for (size_t i = 0; i < instances.size(); i++) {
+        D3D12_RAYTRACING_INSTANCE_DESC& desc = instanceDescArray[i];
+        memcpy(desc.Transform, instances[i].transform.m, sizeof(desc.Transform));
+        desc.InstanceID = instances[i].mesh;
+        desc.InstanceMask = instances[i].mask;
+        desc.InstanceContributionToHitGroupIndex = instances[i].hitGroupOffset;
+        desc.Flags = 0;
+        desc.AccelerationStructure = blasResult[instances[i].mesh].address;
+    }
+    size_t instanceDescSize = instanceDescArray.size() * sizeof(D3D12_RAYTRACING_INSTANCE_DESC);
+    uploadPool.allocate(instanceDescSize, D3D12_RAYTRACING_INSTANCE_DESCS_BYTE_ALIGNMENT, instanceDescs);
+    memcpy(instanceDescs.data, instanceDescArray.data(), instanceDescSize);
+
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = topLevelInputs();
+    device->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &prebuildInfo);
+    scratchPool.allocate(prebuildInfo.ScratchDataSizeInBytes, alignment, tlasScratch);
+    accelerationStructurePool.allocate(prebuildInfo.ResultDataMaxSizeInBytes, alignment, tlasResult);
+    buildTopLevel();
 }
 
-IDxcBlob* rayGenBytecode;
-dxc::DxcDllSupport dxcHelper;
-IDxcCompiler* compiler;
-IDxcLibrary* library;
-IDxcIncludeHandler* includeHandler;
+// Wobble the glass mesh and bring both BVHs up to date. Normals keep their
+// rest values; the displacement is small enough for that not to show.
+void animateMesh(UINT64 lastFrameFence)
+{
+    if (restVerts.empty())
+        restVerts = meshes[0].verts;
+    animationTime += 1.0f / 60.0f;
+    parallel_for(0, restVerts.size(), 4096, [&](size_t i) {
+        const float* p = restVerts[i].position;
+        float scale = 1.0f + 0.04f * sinf(4.0f * p[1] + 3.0f * animationTime);
+        for (int k = 0; k < 3; k++)
+            meshes[0].verts[i].position[k] = p[k] * scale;
+    });
+
+    // The first update always rebuilds, so the first frame does too.
+    BvhUpdateKind kind = pendingBlasUpdate.valid() ? pendingBlasUpdate.get() : BVH_REBUILD;
+    cubeBvhMesh = meshes[0];
+    pendingBlasUpdate = std::async(std::launch::async, [] {
+        cubeBvh.mesh = &cubeBvhMesh;
+        return blasPolicy.update(cubeBvh);
+    });
+
+    // The vertex buffer lives in the persistently mapped upload pool and is
+    // rewritten in place, while frames in flight still read it, so the queue
+    // has to drain before the copy. A per-frame copy would avoid the wait.
+    wait_for_fence(lastFrameFence);
+    memcpy(gpuMeshes[0].vb.data, meshes[0].verts.data(), meshes[0].verts.size() * sizeof(Vertex));
+    buildBottomLevel(0, kind == BVH_REFIT);
+    buildTopLevel();
+}
+
+DxcShaderCompiler shaderCompiler;
+std::vector<uint8_t> rayTracingBytecode;
 
 void setupRaytracingPipelineStateObjects()
 {
     // Compile the shaders as a library. To do this we need to import a DLL
-    // since we need a recent HLSL compiler.
-
-    dxcHelper.Initialize();
-    dxcHelper.CreateInstance(CLSID_DxcCompiler, &compiler);
-    dxcHelper.CreateInstance(CLSID_DxcLibrary, &library);
-    library->CreateIncludeHandler(&includeHandler);
-
-    UINT32 codePage = 0;
-    IDxcBlobEncoding* shaderText;
-    IDxcOperationResult* result;
-    library->CreateBlobFromFile(L"../RayTracing.hlsl", &codePage, &shaderText);
-    compiler->Compile(shaderText, L"../RayTracing.hlsl", nullptr, L"lib_6_3",
-        nullptr, 0, nullptr, 0, includeHandler, &result);
-    result->GetResult(&rayGenBytecode);
-
-    HRESULT compilationStatus;
-    result->GetStatus(&compilationStatus);
-    if (FAILED(compilationStatus)) {
-        IDxcBlobEncoding* error;
-        result->GetErrorBuffer(&error);
-        OutputDebugStringA((char*)error->GetBufferPointer());
+    // since we need a recent HLSL compiler. Compiling takes a while, so the
+    // result is cached next to the source and reused while nothing changed.
+    if (!shaderCompiler.create()) {
+        OutputDebugStringA("cannot load dxcompiler.dll\n");
+        assert(0);
+    }
+
+    ShaderCache shaderCache;
+    shaderCache.directory = "..";
+    shaderCache.compiler = &shaderCompiler;
+    ShaderCompileRequest request = { "../RayTracing.hlsl", "", "lib_6_3", {} };
+    std::string errors;
+    if (!shaderCache.load(request, rayTracingBytecode, errors)) {
+        OutputDebugStringA(errors.c_str());
         assert(0);
     }
 
@@ -399,12 +700,18 @@ void setupRaytracingPipelineStateObjects()
     CD3DX12_STATE_OBJECT_DESC stateObjectDesc(D3D12_STATE_OBJECT_TYPE_RAYTRACING_PIPELINE);
 
     auto subobjDXIL = stateObjectDesc.CreateSubobject<CD3DX12_DXIL_LIBRARY_SUBOBJECT>();
-    subobjDXIL->SetDXILLibrary(&CD3DX12_SHADER_BYTECODE(rayGenBytecode->GetBufferPointer(), rayGenBytecode->GetBufferSize()));
+    subobjDXIL->SetDXILLibrary(&CD3DX12_SHADER_BYTECODE(rayTracingBytecode.data(), rayTracingBytecode.size()));
 
     auto subobjHit = stateObjectDesc.CreateSubobject<CD3DX12_HIT_GROUP_SUBOBJECT>();
     subobjHit->SetHitGroupExport(L"HitGroup");
     subobjHit->SetClosestHitShaderImport(L"ClosestHit");
     subobjHit->SetHitGroupType(D3D12_HIT_GROUP_TYPE_TRIANGLES);
+
+    // Primary visibility rays use hit group and miss shader 1, which only record the hit.
+    auto subobjPrimaryHit = stateObjectDesc.CreateSubobject<CD3DX12_HIT_GROUP_SUBOBJECT>();
+    subobjPrimaryHit->SetHitGroupExport(L"PrimaryHitGroup");
+    subobjPrimaryHit->SetClosestHitShaderImport(L"PrimaryHit");
+    subobjPrimaryHit->SetHitGroupType(D3D12_HIT_GROUP_TYPE_TRIANGLES);
     
     auto subobjShaderConfig = stateObjectDesc.CreateSubobject<CD3DX12_RAYTRACING_SHADER_CONFIG_SUBOBJECT>();
     subobjShaderConfig->Config(sizeof(DirectX::XMFLOAT4)*2, sizeof(DirectX::XMFLOAT2));
@@ -414,6 +721,7 @@ void setupRaytracingPipelineStateObjects()
     auto assocSubobj = stateObjectDesc.CreateSubobject<CD3DX12_SUBOBJECT_TO_EXPORTS_ASSOCIATION_SUBOBJECT>();
     assocSubobj->SetSubobjectToAssociate(*subobjLocalSig);
     assocSubobj->AddExport(L"HitGroup");
+    assocSubobj->AddExport(L"PrimaryHitGroup");
 
     auto subobjRootSig = stateObjectDesc.CreateSubobject<CD3DX12_GLOBAL_ROOT_SIGNATURE_SUBOBJECT>();
     subobjRootSig->SetRootSignature(rootSignature.Get());
@@ -431,6 +739,40 @@ void createRaytracingTexture()
         &CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, width, height, 1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
         D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(&rtTexture));
     rtTexture->SetName(L"RayTracing Texture");
+    resourceStates.track(rtTexture.Get(), 1, STATE_UNORDERED_ACCESS);
+
+    // Two frames of history, ping-ponged by frame parity.
+    D3D12_HEAP_PROPERTIES defaultHeap = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+    device->CreateCommittedResource(&defaultHeap, D3D12_HEAP_FLAG_NONE,
+        &CD3DX12_RESOURCE_DESC::Buffer(2 * width * height * sizeof(HistorySample), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+        D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(&historyBuffer));
+    historyBuffer->SetName(L"Reprojection History");
+
+    device->CreateCommittedResource(&defaultHeap, D3D12_HEAP_FLAG_NONE,
+        &CD3DX12_RESOURCE_DESC::Buffer(sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+        D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(&statsBuffer));
+    statsBuffer->SetName(L"Reprojection Stats");
+    resourceStates.track(statsBuffer.Get(), 1, STATE_UNORDERED_ACCESS);
+    for (unsigned i = 0; i < framesInFlight; i++) {
+        device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK), D3D12_HEAP_FLAG_NONE,
+            &CD3DX12_RESOURCE_DESC::Buffer(sizeof(UINT)), D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&statsReadback[i]));
+        statsReadback[i]->SetName(L"Reprojection Stats Readback");
+    }
+
+    // Cleared to 0 every hybrid frame, which RayGen reads as a miss.
+    const float clearValue[4] = {};
+    device->CreateCommittedResource(&defaultHeap, D3D12_HEAP_FLAG_NONE,
+        &CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32G32B32A32_FLOAT, width, height, 1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET),
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, &CD3DX12_CLEAR_VALUE(DXGI_FORMAT_R32G32B32A32_FLOAT, clearValue),
+        IID_PPV_ARGS(&gbuffer));
+    gbuffer->SetName(L"Hybrid G-Buffer");
+    resourceStates.track(gbuffer.Get(), 1, STATE_NON_PIXEL_SHADER_RESOURCE);
+
+    D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc = {};
+    rtvHeapDesc.NumDescriptors = 1;
+    rtvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+    device->CreateDescriptorHeap(&rtvHeapDesc, IID_PPV_ARGS(&gbufferRtvHeap));
+    device->CreateRenderTargetView(gbuffer.Get(), nullptr, gbufferRtvHeap->GetCPUDescriptorHandleForHeapStart());
 }
 
 void createShaderTables()
@@ -440,74 +782,74 @@ void createShaderTables()
     void* rayGenId = stateObjectProperties->GetShaderIdentifier(L"RayGen");
     void* missId = stateObjectProperties->GetShaderIdentifier(L"Miss");
     void* hitGroupId = stateObjectProperties->GetShaderIdentifier(L"HitGroup");
+    void* primaryMissId = stateObjectProperties->GetShaderIdentifier(L"PrimaryMiss");
+    void* primaryHitGroupId = stateObjectProperties->GetShaderIdentifier(L"PrimaryHitGroup");
+
+    static_assert(shaderIdentifierSize == D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES, "");
+    static_assert(shaderRecordAlignment == D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT, "");
+    static_assert(shaderTableAlignment == D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT, "");
+    ShaderTable table;
+    table.addRayGen(rayGenId);
+    // MissShaderIndex 0 for bounces, 1 for primary rays.
+    table.addMiss(missId);
+    table.addMiss(primaryMissId);
+    // Two records per mesh, as hitGroupOffset expects, each with the mesh's
+    // buffers as local root arguments.
+    for (size_t mesh = 0; mesh < meshes.size(); mesh++) {
+        D3D12_GPU_VIRTUAL_ADDRESS args[2] = { gpuMeshes[mesh].ib.address, gpuMeshes[mesh].vb.address };
+        table.addHitGroup(hitGroupId, args, sizeof(args));
+        table.addHitGroup(primaryHitGroupId, args, sizeof(args));
+    }
+    table.layout(shaderTableLayout);
+    uploadPool.allocate(shaderTableLayout.size, D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT, shaderTableBuffer);
+    table.write(shaderTableLayout, (uint8_t*)shaderTableBuffer.data);
+}
 
-    D3D12_RANGE range = { 0,0 };
-    char* p;
-
-    create_upload_buffer(raygenTable.GetAddressOf(), device, 64);
-    raygenTable->SetName(L"RayGen Table");
-    raygenTable->Map(0, &range, (void**)&p);
-    memcpy(&p[0], rayGenId, D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-    raygenTable->Unmap(0, nullptr);
-
-    create_upload_buffer(hitTable.GetAddressOf(), device, 64);
-    hitTable->SetName(L"Hit Table");
-    hitTable->Map(0, &range, (void**)&p);
-    memcpy(&p[0], hitGroupId, D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-    hitTable->Unmap(0, nullptr);
-
-    create_upload_buffer(missTable.GetAddressOf(), device, 64);
-    missTable->SetName(L"Miss Table");
-    missTable->Map(0, &range, (void**)&p);
-    memcpy(&p[0], missId, D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-    missTable->Unmap(0, nullptr);
+D3D12_CPU_DESCRIPTOR_HANDLE cpu_descriptor(UINT index)
+{
+    return { srvHeap->GetCPUDescriptorHandleForHeapStart().ptr + (SIZE_T)index * cbvDescriptorSize };
 }
 
 void createDescriptorHeap()
 {
+    descriptors.reset(persistentDescriptorCount, maxFramesInFlight, frameDescriptorCount);
     D3D12_DESCRIPTOR_HEAP_DESC srvDesc;
     srvDesc.NodeMask = 0;
-    srvDesc.NumDescriptors = 4;
+    srvDesc.NumDescriptors = descriptors.capacity();
     srvDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
     srvDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
     device->CreateDescriptorHeap(&srvDesc, IID_PPV_ARGS(&srvHeap));
 
     {
+        descriptors.allocate(renderTargetView);
         D3D12_UNORDERED_ACCESS_VIEW_DESC desc = {};
         desc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
-        device->CreateUnorderedAccessView(rtTexture.Get(), nullptr, &desc, srvHeap->GetCPUDescriptorHandleForHeapStart());
+        device->CreateUnorderedAccessView(rtTexture.Get(), nullptr, &desc, cpu_descriptor(renderTargetView.index));
     }
     {
+        descriptors.allocate(envMapView);
         D3D12_SHADER_RESOURCE_VIEW_DESC desc = {};
         desc.Format = DXGI_FORMAT_UNKNOWN;
-        desc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
-        desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-        desc.Buffer.NumElements = cubeMesh.indices.size();
-        desc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
-        desc.Buffer.StructureByteStride = sizeof(uint32_t);
-        device->CreateShaderResourceView(cubeMesh.ib.Get(), &desc, { srvHeap->GetCPUDescriptorHandleForHeapStart().ptr + cbvDescriptorSize });
-    }
-    {
-        D3D12_SHADER_RESOURCE_VIEW_DESC desc = {};
-        desc.Format = DXGI_FORMAT_UNKNOWN;
-        desc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+        desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
         desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-        desc.Buffer.NumElements = cubeMesh.verts.size();
-        desc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
-        desc.Buffer.StructureByteStride = sizeof(Vertex);
-        device->CreateShaderResourceView(cubeMesh.vb.Get(), &desc, { srvHeap->GetCPUDescriptorHandleForHeapStart().ptr + 2*cbvDescriptorSize });
+        desc.Texture2D.MipLevels = envMap->GetDesc().MipLevels;
+        desc.Texture2D.MostDetailedMip = 0;
+        desc.Texture2D.PlaneSlice = 0;
+        desc.Texture2D.ResourceMinLODClamp = 0.0f;
+        device->CreateShaderResourceView(envMap.Get(), &desc, cpu_descriptor(envMapView.index));
     }
     {
+        descriptors.allocate(gbufferView);
         D3D12_SHADER_RESOURCE_VIEW_DESC desc = {};
-        desc.Format = DXGI_FORMAT_UNKNOWN;
+        desc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
         desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
         desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
         desc.Texture2D.MipLevels = 1;
-        desc.Texture2D.MostDetailedMip = 0;
-        desc.Texture2D.PlaneSlice = 0;
-        desc.Texture2D.ResourceMinLODClamp = 0.0f;
-        device->CreateShaderResourceView(envMap.Get(), &desc, { srvHeap->GetCPUDescriptorHandleForHeapStart().ptr + 3*cbvDescriptorSize });
+        device->CreateShaderResourceView(gbuffer.Get(), &desc, cpu_descriptor(gbufferView.index));
     }
+    sceneConstants.render_target_index = renderTargetView.index;
+    sceneConstants.env_map_index = envMapView.index;
+    sceneConstants.gbuffer_index = gbufferView.index;
 }
 
 void RefractionDemo::initialize(HWND hWnd, int width_, int height_)
@@ -516,36 +858,52 @@ void RefractionDemo::initialize(HWND hWnd, int width_, int height_)
     height = height_;
 
     createDevice();
-    // Create a synchronization object which we will use to ensure the GPU is done after swapping buffers.
-    // This is temporary and a bad way of doing things. We should really just use separate command lists
-    // for each back buffer so we can let the GPU continue on ahead of the CPU.
     fenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
     device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence));
 
-    // We should be creating one of these per RTV, for now we just create one.
-    device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&commandAllocator));
-    load_texture(envMap.GetAddressOf(), commandList.Get(), "../envMap.hdr");
+    frameContexts.reset(framesInFlight);
+    for (unsigned i = 0; i < framesInFlight; i++)
+        device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&commandAllocators[i]));
+    load_texture(envMap.GetAddressOf(), "../envMap.hdr");
     envMap->SetName(L"Environment Map Texture");
     
-    device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, commandAllocator.Get(), nullptr, IID_PPV_ARGS(&commandList));
+    device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, commandAllocators[0].Get(), nullptr, IID_PPV_ARGS(&commandList));
 
 
-    unsigned size = (sizeof(sceneConstants) + 255u) & ~255u;
-    create_upload_buffer(cameraConstantBuffer.GetAddressOf(), device, size);
+    create_upload_buffer(uploadRingBuffer.GetAddressOf(), device, (unsigned)uploadRingSize);
+    D3D12_RANGE readRange = {};
+    uploadRingBuffer->Map(0, &readRange, (void**)&uploadRingData);
+    uploadRing.reset(uploadRingSize);
+    uploadPool.create(device, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE,
+        D3D12_RESOURCE_STATE_GENERIC_READ, bufferPoolBlockSize, L"Upload Pool");
+    accelerationStructurePool.create(device, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+        D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, bufferPoolBlockSize, L"Acceleration Structure Pool");
+    scratchPool.create(device, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+        D3D12_RESOURCE_STATE_COMMON, bufferPoolBlockSize, L"Acceleration Structure Scratch Pool");
 
     createSignatures();
-    cubeMesh.load("../shell.obj");
-    cubeMesh.upload(device);
+    createScene();
 
     
     setupRaytracingAccelerationStructures();
     setupRaytracingPipelineStateObjects();
+    setupRasterPipelineState();
     createRaytracingTexture();
     createShaderTables();
 
+    const GpuBufferPool* pools[] = { &uploadPool, &accelerationStructurePool, &scratchPool };
+    for (const GpuBufferPool* pool : pools) {
+        HeapAllocatorStats stats = pool->stats();
+        char message[256];
+        snprintf(message, sizeof(message), "%ls: %u buffers in %u blocks, %llu of %llu bytes used, fragmentation %.2f\n",
+            pool->name, stats.allocationCount, (unsigned)pool->blocks.size(), stats.usedBytes, stats.totalBytes, stats.fragmentation);
+        OutputDebugStringA(message);
+    }
+
     recreateSwapchain(hWnd, width, height);
     createDescriptorHeap();
 
+    flush_barriers(commandList.Get());
     commandList->Close();
     ID3D12CommandList* const commandLists[] = { commandList.Get() };
     commandQueue->ExecuteCommandLists(1, commandLists);
@@ -554,8 +912,34 @@ void RefractionDemo::initialize(HWND hWnd, int width_, int height_)
 
 static float angle = 0.01f;
 
+// Take the reprojection count of the last frame recorded in this context.
+// Its fence has completed, so the copy into the readback buffer is done.
+void readReprojectionStats(unsigned context)
+{
+    // The shader keeps a running count, so the per-frame figure is the difference.
+    D3D12_RANGE readRange = { 0, sizeof(UINT) };
+    D3D12_RANGE writeRange = {};
+    UINT* reused;
+    statsReadback[context]->Map(0, &readRange, (void**)&reused);
+    UINT reusedThisFrame = *reused - reusedPixelTotal;
+    reusedPixelTotal = *reused;
+    statsReadback[context]->Unmap(0, &writeRange);
+    reusedFraction = (float)reusedThisFrame / (width * height);
+}
+
 void RefractionDemo::drawFrame()
 {
+    // Wait only for the frame that last used this context; later ones may
+    // still be running.
+    UINT64 contextFence;
+    unsigned context = frameContexts.begin(contextFence);
+    wait_for_fence(contextFence);
+    if (contextFence)
+        readReprojectionStats(context);
+
+    sceneConstants.prev_proj_inv = sceneConstants.proj_inv;
+    sceneConstants.prev_camera_loc = sceneConstants.camera_loc;
+
     DirectX::XMMATRIX proj = DirectX::XMMatrixPerspectiveFovLH(52.0f / 180.0 * 3.1415, 1.333, 1.0f, 125.0f);
     sceneConstants.camera_loc = { 5 * cosf(angle),0,5 * sinf(angle),1.0 };
     DirectX::XMMATRIX world = DirectX::XMMatrixTranslationFromVector(sceneConstants.camera_loc);
@@ -563,51 +947,149 @@ void RefractionDemo::drawFrame()
     DirectX::XMMATRIX projView = proj * world * view;
 
     sceneConstants.proj_inv = DirectX::XMMatrixInverse(nullptr, projView);
-    copy_to_buffer(cameraConstantBuffer, &sceneConstants, sizeof(sceneConstants));
+    // A deforming mesh moves the paths behind an unchanged primary hit.
+    sceneConstants.history_valid = sceneConstants.frame_index > 0 && !animationEnabled;
+    sceneConstants.reprojection = reprojectionEnabled;
+    sceneConstants.refresh_interval = reprojectionRefreshInterval;
+    sceneConstants.hybrid = hybridEnabled;
+    uploadRing.retire(fence->GetCompletedValue());
+    descriptors.retire(fence->GetCompletedValue());
+    descriptors.beginFrame(context);
+    D3D12_GPU_VIRTUAL_ADDRESS sceneConstantsAddress;
+    void* constants = allocate_upload(sizeof(sceneConstants), D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, sceneConstantsAddress);
+    memcpy(constants, &sceneConstants, sizeof(sceneConstants));
     angle += 0.01f;
 
     int frameIdx = swapchain->GetCurrentBackBufferIndex();
 
-    commandAllocator->Reset();
-    commandList->Reset(commandAllocator.Get(), nullptr);
+    commandAllocators[context]->Reset();
+    commandList->Reset(commandAllocators[context].Get(), nullptr);
+
+    // The back buffer is only needed for the final copy, so its transition
+    // can overlap the rest of the frame.
+    resourceStates.beginTransition(renderTargets[frameIdx].Get(), STATE_COPY_DEST);
+    flush_barriers(commandList.Get());
+
+    if (animationEnabled)
+        animateMesh(frameContexts.lastFence());
+
+    if (hybridEnabled) {
+        resourceStates.transition(gbuffer.Get(), STATE_RENDER_TARGET);
+        flush_barriers(commandList.Get());
+
+        const float clearColor[4] = {};
+        D3D12_CPU_DESCRIPTOR_HANDLE rtv = gbufferRtvHeap->GetCPUDescriptorHandleForHeapStart();
+        D3D12_CPU_DESCRIPTOR_HANDLE dsv = dsvHeap->GetCPUDescriptorHandleForHeapStart();
+        commandList->ClearRenderTargetView(rtv, clearColor, 0, nullptr);
+        commandList->ClearDepthStencilView(dsv, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+        commandList->OMSetRenderTargets(1, &rtv, FALSE, &dsv);
+        D3D12_VIEWPORT viewport = { 0.0f, 0.0f, (float)width, (float)height, 0.0f, 1.0f };
+        D3D12_RECT scissor = { 0, 0, width, height };
+        commandList->RSSetViewports(1, &viewport);
+        commandList->RSSetScissorRects(1, &scissor);
+
+        commandList->SetPipelineState(pipelineState.Get());
+        commandList->SetGraphicsRootSignature(rasterRootSignature.Get());
+        commandList->SetGraphicsRootConstantBufferView(0, sceneConstantsAddress);
+        commandList->SetGraphicsRootShaderResourceView(3, instanceRecords.address);
+        for (size_t mesh = 0; mesh < meshes.size(); mesh++) {
+            commandList->SetGraphicsRootShaderResourceView(1, gpuMeshes[mesh].ib.address);
+            commandList->SetGraphicsRootShaderResourceView(2, gpuMeshes[mesh].vb.address);
+            commandList->SetGraphicsRoot32BitConstant(4, rasterFirstInstance[mesh], 0);
+            gpuMeshes[mesh].draw(commandList, rasterFirstInstance[mesh + 1] - rasterFirstInstance[mesh]);
+        }
+
+        resourceStates.transition(gbuffer.Get(), STATE_NON_PIXEL_SHADER_RESOURCE);
+    }
+
     commandList->SetDescriptorHeaps(1, srvHeap.GetAddressOf());
     commandList->SetComputeRootSignature(rootSignature.Get());
     commandList->SetComputeRootDescriptorTable(0, srvHeap->GetGPUDescriptorHandleForHeapStart());
-    commandList->SetComputeRootShaderResourceView(1, tlasResult->GetGPUVirtualAddress());
-    commandList->SetComputeRootConstantBufferView(2, cameraConstantBuffer->GetGPUVirtualAddress());
-    commandList->SetComputeRootDescriptorTable(3, {srvHeap->GetGPUDescriptorHandleForHeapStart().ptr+cbvDescriptorSize});
+    commandList->SetComputeRootShaderResourceView(1, tlasResult.address);
+    commandList->SetComputeRootConstantBufferView(2, sceneConstantsAddress);
+    commandList->SetComputeRootUnorderedAccessView(3, historyBuffer->GetGPUVirtualAddress());
+    commandList->SetComputeRootUnorderedAccessView(4, statsBuffer->GetGPUVirtualAddress());
 
     D3D12_DISPATCH_RAYS_DESC desc = {};
-    desc.RayGenerationShaderRecord.StartAddress = raygenTable->GetGPUVirtualAddress();
-    desc.RayGenerationShaderRecord.SizeInBytes = 64;
-    desc.HitGroupTable.StartAddress = hitTable->GetGPUVirtualAddress();
-    desc.HitGroupTable.SizeInBytes = 64;
-    desc.HitGroupTable.StrideInBytes = 64;
-    desc.MissShaderTable.StartAddress = missTable->GetGPUVirtualAddress();
-    desc.MissShaderTable.SizeInBytes = 64;
-    desc.MissShaderTable.StrideInBytes = 64;
+    D3D12_GPU_VIRTUAL_ADDRESS tables = shaderTableBuffer.address;
+    desc.RayGenerationShaderRecord = { tables + shaderTableLayout.rayGen.offset, shaderTableLayout.rayGen.size };
+    desc.MissShaderTable = { tables + shaderTableLayout.miss.offset, shaderTableLayout.miss.size, shaderTableLayout.miss.stride };
+    desc.HitGroupTable = { tables + shaderTableLayout.hitGroup.offset, shaderTableLayout.hitGroup.size, shaderTableLayout.hitGroup.stride };
     desc.Width = width;
     desc.Height = height;
     desc.Depth = 1;
 
+    // rtTexture is left as a copy source by the previous frame and only
+    // comes back here, together with the G-buffer transition.
+    resourceStates.transition(rtTexture.Get(), STATE_UNORDERED_ACCESS);
+    flush_barriers(commandList.Get());
     commandList->SetPipelineState1(rtPSO.Get());
     commandList->DispatchRays(&desc);
 
-    D3D12_RESOURCE_BARRIER preCopyBarriers[2];
-    preCopyBarriers[0] = CD3DX12_RESOURCE_BARRIER::Transition(renderTargets[frameIdx].Get(), D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_COPY_DEST);
-    preCopyBarriers[1] = CD3DX12_RESOURCE_BARRIER::Transition(rtTexture.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE);
-    commandList->ResourceBarrier(_countof(preCopyBarriers), preCopyBarriers);
+    resourceStates.transition(renderTargets[frameIdx].Get(), STATE_COPY_DEST);
+    resourceStates.transition(rtTexture.Get(), STATE_COPY_SOURCE);
+    resourceStates.transition(statsBuffer.Get(), STATE_COPY_SOURCE);
+    flush_barriers(commandList.Get());
     commandList->CopyResource(renderTargets[frameIdx].Get(), rtTexture.Get());
-    D3D12_RESOURCE_BARRIER postCopyBarriers[2];
-    postCopyBarriers[0] = CD3DX12_RESOURCE_BARRIER::Transition(renderTargets[frameIdx].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PRESENT);
-    postCopyBarriers[1] = CD3DX12_RESOURCE_BARRIER::Transition(rtTexture.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-    commandList->ResourceBarrier(_countof(postCopyBarriers), postCopyBarriers);
+    commandList->CopyResource(statsReadback[context].Get(), statsBuffer.Get());
+    // Buffers decay to COMMON when the command list finishes, so the stats
+    // buffer goes back to unordered access before then.
+    resourceStates.transition(renderTargets[frameIdx].Get(), STATE_PRESENT);
+    resourceStates.transition(statsBuffer.Get(), STATE_UNORDERED_ACCESS);
+    flush_barriers(commandList.Get());
     commandList->Close();
 
     ID3D12CommandList* const commandLists[] = { commandList.Get() };
     commandQueue->ExecuteCommandLists(1, commandLists);
     swapchain->Present(1, 0);
 
-    wait_until_finished();
+    UINT64 frameFence = signal_queue();
+    uploadRing.finishFrame(frameFence);
+    frameContexts.end(frameFence);
+    sceneConstants.frame_index++;
+
+    if (sceneConstants.frame_index % 60 == 0) {
+        char message[128];
+        snprintf(message, sizeof(message), "Reprojection: %.1f%% of pixel paths reused\n", 100.0f * reusedFraction);
+        OutputDebugStringA(message);
+    }
+}
+
+void RefractionDemo::shutdown()
+{
+    // Frames still in flight use the device, heaps and buffers released at exit.
+    wait_for_fence(frameContexts.lastFence());
+    if (pendingBlasUpdate.valid())
+        pendingBlasUpdate.wait();
+}
+
+void RefractionDemo::setReprojection(bool enabled, unsigned refreshInterval)
+{
+    reprojectionEnabled = enabled;
+    reprojectionRefreshInterval = refreshInterval > 0 ? refreshInterval : 1;
+}
+
+float RefractionDemo::reusedPixelFraction()
+{
+    return reusedFraction;
+}
+
+void RefractionDemo::setHybrid(bool enabled)
+{
+    hybridEnabled = enabled;
 }
 
+void RefractionDemo::setAnimation(bool enabled)
+{
+    animationEnabled = enabled;
+}
+
+void RefractionDemo::setInstanceGrid(unsigned side)
+{
+    instanceGridSide = side;
+}
+
+void RefractionDemo::setFramesInFlight(unsigned count)
+{
+    framesInFlight = std::min(std::max(count, 1u), maxFramesInFlight);
+}
@@ -1,12 +1,40 @@
 #pragma once
 
 #include "stdafx.h"
+#include "Bvh.hpp"
 #include "Mesh.hpp"
 
 
 namespace RefractionDemo {
 
+// Scatter side x side instances of sphere.obj on the floor around the glass
+// shell. Call before initialize.
+void setInstanceGrid(unsigned side);
+
+// Let the CPU record up to count frames ahead of the GPU (at most 4). With 1
+// every frame waits for the GPU to finish. Call before initialize.
+void setFramesInFlight(unsigned count);
+
 void initialize(HWND hWnd, int width, int height);
 void drawFrame();
+// Wait until the GPU has finished every submitted frame. Call before exiting.
+void shutdown();
+
+// Reuse the previous frame's path results where the primary hit is unchanged
+// and was seen from nearly the same direction, since refraction depends on it.
+// A pixel is always re-traced at least once every refreshInterval frames. Off
+// by default, and no history is reused while animation is on.
+void setReprojection(bool enabled, unsigned refreshInterval);
+// Fraction of pixels whose secondary rays were skipped, in the latest frame
+// the GPU is known to have finished.
+float reusedPixelFraction();
+
+// Rasterize primary visibility into a G-buffer and ray trace only the
+// secondary rays, instead of tracing primary rays as well.
+void setHybrid(bool enabled);
+
+// Deform the glass mesh every frame, updating or rebuilding its acceleration
+// structures as BvhUpdatePolicy decides.
+void setAnimation(bool enabled);
 
 }; // namespace RefractionDemo
\ No newline at end of file
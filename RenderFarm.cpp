@@ -0,0 +1,417 @@
+#include "RenderFarm.hpp"
+#include "DemoScene.hpp"
+#include "Socket.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+constexpr uint32_t farmProtocolVersion = 2;
+
+// Worker: HELLO, then READY once the scene is loaded and a RESULT per frame.
+// Coordinator: SETUP once, then a FRAME per READY or RESULT until DONE.
+enum FarmMessage : uint32_t
+{
+    FARM_HELLO = 1, // version
+    FARM_SETUP,     // FarmJob
+    FARM_READY,
+    FARM_FRAME,     // frame number
+    FARM_RESULT,    // frame number, then compress_rgb8 of the image
+    FARM_DONE,
+};
+
+struct FarmMessageHeader
+{
+    uint32_t type;
+    uint32_t size;
+};
+
+constexpr uint32_t maxMessageSize = 1u << 30;
+
+// Payloads are packed in native byte order; all processes run on one machine.
+struct MessageWriter
+{
+    void u32(uint32_t v) { bytes(&v, sizeof(v)); }
+    void f32(float v) { bytes(&v, sizeof(v)); }
+    void str(const std::string& s) { u32((uint32_t)s.size()); bytes(s.data(), s.size()); }
+    void bytes(const void* p, size_t size)
+    {
+        if (size == 0)
+            return;
+        size_t offset = data.size();
+        data.resize(offset + size);
+        memcpy(data.data() + offset, p, size);
+    }
+
+    std::vector<uint8_t> data;
+};
+
+struct MessageReader
+{
+    uint32_t u32() { uint32_t v = 0; bytes(&v, sizeof(v)); return v; }
+    float f32() { float v = 0.0f; bytes(&v, sizeof(v)); return v; }
+    std::string str()
+    {
+        uint32_t size = u32();
+        if (size > (size_t)(end - p)) {
+            ok = false;
+            return {};
+        }
+        std::string s((const char*)p, size);
+        p += size;
+        return s;
+    }
+    void bytes(void* out, size_t size)
+    {
+        if (size > (size_t)(end - p)) {
+            ok = false;
+            return;
+        }
+        memcpy(out, p, size);
+        p += size;
+    }
+
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+};
+
+static bool send_message(Socket& socket, FarmMessage type, const std::vector<uint8_t>& payload = {})
+{
+    FarmMessageHeader header = { type, (uint32_t)payload.size() };
+    return socket.send(&header, sizeof(header)) && (payload.empty() || socket.send(payload.data(), payload.size()));
+}
+
+static bool receive_message(Socket& socket, FarmMessage& type, std::vector<uint8_t>& payload)
+{
+    FarmMessageHeader header;
+    if (!socket.receive(&header, sizeof(header)) || header.size > maxMessageSize)
+        return false;
+    type = (FarmMessage)header.type;
+    payload.resize(header.size);
+    return header.size == 0 || socket.receive(payload.data(), header.size);
+}
+
+static std::vector<uint8_t> write_job(const FarmJob& job)
+{
+    MessageWriter w;
+    w.str(job.dataDirectory);
+    w.u32(job.instanceGridSide);
+    w.u32(job.envCubeSize);
+    w.u32((uint32_t)job.batch.firstFrame);
+    w.u32((uint32_t)job.batch.frameCount);
+    w.u32((uint32_t)job.batch.width);
+    w.u32((uint32_t)job.batch.height);
+    w.u32((uint32_t)job.batch.mode);
+    w.u32((uint32_t)job.keys.size());
+    for (const CameraKey& key : job.keys) {
+        w.f32(key.frame);
+        w.bytes(&key.eye, sizeof(key.eye));
+        w.bytes(&key.focus, sizeof(key.focus));
+    }
+    return w.data;
+}
+
+static bool read_job(const std::vector<uint8_t>& payload, FarmJob& job)
+{
+    MessageReader r = { payload.data(), payload.data() + payload.size() };
+    job.dataDirectory = r.str();
+    job.instanceGridSide = r.u32();
+    job.envCubeSize = r.u32();
+    job.batch.firstFrame = (int)r.u32();
+    job.batch.frameCount = (int)r.u32();
+    job.batch.width = (int)r.u32();
+    job.batch.height = (int)r.u32();
+    job.batch.mode = (RenderMode)r.u32();
+    uint32_t keyCount = r.u32();
+    if (!r.ok || keyCount > payload.size())
+        return false;
+    job.keys.resize(keyCount);
+    for (CameraKey& key : job.keys) {
+        key.frame = r.f32();
+        r.bytes(&key.eye, sizeof(key.eye));
+        r.bytes(&key.focus, sizeof(key.focus));
+    }
+    return r.ok && job.batch.width > 0 && job.batch.height > 0 && job.batch.width <= 16384 && job.batch.height <= 16384;
+}
+
+std::vector<uint8_t> compress_rgb8(const unsigned char* rgb, int width, int height)
+{
+    size_t rowBytes = (size_t)width * 3;
+    std::vector<uint8_t> delta(rowBytes * height);
+    for (size_t row = 0; row < (size_t)height; row++) {
+        const unsigned char* src = rgb + row * rowBytes;
+        uint8_t* dst = &delta[row * rowBytes];
+        for (size_t i = 0; i < rowBytes; i++)
+            dst[i] = (uint8_t)(src[i] - (i >= 3 ? src[i - 3] : 0));
+    }
+
+    // Control byte c < 128: c + 1 literal bytes follow. Otherwise the next
+    // byte repeats c - 125 times (3 to 130).
+    std::vector<uint8_t> out;
+    size_t i = 0, n = delta.size();
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < 130 && delta[i + run] == delta[i])
+            run++;
+        if (run >= 3) {
+            out.push_back((uint8_t)(run + 125));
+            out.push_back(delta[i]);
+            i += run;
+            continue;
+        }
+        size_t start = i, count = 0;
+        while (i < n && count < 128) {
+            if (i + 2 < n && delta[i] == delta[i + 1] && delta[i] == delta[i + 2])
+                break;
+            i++;
+            count++;
+        }
+        out.push_back((uint8_t)(count - 1));
+        out.insert(out.end(), delta.begin() + start, delta.begin() + i);
+    }
+    return out;
+}
+
+bool decompress_rgb8(const uint8_t* data, size_t size, unsigned char* rgb, int width, int height)
+{
+    size_t rowBytes = (size_t)width * 3, n = rowBytes * height, o = 0;
+    const uint8_t* end = data + size;
+    while (data < end) {
+        uint8_t c = *data++;
+        if (c < 128) {
+            size_t count = c + 1u;
+            if (count > (size_t)(end - data) || count > n - o)
+                return false;
+            memcpy(rgb + o, data, count);
+            data += count;
+            o += count;
+        } else {
+            size_t count = c - 125u;
+            if (data == end || count > n - o)
+                return false;
+            memset(rgb + o, *data++, count);
+            o += count;
+        }
+    }
+    if (o != n)
+        return false;
+    for (size_t row = 0; row < (size_t)height; row++) {
+        unsigned char* p = rgb + row * rowBytes;
+        for (size_t i = 3; i < rowBytes; i++)
+            p[i] = (unsigned char)(p[i] + p[i - 3]);
+    }
+    return true;
+}
+
+static double elapsed_seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool run_coordinator(const char* address, const FarmJob& job, double frameTimeoutSeconds, FarmStats& stats)
+{
+    stats = {};
+    const BatchOptions& batch = job.batch;
+    Socket listener;
+    if (!listener.listen(address)) {
+        fprintf(stderr, "cannot listen at %s\n", address);
+        return false;
+    }
+
+    struct Worker
+    {
+        Socket socket;
+        bool idle = false; // set up and waiting for a frame
+        int frame = -1;    // index into the batch of the frame it is rendering
+        std::chrono::steady_clock::time_point assigned;
+    };
+    std::vector<Worker> workers;
+    std::deque<int> queue;
+    for (int i = 0; i < batch.frameCount; i++)
+        queue.push_back(i);
+    std::vector<bool> done(batch.frameCount, false);
+    std::vector<bool> started(batch.frameCount, false);
+    std::vector<std::chrono::steady_clock::time_point> firstAssigned(batch.frameCount);
+    std::vector<double> latencies;
+    std::vector<uint8_t> setup = write_job(job), payload;
+    std::vector<unsigned char> rgb((size_t)batch.width * batch.height * 3);
+    std::vector<bool> ready;
+    int framesDone = 0;
+    bool failed = false;
+
+    auto start = std::chrono::steady_clock::now();
+    auto lastWorkerSeen = start;
+    auto drop = [&](Worker& worker) {
+        if (worker.frame >= 0 && !done[worker.frame]) {
+            queue.push_front(worker.frame);
+            stats.framesReissued++;
+        }
+        worker.socket.close();
+        worker.frame = -1;
+        stats.workersLost++;
+    };
+    auto handle = [&](Worker& worker) {
+        FarmMessage type;
+        if (!receive_message(worker.socket, type, payload))
+            return false;
+        if (type == FARM_HELLO) {
+            MessageReader r = { payload.data(), payload.data() + payload.size() };
+            return r.u32() == farmProtocolVersion && r.ok && send_message(worker.socket, FARM_SETUP, setup);
+        }
+        if (type == FARM_READY) {
+            worker.idle = true;
+            return true;
+        }
+        if (type != FARM_RESULT || payload.size() < 4)
+            return false;
+        uint32_t frame;
+        memcpy(&frame, payload.data(), 4);
+        if ((int)frame != worker.frame)
+            return false;
+        if (!decompress_rgb8(payload.data() + 4, payload.size() - 4, rgb.data(), batch.width, batch.height))
+            return false;
+        char filename[1024];
+        snprintf(filename, sizeof(filename), "%s%04d.ppm", batch.outputPrefix.c_str(), batch.firstFrame + worker.frame);
+        if (!write_ppm(rgb.data(), batch.width, batch.height, filename)) {
+            fprintf(stderr, "cannot write %s\n", filename);
+            failed = true;
+        }
+        done[worker.frame] = true;
+        framesDone++;
+        latencies.push_back(elapsed_seconds(firstAssigned[worker.frame]) * 1000.0);
+        stats.rawBytes += rgb.size();
+        stats.compressedBytes += payload.size() - 4;
+        worker.frame = -1;
+        worker.idle = true;
+        return true;
+    };
+
+    while (framesDone < batch.frameCount && !failed) {
+        std::vector<const Socket*> sockets = { &listener };
+        for (const Worker& worker : workers)
+            sockets.push_back(&worker.socket);
+        if (!Socket::poll(sockets, 100, ready))
+            return false;
+
+        if (ready[0]) {
+            Worker worker;
+            if (listener.accept(worker.socket)) {
+                workers.push_back(std::move(worker));
+                stats.workersJoined++;
+            }
+        }
+        for (size_t i = 0; i + 1 < sockets.size(); i++) {
+            if (ready[i + 1] && !handle(workers[i]))
+                drop(workers[i]);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        for (Worker& worker : workers) {
+            if (worker.socket.isOpen() && worker.frame >= 0 && elapsed_seconds(worker.assigned) > frameTimeoutSeconds) {
+                fprintf(stderr, "worker timed out on frame %d\n", batch.firstFrame + worker.frame);
+                drop(worker);
+            }
+        }
+        for (Worker& worker : workers) {
+            while (worker.socket.isOpen() && worker.idle && !queue.empty()) {
+                int frame = queue.front();
+                queue.pop_front();
+                if (done[frame])
+                    continue;
+                if (!started[frame]) {
+                    started[frame] = true;
+                    firstAssigned[frame] = now;
+                }
+                MessageWriter w;
+                w.u32((uint32_t)frame);
+                worker.frame = frame;
+                worker.assigned = now;
+                worker.idle = false;
+                if (!send_message(worker.socket, FARM_FRAME, w.data))
+                    drop(worker);
+            }
+        }
+        workers.erase(std::remove_if(workers.begin(), workers.end(), [](const Worker& worker) { return !worker.socket.isOpen(); }),
+            workers.end());
+
+        if (!workers.empty())
+            lastWorkerSeen = now;
+        else if (std::chrono::duration<double>(now - lastWorkerSeen).count() > frameTimeoutSeconds) {
+            fprintf(stderr, "no workers connected for %.0f s\n", frameTimeoutSeconds);
+            return false;
+        }
+    }
+
+    for (Worker& worker : workers)
+        send_message(worker.socket, FARM_DONE);
+    stats.batch.frames = framesDone;
+    stats.batch.seconds = elapsed_seconds(start);
+    stats.batch.framesPerSecond = framesDone / std::max(stats.batch.seconds, 1e-9);
+    set_latency_percentiles(latencies, stats.batch);
+    return !failed;
+}
+
+bool run_worker(const char* address, double connectTimeoutSeconds)
+{
+    Socket socket;
+    auto start = std::chrono::steady_clock::now();
+    while (!socket.connect(address)) {
+        if (elapsed_seconds(start) > connectTimeoutSeconds) {
+            fprintf(stderr, "cannot connect to %s\n", address);
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    MessageWriter hello;
+    hello.u32(farmProtocolVersion);
+    FarmMessage type;
+    std::vector<uint8_t> payload;
+    FarmJob job;
+    if (!send_message(socket, FARM_HELLO, hello.data) || !receive_message(socket, type, payload) || type != FARM_SETUP ||
+        !read_job(payload, job))
+        return false;
+
+    CpuDemoScene demo;
+    if (!demo.load(job.dataDirectory.c_str(), job.instanceGridSide)) {
+        fprintf(stderr, "cannot load the scene from %s\n", job.dataDirectory.c_str());
+        return false;
+    }
+    CameraPath path;
+    path.keys = job.keys;
+    CpuRenderer renderer;
+    renderer.scene = &demo.scene;
+    renderer.envMap = &demo.envMap;
+    if (job.envCubeSize) {
+        demo.envMap.bakeCubeMap((int)job.envCubeSize);
+        renderer.cubeEnvMap = true;
+    }
+    Image image;
+    image.resize(job.batch.width, job.batch.height);
+    std::vector<unsigned char> rgb(image.pixels.size() * 3);
+
+    if (!send_message(socket, FARM_READY))
+        return false;
+    for (;;) {
+        if (!receive_message(socket, type, payload))
+            return false;
+        if (type == FARM_DONE)
+            return true;
+        MessageReader r = { payload.data(), payload.data() + payload.size() };
+        uint32_t frame = r.u32();
+        if (type != FARM_FRAME || !r.ok)
+            return false;
+        renderer.render(path.at(job.batch.firstFrame + (int)frame), image, job.batch.mode);
+        to_rgb8(image, rgb.data());
+        MessageWriter result;
+        result.u32(frame);
+        std::vector<uint8_t> packed = compress_rgb8(rgb.data(), image.width, image.height);
+        result.bytes(packed.data(), packed.size());
+        if (!send_message(socket, FARM_RESULT, result.data))
+            return false;
+    }
+}
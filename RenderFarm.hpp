@@ -0,0 +1,44 @@
+#pragma once
+
+#include "BatchRender.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// A batch render split by frame across worker processes. Workers connect to
+// the coordinator over a Socket, get the job once, then ask for one frame at
+// a time and send it back as compressed RGB8.
+struct FarmJob
+{
+    std::string dataDirectory; // as the workers see it
+    uint32_t instanceGridSide = 0;
+    uint32_t envCubeSize = 0;  // bake the environment into cube faces this size; 0 for lat-long
+    BatchOptions batch;
+    std::vector<CameraKey> keys; // empty for the drawFrame orbit
+};
+
+struct FarmStats
+{
+    BatchStats batch;
+    uint32_t workersJoined = 0;
+    uint32_t workersLost = 0;    // disconnected or timed out before the job ended
+    uint32_t framesReissued = 0; // frames handed out again after their worker was lost
+    uint64_t rawBytes = 0;       // RGB8 size of the frames received
+    uint64_t compressedBytes = 0;
+};
+
+// Listen at address and hand the job's frames to the workers that connect,
+// writing each frame as it arrives. A worker that disconnects, or keeps a
+// frame longer than frameTimeoutSeconds, is dropped and its frame goes back
+// to the queue. Fails if a frame cannot be written, or if no worker has been
+// connected for frameTimeoutSeconds.
+bool run_coordinator(const char* address, const FarmJob& job, double frameTimeoutSeconds, FarmStats& stats);
+
+// Connect to the coordinator at address, retrying for connectTimeoutSeconds,
+// load the scene it names and render frames until it reports the job done.
+bool run_worker(const char* address, double connectTimeoutSeconds = 10.0);
+
+// Byte-wise delta from the pixel to the left, then PackBits run-length
+// coding. Lossless; rendered backgrounds shrink well.
+std::vector<uint8_t> compress_rgb8(const unsigned char* rgb, int width, int height);
+bool decompress_rgb8(const uint8_t* data, size_t size, unsigned char* rgb, int width, int height);
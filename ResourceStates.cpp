@@ -0,0 +1,182 @@
+#include "ResourceStates.hpp"
+
+#include <algorithm>
+
+constexpr uint32_t writeStates = STATE_RENDER_TARGET | STATE_UNORDERED_ACCESS | STATE_DEPTH_WRITE | STATE_STREAM_OUT |
+    STATE_COPY_DEST | STATE_RESOLVE_DEST | STATE_RAYTRACING_ACCELERATION_STRUCTURE;
+
+// States the GPU can combine with other read-only states. COMMON is not one
+// of them, since it relies on implicit promotion.
+static bool read_only(uint32_t state)
+{
+    return state != STATE_COMMON && !(state & writeStates);
+}
+
+// State a subresource must be put in for the next commands to use it in
+// requested, starting from current.
+static uint32_t combine(uint32_t current, uint32_t requested)
+{
+    if (read_only(current) && read_only(requested))
+        return current | requested;
+    return requested;
+}
+
+// Append the transitions of one resource, as one barrier if every
+// subresource makes the same one. before[s] == after[s] means none.
+static void emit_transitions(std::vector<ResourceBarrier>& barriers, const void* resource, BarrierSplit split,
+    const std::vector<uint32_t>& before, const std::vector<uint32_t>& after)
+{
+    size_t changed = 0;
+    bool uniform = true;
+    for (size_t s = 0; s < before.size(); s++) {
+        if (before[s] != after[s])
+            changed++;
+        if (before[s] != before[0] || after[s] != after[0])
+            uniform = false;
+    }
+    if (changed == before.size() && uniform) {
+        barriers.push_back({ BARRIER_TRANSITION, split, resource, allSubresources, before[0], after[0] });
+        return;
+    }
+    for (size_t s = 0; s < before.size(); s++) {
+        if (before[s] != after[s])
+            barriers.push_back({ BARRIER_TRANSITION, split, resource, (uint32_t)s, before[s], after[s] });
+    }
+}
+
+void ResourceStateTracker::track(const void* resource, uint32_t subresourceCount, uint32_t state)
+{
+    resources[resource].assign(std::max(subresourceCount, 1u), { state, noSplit });
+}
+
+void ResourceStateTracker::forget(const void* resource)
+{
+    resources.erase(resource);
+}
+
+std::vector<ResourceStateTracker::Subresource>& ResourceStateTracker::subresources(const void* resource)
+{
+    std::vector<Subresource>& subs = resources[resource];
+    if (subs.empty())
+        subs.push_back({ STATE_COMMON, noSplit });
+    return subs;
+}
+
+void ResourceStateTracker::transition(const void* resource, uint32_t state, uint32_t subresource)
+{
+    requests.push_back({ resource, subresource, state, false });
+}
+
+void ResourceStateTracker::beginTransition(const void* resource, uint32_t state, uint32_t subresource)
+{
+    requests.push_back({ resource, subresource, state, true });
+}
+
+void ResourceStateTracker::uavBarrier(const void* resource)
+{
+    if (std::find(uavRequests.begin(), uavRequests.end(), resource) == uavRequests.end())
+        uavRequests.push_back(resource);
+}
+
+uint32_t ResourceStateTracker::state(const void* resource, uint32_t subresource) const
+{
+    auto it = resources.find(resource);
+    if (it == resources.end() || subresource >= it->second.size())
+        return STATE_COMMON;
+    return it->second[subresource].state;
+}
+
+std::vector<ResourceBarrier> ResourceStateTracker::flush()
+{
+    // Fold the requests into the state each touched subresource must end up
+    // in, per resource in order of first request.
+    std::vector<const void*> order;
+    std::unordered_map<const void*, std::vector<uint32_t>> targets;
+    std::unordered_map<const void*, std::vector<uint8_t>> touched;
+    for (const Request& request : requests) {
+        if (request.begin)
+            continue;
+        std::vector<Subresource>& subs = subresources(request.resource);
+        std::vector<uint32_t>& target = targets[request.resource];
+        if (target.empty()) {
+            order.push_back(request.resource);
+            for (const Subresource& sub : subs)
+                target.push_back(sub.state);
+            touched[request.resource].assign(subs.size(), 0);
+        }
+        size_t first = request.subresource == allSubresources ? 0 : request.subresource;
+        size_t last = request.subresource == allSubresources ? subs.size() : std::min(subs.size(), first + 1);
+        for (size_t s = first; s < last; s++) {
+            target[s] = combine(target[s], request.state);
+            touched[request.resource][s] = 1;
+        }
+    }
+
+    std::vector<ResourceBarrier> barriers;
+    std::vector<const void*> transitioned;
+    for (const void* resource : order) {
+        std::vector<Subresource>& subs = resources[resource];
+        const std::vector<uint32_t>& target = targets[resource];
+        const std::vector<uint8_t>& used = touched[resource];
+
+        // A split barrier ends when its subresource is next used.
+        std::vector<uint32_t> before(subs.size()), after(subs.size());
+        bool ends = false;
+        for (size_t s = 0; s < subs.size(); s++) {
+            bool end = used[s] && subs[s].splitBefore != noSplit;
+            before[s] = end ? subs[s].splitBefore : subs[s].state;
+            after[s] = subs[s].state;
+            if (end) {
+                subs[s].splitBefore = noSplit;
+                ends = true;
+            }
+        }
+        if (ends)
+            emit_transitions(barriers, resource, BARRIER_SPLIT_END, before, after);
+
+        bool changes = false;
+        for (size_t s = 0; s < subs.size(); s++) {
+            before[s] = subs[s].state;
+            after[s] = target[s];
+            if (before[s] != after[s])
+                changes = true;
+            subs[s].state = target[s];
+        }
+        if (changes)
+            emit_transitions(barriers, resource, BARRIER_SPLIT_NONE, before, after);
+        if (ends || changes)
+            transitioned.push_back(resource);
+    }
+
+    // Split barriers start after everything the batch needs now.
+    for (const Request& request : requests) {
+        if (!request.begin)
+            continue;
+        std::vector<Subresource>& subs = subresources(request.resource);
+        std::vector<uint32_t> before(subs.size()), after(subs.size());
+        bool begins = false;
+        size_t first = request.subresource == allSubresources ? 0 : request.subresource;
+        size_t last = request.subresource == allSubresources ? subs.size() : std::min(subs.size(), first + 1);
+        for (size_t s = 0; s < subs.size(); s++) {
+            before[s] = after[s] = subs[s].state;
+            if (s < first || s >= last || subs[s].splitBefore != noSplit || subs[s].state == request.state)
+                continue;
+            after[s] = request.state;
+            subs[s].splitBefore = subs[s].state;
+            subs[s].state = request.state;
+            begins = true;
+        }
+        if (begins)
+            emit_transitions(barriers, request.resource, BARRIER_SPLIT_BEGIN, before, after);
+    }
+
+    // A transition already waits for earlier writes to the resource.
+    for (const void* resource : uavRequests) {
+        if (std::find(transitioned.begin(), transitioned.end(), resource) == transitioned.end())
+            barriers.push_back({ BARRIER_UAV, BARRIER_SPLIT_NONE, resource, allSubresources, 0, 0 });
+    }
+
+    requests.clear();
+    uavRequests.clear();
+    return barriers;
+}
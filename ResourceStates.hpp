@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// Bit values of D3D12_RESOURCE_STATES, so the tracker needs no D3D12 headers.
+enum ResourceState : uint32_t
+{
+    STATE_COMMON = 0,
+    STATE_PRESENT = 0,
+    STATE_VERTEX_AND_CONSTANT_BUFFER = 0x1,
+    STATE_INDEX_BUFFER = 0x2,
+    STATE_RENDER_TARGET = 0x4,
+    STATE_UNORDERED_ACCESS = 0x8,
+    STATE_DEPTH_WRITE = 0x10,
+    STATE_DEPTH_READ = 0x20,
+    STATE_NON_PIXEL_SHADER_RESOURCE = 0x40,
+    STATE_PIXEL_SHADER_RESOURCE = 0x80,
+    STATE_STREAM_OUT = 0x100,
+    STATE_INDIRECT_ARGUMENT = 0x200,
+    STATE_COPY_DEST = 0x400,
+    STATE_COPY_SOURCE = 0x800,
+    STATE_RESOLVE_DEST = 0x1000,
+    STATE_RESOLVE_SOURCE = 0x2000,
+    STATE_RAYTRACING_ACCELERATION_STRUCTURE = 0x400000,
+};
+
+// Same values as D3D12_RESOURCE_BARRIER_TYPE and D3D12_RESOURCE_BARRIER_FLAGS.
+enum BarrierType
+{
+    BARRIER_TRANSITION = 0,
+    BARRIER_UAV = 2,
+};
+
+enum BarrierSplit
+{
+    BARRIER_SPLIT_NONE = 0,
+    BARRIER_SPLIT_BEGIN = 1,
+    BARRIER_SPLIT_END = 2,
+};
+
+constexpr uint32_t allSubresources = 0xffffffff;
+
+struct ResourceBarrier
+{
+    BarrierType type;
+    BarrierSplit split;
+    const void* resource;
+    uint32_t subresource; // allSubresources for the whole resource
+    uint32_t before;      // transitions only
+    uint32_t after;
+};
+
+// Knows the state every tracked resource will be in once the barriers
+// emitted so far have executed, and turns the states that the next commands
+// need into as few barriers as possible. Requests only take effect at
+// flush(), which is called right before the commands that depend on them:
+//  - requests for the same resource in one batch collapse into one
+//    transition from the current state, or none if it ends where it was;
+//  - a read-only state that the current one already includes needs no
+//    barrier, and two read-only states are combined instead of swapped;
+//  - a transition of every subresource to the same state is one barrier;
+//  - a UAV barrier is dropped when the resource transitions in the batch,
+//    and requested once per resource however often it was asked for.
+// beginTransition() starts a split barrier at the next flush; the transition
+// that later asks for that state ends it. Resources are identified by any
+// pointer, usually the ID3D12Resource.
+struct ResourceStateTracker
+{
+    void track(const void* resource, uint32_t subresourceCount, uint32_t state);
+    void forget(const void* resource);
+
+    // The commands after the next flush use the subresource in state.
+    // Untracked resources are taken to start out in STATE_COMMON.
+    void transition(const void* resource, uint32_t state, uint32_t subresource = allSubresources);
+    // Commands after the next flush need state, but not the ones right after
+    // it, so the GPU may start the transition early.
+    void beginTransition(const void* resource, uint32_t state, uint32_t subresource = allSubresources);
+    // Unordered access after the next flush must see earlier writes.
+    void uavBarrier(const void* resource);
+
+    // Barriers for the requests since the last flush, in request order.
+    std::vector<ResourceBarrier> flush();
+
+    // Where tracking believes the subresource is, or will be once a split
+    // transition ends.
+    uint32_t state(const void* resource, uint32_t subresource = 0) const;
+
+    static constexpr uint32_t noSplit = 0xffffffff;
+
+    struct Subresource
+    {
+        uint32_t state;
+        uint32_t splitBefore; // state a begun split barrier leaves, or noSplit
+    };
+
+    struct Request
+    {
+        const void* resource;
+        uint32_t subresource;
+        uint32_t state;
+        bool begin;
+    };
+
+    std::vector<Subresource>& subresources(const void* resource);
+
+    std::unordered_map<const void*, std::vector<Subresource>> resources;
+    std::vector<Request> requests;
+    std::vector<const void*> uavRequests;
+};
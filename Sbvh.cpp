@@ -0,0 +1,364 @@
+#include "Bvh.hpp"
+
+#include <algorithm>
+
+constexpr float INF = 1e30f;
+constexpr int maxDepth = 64;
+
+namespace {
+
+struct Bounds
+{
+    float3 bmin = { INF, INF, INF };
+    float3 bmax = { -INF, -INF, -INF };
+
+    void grow(float3 p) { bmin = min(bmin, p); bmax = max(bmax, p); }
+    void grow(const Bounds& b) { bmin = min(bmin, b.bmin); bmax = max(bmax, b.bmax); }
+    bool valid() const { return bmin.x <= bmax.x && bmin.y <= bmax.y && bmin.z <= bmax.z; }
+    float area() const { return valid() ? surface_area(bmin, bmax) : 0.0f; }
+};
+
+// A triangle, or the part of it inside a box after spatial splits.
+struct Reference
+{
+    Bounds bounds;
+    uint32_t prim;
+};
+
+struct ObjectBin
+{
+    Bounds bounds;
+    uint32_t count = 0;
+};
+
+struct SpatialBin
+{
+    Bounds bounds;
+    uint32_t entries = 0; // references whose extent starts in this bin
+    uint32_t exits = 0;   // references whose extent ends in this bin
+};
+
+struct Split
+{
+    float cost = INF;
+    int axis = -1;
+    int plane = 0;
+    float position = 0.0f; // spatial splits only
+    Bounds left, right;
+    uint32_t leftCount = 0, rightCount = 0;
+};
+
+struct Pending
+{
+    uint32_t node;
+    int depth;
+    std::vector<Reference> refs;
+};
+
+} // namespace
+
+static inline float& component_ref(float3& a, int axis)
+{
+    return axis == 0 ? a.x : (axis == 1 ? a.y : a.z);
+}
+
+static inline float3 centre(const Reference& ref)
+{
+    return (ref.bounds.bmin + ref.bounds.bmax) * 0.5f;
+}
+
+static inline Bounds intersection(const Bounds& a, const Bounds& b)
+{
+    Bounds r;
+    r.bmin = max(a.bmin, b.bmin);
+    r.bmax = min(a.bmax, b.bmax);
+    return r;
+}
+
+// Cut the part of triangle prim inside box at position on axis. Each side's
+// box is the part of the triangle on that side, kept within box. A side the
+// triangle does not actually reach comes back invalid.
+static void split_reference(const Mesh& mesh, uint32_t prim, Bounds box, int axis, float position, Bounds& l, Bounds& r)
+{
+    l = r = Bounds();
+    for (int k = 0; k < 3; k++) {
+        float3 v0 = vertex_position(mesh, prim, k);
+        float3 v1 = vertex_position(mesh, prim, (k + 1) % 3);
+        float p0 = component(v0, axis), p1 = component(v1, axis);
+        if (p0 <= position)
+            l.grow(v0);
+        if (p0 >= position)
+            r.grow(v0);
+        if ((p0 < position && p1 > position) || (p0 > position && p1 < position)) {
+            float3 p = v0 + clamp((position - p0) / (p1 - p0), 0.0f, 1.0f) * (v1 - v0);
+            component_ref(p, axis) = position;
+            l.grow(p);
+            r.grow(p);
+        }
+    }
+    l = intersection(l, box);
+    r = intersection(r, box);
+}
+
+static Split find_object_split(const std::vector<Reference>& refs, int binCount)
+{
+    Bounds centroids;
+    for (const Reference& ref : refs)
+        centroids.grow(centre(ref));
+
+    Split best;
+    std::vector<ObjectBin> bins(binCount);
+    std::vector<ObjectBin> rightSweep(binCount);
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = component(centroids.bmin, axis), extent = component(centroids.bmax, axis) - lo;
+        if (extent <= 0.0f)
+            continue;
+        float scale = binCount / extent;
+        std::fill(bins.begin(), bins.end(), ObjectBin());
+        for (const Reference& ref : refs) {
+            int b = std::min(binCount - 1, (int)((component(centre(ref), axis) - lo) * scale));
+            bins[b].count++;
+            bins[b].bounds.grow(ref.bounds);
+        }
+
+        ObjectBin right;
+        for (int i = binCount - 1; i > 0; i--) {
+            right.count += bins[i].count;
+            right.bounds.grow(bins[i].bounds);
+            rightSweep[i - 1] = right;
+        }
+        ObjectBin left;
+        for (int i = 0; i < binCount - 1; i++) {
+            left.count += bins[i].count;
+            left.bounds.grow(bins[i].bounds);
+            if (left.count == 0 || rightSweep[i].count == 0)
+                continue;
+            float cost = left.count * left.bounds.area() + rightSweep[i].count * rightSweep[i].bounds.area();
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.plane = i;
+                best.left = left.bounds;
+                best.right = rightSweep[i].bounds;
+                best.leftCount = left.count;
+                best.rightCount = rightSweep[i].count;
+            }
+        }
+    }
+    return best;
+}
+
+static Split find_spatial_split(const Mesh& mesh, const std::vector<Reference>& refs, const Bounds& nodeBounds, int binCount)
+{
+    Split best;
+    std::vector<SpatialBin> bins(binCount);
+    std::vector<SpatialBin> rightSweep(binCount);
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = component(nodeBounds.bmin, axis), extent = component(nodeBounds.bmax, axis) - lo;
+        if (extent <= 0.0f)
+            continue;
+        float binWidth = extent / binCount;
+        auto binOf = [&](float x) { return std::max(0, std::min(binCount - 1, (int)((x - lo) / binWidth))); };
+
+        // Chop each reference at the bin boundaries it crosses.
+        std::fill(bins.begin(), bins.end(), SpatialBin());
+        for (const Reference& ref : refs) {
+            int first = binOf(component(ref.bounds.bmin, axis));
+            int last = binOf(component(ref.bounds.bmax, axis));
+            Bounds rest = ref.bounds;
+            for (int b = first; b < last; b++) {
+                Bounds piece;
+                split_reference(mesh, ref.prim, rest, axis, lo + binWidth * (b + 1), piece, rest);
+                if (piece.valid())
+                    bins[b].bounds.grow(piece);
+            }
+            if (rest.valid())
+                bins[last].bounds.grow(rest);
+            bins[first].entries++;
+            bins[last].exits++;
+        }
+
+        SpatialBin right;
+        for (int i = binCount - 1; i > 0; i--) {
+            right.exits += bins[i].exits;
+            right.bounds.grow(bins[i].bounds);
+            rightSweep[i - 1] = right;
+        }
+        SpatialBin left;
+        for (int i = 0; i < binCount - 1; i++) {
+            left.entries += bins[i].entries;
+            left.bounds.grow(bins[i].bounds);
+            if (left.entries == 0 || rightSweep[i].exits == 0)
+                continue;
+            float cost = left.entries * left.bounds.area() + rightSweep[i].exits * rightSweep[i].bounds.area();
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.plane = i;
+                best.position = lo + binWidth * (i + 1);
+                best.left = left.bounds;
+                best.right = rightSweep[i].bounds;
+                best.leftCount = left.entries;
+                best.rightCount = rightSweep[i].exits;
+            }
+        }
+    }
+    return best;
+}
+
+// Stich et al. 2009. Each node takes the cheaper of the best object split and
+// the best spatial split. Spatial splits are only tried where the object
+// split's children overlap noticeably, and stop once the reference budget is
+// used up.
+void build_sbvh_nodes(const Mesh& mesh, const BvhBuildOptions& options, std::vector<BvhNode>& nodes,
+    std::vector<uint32_t>& primIndices)
+{
+    nodes.clear();
+    primIndices.clear();
+    uint32_t triCount = (uint32_t)(mesh.indices.size() / 3);
+    if (triCount == 0)
+        return;
+
+    Pending root = { 0, 0, std::vector<Reference>(triCount) };
+    Bounds rootBounds;
+    for (uint32_t i = 0; i < triCount; i++) {
+        Bounds b;
+        for (int k = 0; k < 3; k++)
+            b.grow(vertex_position(mesh, i, k));
+        root.refs[i] = { b, i };
+        rootBounds.grow(b);
+    }
+    BvhNode rootNode = {};
+    rootNode.bmin = rootBounds.bmin;
+    rootNode.bmax = rootBounds.bmax;
+    nodes.reserve(2 * (size_t)triCount);
+    nodes.push_back(rootNode);
+    primIndices.reserve(triCount);
+
+    int binCount = std::max(options.binCount, 2);
+    float minOverlap = options.splitAlpha * rootBounds.area();
+    size_t refBudget = (size_t)(triCount * std::max(options.splitBudget, 0.0f));
+    size_t refCount = triCount;
+
+    auto makeLeaf = [&](const Pending& pending) {
+        BvhNode& leaf = nodes[pending.node];
+        leaf.leftFirst = (uint32_t)primIndices.size();
+        leaf.count = (uint32_t)pending.refs.size();
+        for (const Reference& ref : pending.refs)
+            primIndices.push_back(ref.prim);
+    };
+
+    std::vector<Pending> stack;
+    stack.push_back(std::move(root));
+    while (!stack.empty()) {
+        Pending pending = std::move(stack.back());
+        stack.pop_back();
+        std::vector<Reference>& refs = pending.refs;
+        uint32_t count = (uint32_t)refs.size();
+        Bounds nodeBounds;
+        nodeBounds.bmin = nodes[pending.node].bmin;
+        nodeBounds.bmax = nodes[pending.node].bmax;
+
+        Split split;
+        bool spatial = false;
+        if (count > 1 && pending.depth < maxDepth) {
+            split = find_object_split(refs, binCount);
+            Bounds overlap = intersection(split.left, split.right);
+            if (split.axis < 0 || overlap.area() > minOverlap) {
+                Split spatialSplit = find_spatial_split(mesh, refs, nodeBounds, binCount);
+                size_t duplicates = spatialSplit.leftCount + spatialSplit.rightCount - count;
+                if (spatialSplit.cost < split.cost && refCount + duplicates <= triCount + refBudget) {
+                    split = spatialSplit;
+                    spatial = true;
+                }
+            }
+        }
+
+        float splitCost = options.traversalCost + split.cost / nodeBounds.area();
+        if (split.axis < 0 || (splitCost >= count && count <= (uint32_t)options.maxLeafSize)) {
+            makeLeaf(pending);
+            continue;
+        }
+
+        std::vector<Reference> left, right;
+        left.reserve(count);
+        right.reserve(count);
+        if (spatial) {
+            // A straddling reference goes to both sides unless keeping it
+            // whole on one side is cheaper (reference unsplitting).
+            uint32_t leftCount = 0, rightCount = 0;
+            for (const Reference& ref : refs) {
+                float lo = component(ref.bounds.bmin, split.axis), hi = component(ref.bounds.bmax, split.axis);
+                leftCount += hi <= split.position || lo < split.position;
+                rightCount += hi > split.position;
+            }
+            for (const Reference& ref : refs) {
+                float lo = component(ref.bounds.bmin, split.axis), hi = component(ref.bounds.bmax, split.axis);
+                if (hi <= split.position) {
+                    left.push_back(ref);
+                    continue;
+                }
+                if (lo >= split.position) {
+                    right.push_back(ref);
+                    continue;
+                }
+                Bounds leftWhole = split.left, rightWhole = split.right;
+                leftWhole.grow(ref.bounds);
+                rightWhole.grow(ref.bounds);
+                float costSplit = split.left.area() * leftCount + split.right.area() * rightCount;
+                float costLeft = leftWhole.area() * leftCount + split.right.area() * (rightCount - 1);
+                float costRight = split.left.area() * (leftCount - 1) + rightWhole.area() * rightCount;
+                if (costLeft < costSplit && costLeft <= costRight) {
+                    left.push_back(ref);
+                    split.left = leftWhole;
+                    rightCount--;
+                } else if (costRight < costSplit) {
+                    right.push_back(ref);
+                    split.right = rightWhole;
+                    leftCount--;
+                } else {
+                    Bounds l, r;
+                    split_reference(mesh, ref.prim, ref.bounds, split.axis, split.position, l, r);
+                    if (l.valid())
+                        left.push_back({ l, ref.prim });
+                    if (r.valid())
+                        right.push_back({ r, ref.prim });
+                }
+            }
+            refCount += left.size() + right.size() - count;
+        } else {
+            Bounds centroids;
+            for (const Reference& ref : refs)
+                centroids.grow(centre(ref));
+            float lo = component(centroids.bmin, split.axis);
+            float scale = binCount / (component(centroids.bmax, split.axis) - lo);
+            for (const Reference& ref : refs) {
+                int b = std::min(binCount - 1, (int)((component(centre(ref), split.axis) - lo) * scale));
+                (b <= split.plane ? left : right).push_back(ref);
+            }
+        }
+        if (left.empty() || right.empty()) {
+            // Only possible when rounding puts every reference on one side.
+            makeLeaf(pending);
+            continue;
+        }
+        refs = std::vector<Reference>();
+
+        BvhNode children[2] = {};
+        std::vector<Reference>* sides[2] = { &left, &right };
+        for (int side = 0; side < 2; side++) {
+            Bounds b;
+            for (const Reference& ref : *sides[side])
+                b.grow(ref.bounds);
+            children[side].bmin = b.bmin;
+            children[side].bmax = b.bmax;
+        }
+        uint32_t leftIndex = (uint32_t)nodes.size();
+        nodes[pending.node].leftFirst = leftIndex;
+        nodes[pending.node].count = 0;
+        nodes.push_back(children[0]);
+        nodes.push_back(children[1]);
+        stack.push_back({ leftIndex + 1, pending.depth + 1, std::move(right) });
+        stack.push_back({ leftIndex, pending.depth + 1, std::move(left) });
+    }
+}
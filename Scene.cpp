@@ -0,0 +1,127 @@
+#include "Scene.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+
+constexpr float INF = 1e30f;
+constexpr int maxStackDepth = 128;
+
+float3x4 inverse(const float3x4& t)
+{
+    // Inverse of the 3x3 part by cofactors, then the translation undone by it.
+    const float (*m)[4] = t.m;
+    float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    float invDet = 1.0f / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+
+    float3x4 r;
+    r.m[0][0] = c00 * invDet;
+    r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+    r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+    r.m[1][0] = c01 * invDet;
+    r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+    r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+    r.m[2][0] = c02 * invDet;
+    r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+    r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+    for (int i = 0; i < 3; i++)
+        r.m[i][3] = -(r.m[i][0] * m[0][3] + r.m[i][1] * m[1][3] + r.m[i][2] * m[2][3]);
+    return r;
+}
+
+void Scene::build(const BvhBuildOptions& options)
+{
+    uint32_t count = (uint32_t)instances.size();
+    worldToObject.resize(count);
+    std::vector<float3> instanceMin(count), instanceMax(count), centroids(count);
+    parallel_for(0, count, 256, [&](size_t i) {
+        const Instance& instance = instances[i];
+        worldToObject[i] = inverse(instance.transform);
+
+        // World bounds of the eight corners of the mesh's root box.
+        const Bvh& bvh = *meshes[instance.mesh];
+        float3 bmin = { INF, INF, INF }, bmax = { -INF, -INF, -INF };
+        if (bvh.nodeCount) {
+            const BvhNode& root = bvh.nodes[0];
+            for (int corner = 0; corner < 8; corner++) {
+                float3 p = { corner & 1 ? root.bmax.x : root.bmin.x, corner & 2 ? root.bmax.y : root.bmin.y,
+                    corner & 4 ? root.bmax.z : root.bmin.z };
+                p = transform_point(instance.transform, p);
+                bmin = min(bmin, p);
+                bmax = max(bmax, p);
+            }
+        }
+        instanceMin[i] = bmin;
+        instanceMax[i] = bmax;
+        centroids[i] = (bmin + bmax) * 0.5f;
+    });
+
+    // An instance is one opaque primitive to the top level.
+    BvhBuildOptions topOptions = options;
+    topOptions.maxLeafSize = 1;
+    build_bvh_nodes(count, instanceMin.data(), instanceMax.data(), centroids.data(), topOptions, nodes, instanceIndices);
+    depth = bvh_depth(nodes.data(), (uint32_t)nodes.size());
+}
+
+bool Scene::intersect(const Ray& ray_, RayCull cull, uint32_t mask, SceneHit& hit, BvhTraversalStats* stats) const
+{
+    if (nodes.empty())
+        return false;
+
+    Ray ray = ray_;
+    float3 invDir = { 1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z };
+    // Both children are pushed, so one more entry than levels can be waiting.
+    bool found = false;
+    uint32_t localStack[maxStackDepth];
+    std::vector<uint32_t> heapStack;
+    uint32_t* stack = localStack;
+    if (depth + 1 > (uint32_t)maxStackDepth) {
+        heapStack.resize(depth + 1);
+        stack = heapStack.data();
+    }
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const BvhNode& node = nodes[stack[--sp]];
+        if (intersect_aabb(ray, invDir, node) == INF)
+            continue;
+        if (stats)
+            stats->nodes++;
+
+        if (node.count == 0) {
+            // Push the far child first so the near one is visited next.
+            uint32_t c0 = node.leftFirst, c1 = c0 + 1;
+            if (intersect_aabb(ray, invDir, nodes[c0]) > intersect_aabb(ray, invDir, nodes[c1]))
+                std::swap(c0, c1);
+            stack[sp++] = c1;
+            stack[sp++] = c0;
+            continue;
+        }
+
+        for (uint32_t i = 0; i < node.count; i++) {
+            uint32_t index = instanceIndices[node.leftFirst + i];
+            const Instance& instance = instances[index];
+            if ((instance.mask & mask) == 0)
+                continue;
+
+            // The direction is not renormalised, so t means the same in both spaces.
+            const float3x4& toObject = worldToObject[index];
+            Ray objectRay = { transform_point(toObject, ray.origin), transform_vector(toObject, ray.dir), ray.tmin, ray.tmax };
+            Hit meshHit;
+            if (meshes[instance.mesh]->intersect(objectRay, cull, meshHit, stats)) {
+                ray.tmax = meshHit.t;
+                hit = { meshHit, index };
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+float3 Scene::surfaceNormal(const SceneHit& hit) const
+{
+    const Bvh& bvh = *meshes[instances[hit.instance].mesh];
+    float3 n = surface_normal(*bvh.mesh, hit.hit.prim, hit.hit.u, hit.hit.v);
+    return normalize(transform_normal_transposed(worldToObject[hit.instance], n));
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Bvh.hpp"
+#include <stdint.h>
+#include <vector>
+
+// One placement of a mesh, mirroring D3D12_RAYTRACING_INSTANCE_DESC.
+struct Instance
+{
+    float3x4 transform;      // object to world
+    uint32_t mesh;           // index into Scene::meshes
+    uint32_t mask = 0xff;    // tested against the ray's inclusion mask
+    uint32_t hitGroupOffset; // InstanceContributionToHitGroupIndex on the GPU
+};
+
+struct SceneHit
+{
+    Hit hit;           // t is along the world ray; u, v and prim are in the mesh
+    uint32_t instance;
+};
+
+// Two-level scene: a top-level BVH over instance bounds, and one Bvh per
+// unique mesh that every instance of it shares. Rays are taken into object
+// space at the instance leaves, so memory grows with unique meshes, not with
+// the number of instances. Facing and culling are decided in object space,
+// as in DXR.
+struct Scene
+{
+    // Rebuild the top level after instances were added or moved.
+    void build(const BvhBuildOptions& options = {});
+    bool intersect(const Ray& ray, RayCull cull, uint32_t mask, SceneHit& hit, BvhTraversalStats* stats = nullptr) const;
+    // Interpolated vertex normal at a hit, in world space.
+    float3 surfaceNormal(const SceneHit& hit) const;
+
+    std::vector<const Bvh*> meshes;
+    std::vector<Instance> instances;
+    std::vector<float3x4> worldToObject;
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> instanceIndices;
+    uint32_t depth = 0; // of the top level's deepest leaf
+};
@@ -1,32 +1,111 @@
-struct
+// Raster primary visibility for the hybrid mode. Writes the surface seen at
+// each pixel centre into a G-buffer, which RayGen in RayTracing.hlsl shades.
+
+// Must match SceneConstants in RayTracing.hlsl.
+struct SceneConstants
+{
+    float4x4 proj_inv;
+    float4x4 prev_proj_inv;
+    float4 camera_loc;
+    float4 prev_camera_loc;
+    uint frame_index;
+    uint refresh_interval;
+    uint reprojection;
+    uint history_valid;
+    uint hybrid;
+    uint render_target_index;
+    uint env_map_index;
+    uint gbuffer_index;
+};
+struct Vertex
+{
+    float3 position;
+    float3 norm;
+    float2 uv;
+};
+
+// Must match InstanceRecord in RefractionDemo.cpp. Rows of affine transforms.
+struct InstanceRecord
+{
+    float4 objectToWorld[3];
+    float4 worldToObject[3];
+};
+
+ConstantBuffer<SceneConstants> sceneConstants : register(b0);
+// The mesh being drawn.
+StructuredBuffer<uint> Indices : register(t1);
+StructuredBuffer<Vertex> Vertices : register(t2);
+// All instances, grouped by mesh; this draw's start at firstInstance.
+StructuredBuffer<InstanceRecord> Instances : register(t3);
+cbuffer DrawConstants : register(b1)
 {
-    row_major float4x4 proj;
-    row_major float4x4 view;
-} constants : b0;
+    uint firstInstance;
+};
+
+static const float nearDepth = 0.01;
+static const float farDepth = 1000.0;
 
 struct PSInput
 {
     float4 position : SV_POSITION;
-    float4 uv : TEXCOORD;
+    float3 world : POSITION;
+    float3 object : OBJECTPOSITION;
+    float3 norm : NORMAL;
+    nointerpolation uint instance : INSTANCE;
 };
 
 struct PSOutput
 {
-    float4 color : SV_Target;
+    // xyz: interpolated normal, w: distance along the camera ray, negated for
+    // back faces. 0 (the clear value) means nothing was hit.
+    float4 gbuffer : SV_Target;
 };
 
-PSInput VSMain(float3 position : POSITION, float4 uv : TEXCOORD)
+PSInput VSMain(float3 position : POSITION, float3 norm : NORMAL, uint instanceId : SV_InstanceID)
 {
+    InstanceRecord inst = Instances[firstInstance + instanceId];
+    float3 world = float3(dot(inst.objectToWorld[0], float4(position, 1.0)),
+        dot(inst.objectToWorld[1], float4(position, 1.0)), dot(inst.objectToWorld[2], float4(position, 1.0)));
+
+    // GenerateCameraRay maps screen position s to direction sx*a + sy*b + c.
+    // Inverting that for a point is a projective map, so the raster covers
+    // exactly the pixels whose rays see the point. See project() in Camera.cpp.
+    float3 a = sceneConstants.proj_inv[0].xyz;
+    float3 b = sceneConstants.proj_inv[1].xyz;
+    float3 c = sceneConstants.proj_inv[3].xyz;
+    float3 d = sceneConstants.camera_loc.xyz - world;
+    float3 bd = cross(b, d);
+    float scale = -dot(cross(a, b), normalize(c));
+    float w = dot(a, bd) / scale;
+
     PSInput result;
-    result.position = float4(position, 1.0);
-    result.position = mul(result.position, constants.view);
-    result.position = mul(result.position, constants.proj);
+    result.position.x = -dot(c, bd) / scale;
+    result.position.y = -dot(a, cross(c, d)) / scale;
+    result.position.z = (w - nearDepth) * farDepth / (farDepth - nearDepth);
+    result.position.w = w;
+    result.world = world;
+    result.object = position;
+    // Normals go through the inverse transpose.
+    result.norm = norm.x * inst.worldToObject[0].xyz + norm.y * inst.worldToObject[1].xyz + norm.z * inst.worldToObject[2].xyz;
+    result.instance = firstInstance + instanceId;
     return result;
 }
 
-PSOutput PSMain(PSInput input)
+PSOutput PSMain(PSInput input, uint prim : SV_PrimitiveID)
 {
+    // Facing by the DXR rule (clockwise seen from the ray origin is front, in
+    // object space), so the ray-traced bounces see the same sidedness as a
+    // traced primary ray.
+    InstanceRecord inst = Instances[input.instance];
+    float4 eye = float4(sceneConstants.camera_loc.xyz, 1.0);
+    float3 objectEye = float3(dot(inst.worldToObject[0], eye), dot(inst.worldToObject[1], eye), dot(inst.worldToObject[2], eye));
+    float3 A = Vertices[Indices[prim * 3 + 0]].position;
+    float3 B = Vertices[Indices[prim * 3 + 1]].position;
+    float3 C = Vertices[Indices[prim * 3 + 2]].position;
+    bool front = dot(cross(B - A, C - A), input.object - objectEye) < 0.0;
+
+    float t = length(input.world - sceneConstants.camera_loc.xyz);
     PSOutput result;
-    result.color = float4(1.0,0.0,1.0,1.0);
+    result.gbuffer = float4(normalize(input.norm), front ? t : -t);
     return result;
 }
\ No newline at end of file
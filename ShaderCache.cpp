@@ -0,0 +1,148 @@
+#include "ShaderCache.hpp"
+#include "Hash.hpp"
+#include "MappedFile.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <stdio.h>
+#include <string.h>
+
+constexpr char shaderCacheMagic[4] = { 'R', 'D', 'X', 'L' };
+constexpr uint32_t shaderCacheVersion = 1;
+
+// Unlike MappedFile, this accepts empty files, which includes may be.
+static bool read_file(const std::string& filename, std::string& contents)
+{
+    std::ifstream is(filename, std::ios_base::binary);
+    if (!is)
+        return false;
+    contents.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    return !is.bad();
+}
+
+static uint64_t hash_string(const std::string& s, uint64_t seed)
+{
+    return hash_bytes(s.data(), s.size(), seed);
+}
+
+uint64_t ShaderCache::key(const ShaderCompileRequest& request, const std::string& source)
+{
+    uint64_t h = hash_string(source, shaderCacheVersion);
+    h = hash_string(request.profile, h);
+    h = hash_string(request.entryPoint, h);
+    for (const ShaderDefine& define : request.defines) {
+        h = hash_string(define.name, h);
+        h = hash_string(define.value, h);
+    }
+    return hash_string(compiler->version(), h);
+}
+
+std::string ShaderCache::entryFilename(uint64_t key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.dxil", (unsigned long long)key);
+    return directory.empty() ? name : directory + "/" + name;
+}
+
+// Check the file against key and its own content hash, and that every
+// include still hashes as it did; then copy out the bytecode.
+static bool read_entry(const MappedFile& file, uint64_t key, std::vector<uint8_t>& bytecode)
+{
+    if (file.size < sizeof(ShaderCacheFileHeader))
+        return false;
+    const ShaderCacheFileHeader& header = *(const ShaderCacheFileHeader*)file.data;
+    if (memcmp(header.magic, shaderCacheMagic, sizeof(shaderCacheMagic)) != 0 || header.version != shaderCacheVersion
+        || header.key != key)
+        return false;
+    const char* p = (const char*)(&header + 1);
+    const char* end = (const char*)file.data + file.size;
+    if (hash_bytes(p, end - p) != header.contentHash)
+        return false;
+
+    for (uint32_t i = 0; i < header.includeCount; i++) {
+        uint64_t hash;
+        uint32_t length;
+        if ((size_t)(end - p) < sizeof(hash) + sizeof(length))
+            return false;
+        memcpy(&hash, p, sizeof(hash));
+        memcpy(&length, p + sizeof(hash), sizeof(length));
+        p += sizeof(hash) + sizeof(length);
+        if ((size_t)(end - p) < length)
+            return false;
+        std::string contents;
+        if (!read_file(std::string(p, length), contents) || hash_string(contents, 0) != hash)
+            return false;
+        p += length;
+    }
+    if ((size_t)(end - p) != header.bytecodeSize)
+        return false;
+    bytecode.assign((const uint8_t*)p, (const uint8_t*)end);
+    return true;
+}
+
+static bool write_entry(const std::string& filename, uint64_t key, const std::vector<uint8_t>& bytecode, const std::vector<std::string>& includes)
+{
+    std::string body;
+    for (const std::string& include : includes) {
+        std::string contents;
+        if (!read_file(include, contents))
+            return false;
+        uint64_t hash = hash_string(contents, 0);
+        uint32_t length = (uint32_t)include.size();
+        body.append((const char*)&hash, sizeof(hash));
+        body.append((const char*)&length, sizeof(length));
+        body += include;
+    }
+    body.append((const char*)bytecode.data(), bytecode.size());
+
+    ShaderCacheFileHeader header = {};
+    memcpy(header.magic, shaderCacheMagic, sizeof(shaderCacheMagic));
+    header.version = shaderCacheVersion;
+    header.key = key;
+    header.contentHash = hash_bytes(body.data(), body.size());
+    header.bytecodeSize = bytecode.size();
+    header.includeCount = (uint32_t)includes.size();
+
+    // Write to a temporary name first so a crash never leaves a truncated file behind.
+    std::string tempFilename = filename + ".tmp";
+    std::ofstream os(tempFilename, std::ios_base::binary);
+    os.write((const char*)&header, sizeof(header));
+    os.write(body.data(), body.size());
+    os.close();
+    if (!os) {
+        remove(tempFilename.c_str());
+        return false;
+    }
+    remove(filename.c_str());
+    return rename(tempFilename.c_str(), filename.c_str()) == 0;
+}
+
+bool ShaderCache::load(const ShaderCompileRequest& request, std::vector<uint8_t>& bytecode, std::string& errors)
+{
+    std::string source;
+    if (!read_file(request.filename, source)) {
+        errors = "cannot read " + request.filename;
+        return false;
+    }
+    uint64_t entryKey = key(request, source);
+    std::string filename = entryFilename(entryKey);
+
+    MappedFile file;
+    if (file.open(filename.c_str())) {
+        if (read_entry(file, entryKey, bytecode)) {
+            hits++;
+            return true;
+        }
+        rejected++;
+    }
+    file.close();
+
+    std::vector<std::string> includes;
+    bytecode.clear();
+    if (!compiler->compile(request, source, bytecode, includes, errors))
+        return false;
+    compiles++;
+    // A cache that cannot be written only costs the next start a compile.
+    write_entry(filename, entryKey, bytecode, includes);
+    return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct ShaderDefine
+{
+    std::string name;
+    std::string value;
+};
+
+struct ShaderCompileRequest
+{
+    std::string filename;   // main source file
+    std::string entryPoint; // empty for libraries
+    std::string profile;    // lib_6_3, vs_6_0, ...
+    std::vector<ShaderDefine> defines;
+};
+
+// Turns HLSL into DXIL. The D3D12 backend wraps DXC; anything else that
+// produces bytes will do for the cache.
+struct ShaderCompiler
+{
+    virtual ~ShaderCompiler() = default;
+
+    // Changes whenever the compiler could produce different output.
+    virtual std::string version() = 0;
+
+    // source is the contents of request.filename. On success, includes lists
+    // every file the compiler read besides it, as paths it can be opened by.
+    virtual bool compile(const ShaderCompileRequest& request, const std::string& source,
+        std::vector<uint8_t>& bytecode, std::vector<std::string>& includes, std::string& errors) = 0;
+};
+
+// Header of a shader cache file. The includes follow, each a uint64_t hash
+// of its contents and a uint32_t name length before the name, then the
+// bytecode.
+struct ShaderCacheFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t contentHash; // everything after the header
+    uint64_t bytecodeSize;
+    uint32_t includeCount;
+    uint32_t pad;
+};
+
+// Compiled shaders stored in directory as "<key>.dxil", where the key is a
+// hash of the source text, profile, entry point, defines and compiler
+// version. Since includes are only known after compiling, each file records
+// them with the hash of their contents, and an entry whose includes changed
+// is compiled again. Damaged files fail the content hash and are replaced.
+struct ShaderCache
+{
+    bool load(const ShaderCompileRequest& request, std::vector<uint8_t>& bytecode, std::string& errors);
+
+    uint64_t key(const ShaderCompileRequest& request, const std::string& source);
+    std::string entryFilename(uint64_t key) const;
+
+    std::string directory;
+    ShaderCompiler* compiler = nullptr;
+    unsigned hits = 0;
+    unsigned compiles = 0;
+    unsigned rejected = 0; // entries found but stale or damaged
+};
@@ -0,0 +1,88 @@
+#include "ShaderTable.hpp"
+
+#include <algorithm>
+#include <string.h>
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static uint32_t add_record(std::vector<ShaderTable::Record>& records, const void* identifier, const void* arguments, size_t argumentSize)
+{
+    records.emplace_back();
+    ShaderTable::Record& record = records.back();
+    memcpy(record.identifier, identifier, shaderIdentifierSize);
+    record.arguments.assign((const uint8_t*)arguments, (const uint8_t*)arguments + (arguments ? argumentSize : 0));
+    return (uint32_t)records.size() - 1;
+}
+
+static bool table_range(const std::vector<ShaderTable::Record>& records, uint64_t recordAlignment, uint64_t& offset, ShaderTableRange& range)
+{
+    size_t largest = 0;
+    for (const ShaderTable::Record& record : records)
+        largest = std::max(largest, record.arguments.size());
+    range.offset = align_up(offset, shaderTableAlignment);
+    range.stride = records.empty() ? 0 : align_up(shaderIdentifierSize + largest, recordAlignment);
+    range.size = range.stride * records.size();
+    offset = range.offset + range.size;
+    return range.stride <= maxShaderRecordStride;
+}
+
+static void write_table(const std::vector<ShaderTable::Record>& records, const ShaderTableRange& range, uint8_t* data)
+{
+    for (size_t i = 0; i < records.size(); i++) {
+        uint8_t* record = data + range.offset + i * range.stride;
+        memcpy(record, records[i].identifier, shaderIdentifierSize);
+        if (!records[i].arguments.empty())
+            memcpy(record + shaderIdentifierSize, records[i].arguments.data(), records[i].arguments.size());
+    }
+}
+
+void ShaderTable::clear()
+{
+    rayGen.clear();
+    miss.clear();
+    hitGroups.clear();
+}
+
+uint32_t ShaderTable::addRayGen(const void* identifier, const void* arguments, size_t argumentSize)
+{
+    return add_record(rayGen, identifier, arguments, argumentSize);
+}
+
+uint32_t ShaderTable::addMiss(const void* identifier, const void* arguments, size_t argumentSize)
+{
+    return add_record(miss, identifier, arguments, argumentSize);
+}
+
+uint32_t ShaderTable::addHitGroup(const void* identifier, const void* arguments, size_t argumentSize)
+{
+    return add_record(hitGroups, identifier, arguments, argumentSize);
+}
+
+bool ShaderTable::layout(ShaderTableLayout& result) const
+{
+    uint64_t offset = 0;
+    // Each raygen record is dispatched on its own, so each starts a table.
+    bool ok = table_range(rayGen, shaderTableAlignment, offset, result.rayGen);
+    ok &= table_range(miss, shaderRecordAlignment, offset, result.miss);
+    ok &= table_range(hitGroups, shaderRecordAlignment, offset, result.hitGroup);
+    result.size = offset;
+    // The first raygen record is the one dispatched by default.
+    result.rayGen.size = result.rayGen.stride;
+    return ok;
+}
+
+void ShaderTable::write(const ShaderTableLayout& layout, uint8_t* data) const
+{
+    memset(data, 0, layout.size);
+    write_table(rayGen, layout.rayGen, data);
+    write_table(miss, layout.miss, data);
+    write_table(hitGroups, layout.hitGroup, data);
+}
+
+ShaderTableRange ShaderTable::rayGenRecord(const ShaderTableLayout& layout, uint32_t index) const
+{
+    return { layout.rayGen.offset + index * layout.rayGen.stride, layout.rayGen.stride, layout.rayGen.stride };
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Sizes and alignments of D3D12_RAYTRACING_SHADER_* and friends.
+constexpr uint32_t shaderIdentifierSize = 32;
+constexpr uint32_t shaderRecordAlignment = 32;
+constexpr uint32_t shaderTableAlignment = 64;
+constexpr uint32_t maxShaderRecordStride = 4096;
+
+// Where one table sits in the shader binding table buffer, as
+// D3D12_GPU_VIRTUAL_ADDRESS_RANGE_AND_STRIDE wants it relative to the start.
+struct ShaderTableRange
+{
+    uint64_t offset;
+    uint64_t size;
+    uint64_t stride;
+};
+
+struct ShaderTableLayout
+{
+    ShaderTableRange rayGen;   // DispatchRays takes a single raygen record
+    ShaderTableRange miss;
+    ShaderTableRange hitGroup;
+    uint64_t size;
+};
+
+// Shader binding table for one pipeline: raygen, miss and hit group records,
+// each a shader identifier followed by its local root arguments, packed into
+// one buffer. Every record in a table gets the stride of its largest one,
+// rounded up to the record alignment, and every table starts on the table
+// alignment. The identifiers are only copied, so any 32 bytes will do.
+struct ShaderTable
+{
+    struct Record
+    {
+        uint8_t identifier[shaderIdentifierSize];
+        std::vector<uint8_t> arguments;
+    };
+
+    void clear();
+    // Return the record's index in its table: MissShaderIndex for miss
+    // records, the hit group index that TraceRay and the instances select
+    // for hit groups.
+    uint32_t addRayGen(const void* identifier, const void* arguments = nullptr, size_t argumentSize = 0);
+    uint32_t addMiss(const void* identifier, const void* arguments = nullptr, size_t argumentSize = 0);
+    uint32_t addHitGroup(const void* identifier, const void* arguments = nullptr, size_t argumentSize = 0);
+
+    // False if a record is larger than the maximum stride.
+    bool layout(ShaderTableLayout& result) const;
+    // Fill a buffer of layout.size bytes; padding is zeroed.
+    void write(const ShaderTableLayout& layout, uint8_t* data) const;
+    // Raygen table for record index, for pipelines with several.
+    ShaderTableRange rayGenRecord(const ShaderTableLayout& layout, uint32_t index) const;
+
+    std::vector<Record> rayGen;
+    std::vector<Record> miss;
+    std::vector<Record> hitGroups;
+};
@@ -0,0 +1,211 @@
+#include "Socket.hpp"
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+typedef SOCKET native_socket;
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int native_socket;
+#endif
+
+static native_socket native(intptr_t fd)
+{
+    return (native_socket)fd;
+}
+
+#ifdef _WIN32
+
+static bool startup()
+{
+    static bool started = [] {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    return started;
+}
+
+static void close_fd(intptr_t fd)
+{
+    closesocket(native(fd));
+}
+
+#else
+
+static bool startup()
+{
+    // A peer that disappears must fail send(), not kill the process.
+    static bool started = [] {
+        signal(SIGPIPE, SIG_IGN);
+        return true;
+    }();
+    return started;
+}
+
+static void close_fd(intptr_t fd)
+{
+    ::close(native(fd));
+}
+
+#endif
+
+// Resolve the address and create a socket for it. Unix domain sockets are
+// only available on POSIX systems here.
+static intptr_t open_socket(const char* address, sockaddr_storage& storage, socklen_t& length)
+{
+    if (!startup())
+        return -1;
+    memset(&storage, 0, sizeof(storage));
+#ifndef _WIN32
+    if (!strncmp(address, "unix:", 5)) {
+        sockaddr_un& un = (sockaddr_un&)storage;
+        if (strlen(address + 5) >= sizeof(un.sun_path))
+            return -1;
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, address + 5);
+        length = sizeof(sockaddr_un);
+        return socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+#endif
+    std::string host = address;
+    size_t colon = host.rfind(':');
+    if (colon == std::string::npos)
+        return -1;
+    std::string port = host.substr(colon + 1);
+    host.resize(colon);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* info = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &info) != 0 || !info)
+        return -1;
+    memcpy(&storage, info->ai_addr, info->ai_addrlen);
+    length = (socklen_t)info->ai_addrlen;
+    freeaddrinfo(info);
+    intptr_t fd = (intptr_t)socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd != -1) {
+        int one = 1;
+        setsockopt(native(fd), IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+    }
+    return fd;
+}
+
+bool Socket::listen(const char* address)
+{
+    close();
+    sockaddr_storage storage;
+    socklen_t length;
+    intptr_t s = open_socket(address, storage, length);
+    if (s == -1)
+        return false;
+    int one = 1;
+    setsockopt(native(s), SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+#ifndef _WIN32
+    if (storage.ss_family == AF_UNIX)
+        unlink(((sockaddr_un&)storage).sun_path);
+#endif
+    if (::bind(native(s), (sockaddr*)&storage, length) != 0 || ::listen(native(s), 64) != 0) {
+        close_fd(s);
+        return false;
+    }
+    fd = s;
+    return true;
+}
+
+bool Socket::accept(Socket& client) const
+{
+    intptr_t s = (intptr_t)::accept(native(fd), nullptr, nullptr);
+    if (s == -1)
+        return false;
+    client.close();
+    client.fd = s;
+    return true;
+}
+
+bool Socket::connect(const char* address)
+{
+    close();
+    sockaddr_storage storage;
+    socklen_t length;
+    intptr_t s = open_socket(address, storage, length);
+    if (s == -1)
+        return false;
+    if (::connect(native(s), (sockaddr*)&storage, length) != 0) {
+        close_fd(s);
+        return false;
+    }
+    fd = s;
+    return true;
+}
+
+bool Socket::send(const void* data, size_t size)
+{
+    const char* p = (const char*)data;
+    while (size) {
+        int chunk = (int)(size < (1u << 30) ? size : (1u << 30));
+        auto sent = ::send(native(fd), p, chunk, 0);
+        if (sent <= 0)
+            return false;
+        p += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+bool Socket::receive(void* data, size_t size)
+{
+    char* p = (char*)data;
+    while (size) {
+        int chunk = (int)(size < (1u << 30) ? size : (1u << 30));
+        auto received = ::recv(native(fd), p, chunk, 0);
+        if (received <= 0)
+            return false;
+        p += received;
+        size -= (size_t)received;
+    }
+    return true;
+}
+
+void Socket::close()
+{
+    if (fd != -1)
+        close_fd(fd);
+    fd = -1;
+}
+
+bool Socket::poll(const std::vector<const Socket*>& sockets, int timeoutMs, std::vector<bool>& ready)
+{
+#ifdef _WIN32
+    std::vector<WSAPOLLFD> fds(sockets.size());
+#else
+    std::vector<pollfd> fds(sockets.size());
+#endif
+    for (size_t i = 0; i < sockets.size(); i++) {
+        fds[i].fd = native(sockets[i]->fd);
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+#ifdef _WIN32
+    int result = WSAPoll(fds.data(), (ULONG)fds.size(), timeoutMs);
+#else
+    int result = ::poll(fds.data(), (nfds_t)fds.size(), timeoutMs);
+#endif
+    if (result < 0)
+        return false;
+    ready.assign(sockets.size(), false);
+    for (size_t i = 0; i < sockets.size(); i++)
+        ready[i] = (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+    return true;
+}
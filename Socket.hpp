@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Blocking stream socket. Addresses are "unix:<path>" for a Unix domain
+// socket or "<host>:<port>" for TCP.
+struct Socket
+{
+    Socket() = default;
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+    Socket(Socket&& other) noexcept : fd(other.fd) { other.fd = -1; }
+    Socket& operator=(Socket&& other) noexcept
+    {
+        if (this != &other) {
+            close();
+            fd = other.fd;
+            other.fd = -1;
+        }
+        return *this;
+    }
+    ~Socket() { close(); }
+
+    bool listen(const char* address);
+    bool accept(Socket& client) const;
+    bool connect(const char* address);
+    // Both transfer the whole buffer or fail.
+    bool send(const void* data, size_t size);
+    bool receive(void* data, size_t size);
+    void close();
+    bool isOpen() const { return fd != -1; }
+
+    // Wait up to timeoutMs for any of the sockets to become readable, or to
+    // be closed by the peer. Sets ready[i] for each such socket.
+    static bool poll(const std::vector<const Socket*>& sockets, int timeoutMs, std::vector<bool>& ready);
+
+    intptr_t fd = -1;
+};
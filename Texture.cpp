@@ -0,0 +1,193 @@
+#include "Texture.hpp"
+#include "Hash.hpp"
+#include "Parallel.hpp"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <array>
+#include <fstream>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+constexpr size_t rowsPerStrip = 16;
+
+// sRGB transfer function for every 8-bit value, built once.
+static const std::array<float, 256>& srgb_to_linear_table()
+{
+    static const std::array<float, 256> table = [] {
+        std::array<float, 256> t;
+        for (int i = 0; i < 256; i++) {
+            float c = i / 255.0f;
+            t[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return t;
+    }();
+    return table;
+}
+
+bool SourceImage::open(const char* filename)
+{
+    close();
+    int n;
+    if (stbi_is_hdr(filename))
+        hdr = stbi_loadf(filename, &width, &height, &n, 3);
+    else
+        ldr = stbi_load(filename, &width, &height, &n, 3);
+    return ldr || hdr;
+}
+
+void SourceImage::close()
+{
+    stbi_image_free(ldr);
+    stbi_image_free(hdr);
+    ldr = nullptr;
+    hdr = nullptr;
+}
+
+void convert_image(const SourceImage& image, void* dest, size_t rowPitch)
+{
+    const auto& table = srgb_to_linear_table();
+    size_t width = image.width;
+    size_t height = image.height;
+    size_t strips = (height + rowsPerStrip - 1) / rowsPerStrip;
+
+    parallel_for(0, strips, 1, [&](size_t strip) {
+        size_t last = std::min(height, (strip + 1) * rowsPerStrip);
+        for (size_t y = strip * rowsPerStrip; y < last; y++) {
+            float* out = (float*)((char*)dest + y * rowPitch);
+            if (image.hdr) {
+                memcpy(out, &image.hdr[y * width * 3], width * 3 * sizeof(float));
+                continue;
+            }
+            const unsigned char* in = &image.ldr[y * width * 3];
+            for (size_t x = 0; x < width * 3; x++)
+                out[x] = table[in[x]];
+        }
+    });
+}
+
+constexpr char textureMagic[4] = { 'R', 'T', 'E', 'X' };
+constexpr uint32_t textureVersion = 1;
+
+// Average 2x2 blocks of the level above; odd edges reuse the last texel.
+static void downsample(const float* src, unsigned srcWidth, unsigned srcHeight, float* dst, unsigned width, unsigned height)
+{
+    parallel_for(0, height, rowsPerStrip, [&](size_t y) {
+        unsigned y0 = std::min<unsigned>(2 * y, srcHeight - 1), y1 = std::min<unsigned>(2 * y + 1, srcHeight - 1);
+        for (unsigned x = 0; x < width; x++) {
+            unsigned x0 = std::min(2 * x, srcWidth - 1), x1 = std::min(2 * x + 1, srcWidth - 1);
+            for (int c = 0; c < 3; c++) {
+                dst[3 * (y * width + x) + c] = 0.25f * (src[3 * (y0 * srcWidth + x0) + c] + src[3 * (y0 * srcWidth + x1) + c]
+                    + src[3 * (y1 * srcWidth + x0) + c] + src[3 * (y1 * srcWidth + x1) + c]);
+            }
+        }
+    });
+}
+
+// A full chain halves down to 1x1: floor(log2(max(width, height))) + 1 levels.
+static uint32_t mip_level_count(uint32_t width, uint32_t height, bool mipmaps)
+{
+    uint32_t levels = 1;
+    if (mipmaps) {
+        for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+            levels++;
+    }
+    return levels;
+}
+
+bool bake_texture(const char* sourceFilename, const char* bakedFilename, uint64_t sourceHash, bool mipmaps)
+{
+    SourceImage image;
+    if (!image.open(sourceFilename))
+        return false;
+
+    TextureFileHeader header = {};
+    memcpy(header.magic, textureMagic, sizeof(textureMagic));
+    header.version = textureVersion;
+    header.format = TEXTURE_FORMAT_RGB32F;
+    header.width = image.width;
+    header.height = image.height;
+    header.mipLevels = mip_level_count(header.width, header.height, mipmaps);
+    header.sourceHash = sourceHash;
+
+    std::vector<TextureMip> mips(header.mipLevels);
+    uint64_t offset = sizeof(header) + mips.size() * sizeof(TextureMip);
+    for (unsigned level = 0; level < header.mipLevels; level++) {
+        mips[level].offset = offset;
+        mips[level].width = std::max(header.width >> level, 1u);
+        mips[level].height = std::max(header.height >> level, 1u);
+        offset += (uint64_t)mips[level].width * mips[level].height * 3 * sizeof(float);
+    }
+
+    std::vector<char> contents(offset);
+    memcpy(contents.data(), &header, sizeof(header));
+    memcpy(contents.data() + sizeof(header), mips.data(), mips.size() * sizeof(TextureMip));
+    convert_image(image, contents.data() + mips[0].offset, mips[0].width * 3 * sizeof(float));
+    for (unsigned level = 1; level < header.mipLevels; level++) {
+        downsample((const float*)(contents.data() + mips[level - 1].offset), mips[level - 1].width, mips[level - 1].height,
+            (float*)(contents.data() + mips[level].offset), mips[level].width, mips[level].height);
+    }
+
+    // Write to a temporary name first so a crash never leaves a truncated file behind.
+    std::string tempFilename = std::string(bakedFilename) + ".tmp";
+    std::ofstream os(tempFilename, std::ios_base::binary);
+    os.write(contents.data(), contents.size());
+    os.close();
+    if (!os) {
+        remove(tempFilename.c_str());
+        return false;
+    }
+    remove(bakedFilename);
+    return rename(tempFilename.c_str(), bakedFilename) == 0;
+}
+
+static bool valid_texture_file(const MappedFile& file, bool mipmaps)
+{
+    if (file.size < sizeof(TextureFileHeader))
+        return false;
+    const TextureFileHeader& header = *(const TextureFileHeader*)file.data;
+    if (memcmp(header.magic, textureMagic, sizeof(textureMagic)) != 0 || header.version != textureVersion
+        || header.format != TEXTURE_FORMAT_RGB32F || header.width == 0 || header.height == 0)
+        return false;
+    // Exactly the levels bake_texture writes, so a truncated chain is rebaked.
+    if (header.mipLevels != mip_level_count(header.width, header.height, mipmaps)
+        || file.size < sizeof(header) + header.mipLevels * sizeof(TextureMip))
+        return false;
+
+    // Readers size their copies from the mip table, so every level must be the
+    // header's size halved level times and lie inside the file.
+    const TextureMip* mips = (const TextureMip*)(&header + 1);
+    for (unsigned level = 0; level < header.mipLevels; level++) {
+        if (mips[level].width != std::max(header.width >> level, 1u) || mips[level].height != std::max(header.height >> level, 1u)
+            || mips[level].offset % sizeof(float) != 0)
+            return false;
+        uint64_t bytes = (uint64_t)mips[level].width * mips[level].height * 3 * sizeof(float);
+        if (mips[level].offset > file.size || bytes > file.size - mips[level].offset)
+            return false;
+    }
+    return true;
+}
+
+bool BakedTexture::open(const char* sourceFilename, bool mipmaps)
+{
+    std::string bakedFilename = std::string(sourceFilename) + ".tex";
+
+    // Without the source there is nothing to compare against, so trust a
+    // well-formed baked file. That lets builds ship only the .tex.
+    MappedFile source;
+    bool haveSource = source.open(sourceFilename);
+    uint64_t sourceHash = haveSource ? hash_bytes(source.data, source.size) : 0;
+    source.close();
+
+    if (file.open(bakedFilename.c_str()) && valid_texture_file(file, mipmaps)
+        && (!haveSource || header().sourceHash == sourceHash))
+        return true;
+    file.close();
+
+    if (!haveSource || !bake_texture(sourceFilename, bakedFilename.c_str(), sourceHash, mipmaps))
+        return false;
+    return file.open(bakedFilename.c_str()) && valid_texture_file(file, mipmaps);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "MappedFile.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+// An image decoded from disk but not yet converted to the texture format.
+// LDR files stay 8-bit sRGB so the float conversion can be done by
+// convert_image straight into the destination memory.
+struct SourceImage
+{
+    SourceImage() = default;
+    SourceImage(const SourceImage&) = delete;
+    SourceImage& operator=(const SourceImage&) = delete;
+    ~SourceImage() { close(); }
+
+    bool open(const char* filename);
+    void close();
+
+    int width = 0;
+    int height = 0;
+    unsigned char* ldr = nullptr; // RGB8, sRGB encoded
+    float* hdr = nullptr;         // RGB32F, linear
+};
+
+// Write the image as linear RGB32F rows starting at dest, rowPitch bytes apart.
+// Rows are converted in parallel strips.
+void convert_image(const SourceImage& image, void* dest, size_t rowPitch);
+
+enum TextureFormat : uint32_t
+{
+    TEXTURE_FORMAT_RGB32F = 1,
+};
+
+// Header of a baked texture file. A TextureMip table for mipLevels follows,
+// then the tightly packed rows of every level.
+struct TextureFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint64_t sourceHash;
+};
+
+struct TextureMip
+{
+    uint64_t offset;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Converted pixel data saved next to the source image as "<source>.tex", so
+// startup maps it instead of decoding. open() rebakes the file when it is
+// missing, damaged or was made from a different version of the source.
+struct BakedTexture
+{
+    bool open(const char* sourceFilename, bool mipmaps = false);
+    void close() { file.close(); }
+
+    const TextureFileHeader& header() const { return *(const TextureFileHeader*)file.data; }
+    const TextureMip& mip(unsigned level) const { return ((const TextureMip*)(&header() + 1))[level]; }
+    const float* texels(unsigned level) const { return (const float*)((const char*)file.data + mip(level).offset); }
+
+    MappedFile file;
+};
+
+bool bake_texture(const char* sourceFilename, const char* bakedFilename, uint64_t sourceHash, bool mipmaps);
@@ -0,0 +1,51 @@
+#include "TraversalCost.hpp"
+
+#include <algorithm>
+
+uint32_t TraversalCostMap::value(size_t pixel, TraversalCounter counter) const
+{
+    const TraversalCost& cost = pixels[pixel];
+    return counter == COUNT_NODES ? cost.nodes : (counter == COUNT_TRIANGLES ? cost.triangles : cost.rays);
+}
+
+// Blue, cyan, green, yellow, red at s = 0, 0.25, 0.5, 0.75, 1.
+static float3 ramp(float s)
+{
+    static const float3 stops[5] = { { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 0.0f },
+        { 1.0f, 1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f } };
+    s = clamp(s, 0.0f, 1.0f) * 4.0f;
+    int i = std::min((int)s, 3);
+    float f = s - i;
+    return (1.0f - f) * stops[i] + f * stops[i + 1];
+}
+
+void cost_heatmap(const TraversalCostMap& costs, TraversalCounter counter, uint32_t maxValue, Image& image)
+{
+    image.resize(costs.width, costs.height);
+    if (maxValue == 0) {
+        for (size_t i = 0; i < costs.pixels.size(); i++)
+            maxValue = std::max(maxValue, costs.value(i, counter));
+        maxValue = std::max(maxValue, 1u);
+    }
+    for (size_t i = 0; i < costs.pixels.size(); i++) {
+        uint32_t v = costs.value(i, counter);
+        image.pixels[i] = v ? ramp((float)v / maxValue) : float3{ 0.0f, 0.0f, 0.0f };
+    }
+}
+
+std::vector<uint32_t> cost_histogram(const TraversalCostMap& costs, TraversalCounter counter)
+{
+    std::vector<uint32_t> histogram(1, 0);
+    for (size_t i = 0; i < costs.pixels.size(); i++) {
+        uint32_t v = costs.value(i, counter);
+        size_t bucket = 0;
+        while (v) {
+            bucket++;
+            v >>= 1;
+        }
+        if (histogram.size() <= bucket)
+            histogram.resize(bucket + 1, 0);
+        histogram[bucket]++;
+    }
+    return histogram;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Image.hpp"
+#include <stdint.h>
+#include <vector>
+
+// Work done for one pixel of a CPU render, over its whole ClosestHit ray tree.
+struct TraversalCost
+{
+    uint32_t nodes;     // BVH nodes entered, top and bottom level
+    uint32_t triangles; // triangle tests
+    uint32_t rays;      // rays cast, counting a traced primary ray
+};
+
+enum TraversalCounter
+{
+    COUNT_NODES,
+    COUNT_TRIANGLES,
+    COUNT_RAYS,
+};
+
+struct TraversalCostMap
+{
+    void resize(int width_, int height_) { width = width_; height = height_; pixels.assign(width * height, { 0, 0, 0 }); }
+    uint32_t value(size_t pixel, TraversalCounter counter) const;
+
+    int width = 0;
+    int height = 0;
+    std::vector<TraversalCost> pixels;
+};
+
+// False-colour view of one counter: black for 0, then blue through red up to
+// maxValue and beyond. maxValue 0 scales to the largest value in the map.
+void cost_heatmap(const TraversalCostMap& costs, TraversalCounter counter, uint32_t maxValue, Image& image);
+
+// Pixel counts by powers of two: bucket 0 holds pixels with a count of 0,
+// bucket i those with a count in [2^(i-1), 2^i).
+std::vector<uint32_t> cost_histogram(const TraversalCostMap& costs, TraversalCounter counter);
@@ -0,0 +1,175 @@
+#include "Bvh.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+
+constexpr float INF = 1e30f;
+constexpr int maxTreeletSize = 10; // the search is O(3^n) per treelet
+
+static inline uint32_t lowest_bit(uint32_t x)
+{
+    return x & (0u - x);
+}
+
+void Bvh::optimize(int treeletSize, int iterations, float traversalCost)
+{
+    if (nodeCount < 5 || iterations <= 0)
+        return;
+    detach();
+    int n = std::max(3, std::min(treeletSize, maxTreeletSize));
+
+    // SAH cost and triangle count of the subtree under each node. Both move
+    // with a node when the restructuring gives it a new slot.
+    std::vector<float> cost(nodeCount);
+    std::vector<uint32_t> triangles(nodeCount);
+    std::vector<uint32_t> order;
+    std::vector<size_t> levelStart;
+    bvh_levels(nodes, nodeCount, order, levelStart);
+    for (size_t level = levelStart.size() - 1; level-- > 0;) {
+        parallel_for(levelStart[level], levelStart[level + 1], 1024, [&](size_t i) {
+            uint32_t index = order[i];
+            const BvhNode& node = nodeStorage[index];
+            float area = surface_area(node.bmin, node.bmax);
+            if (node.count) {
+                cost[index] = area * node.count;
+                triangles[index] = node.count;
+            } else {
+                cost[index] = traversalCost * area + cost[node.leftFirst] + cost[node.leftFirst + 1];
+                triangles[index] = triangles[node.leftFirst] + triangles[node.leftFirst + 1];
+            }
+        });
+    }
+
+    auto restructure = [&](uint32_t root) {
+        // Grow the treelet by opening its largest interior leaf. Each interior
+        // treelet node owns the child pair its leftFirst points at; those
+        // pairs are handed out again to the new topology.
+        uint32_t leaves[maxTreeletSize];
+        uint32_t pairs[maxTreeletSize];
+        int leafCount = 2, pairCount = 1;
+        pairs[0] = nodeStorage[root].leftFirst;
+        leaves[0] = pairs[0];
+        leaves[1] = pairs[0] + 1;
+        while (leafCount < n) {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (int i = 0; i < leafCount; i++) {
+                const BvhNode& node = nodeStorage[leaves[i]];
+                float area = surface_area(node.bmin, node.bmax);
+                if (node.count == 0 && area > bestArea) {
+                    best = i;
+                    bestArea = area;
+                }
+            }
+            if (best < 0)
+                break;
+            uint32_t pair = nodeStorage[leaves[best]].leftFirst;
+            pairs[pairCount++] = pair;
+            leaves[best] = pair;
+            leaves[leafCount++] = pair + 1;
+        }
+        if (leafCount < 3)
+            return;
+
+        // Cheapest topology for every subset of the treelet's leaves, from
+        // smaller subsets up. Only partitions holding the lowest leaf of the
+        // subset are tried, as the mirrored ones cost the same.
+        uint32_t subsetCount = 1u << leafCount;
+        float3 bmin[1 << maxTreeletSize], bmax[1 << maxTreeletSize];
+        float best[1 << maxTreeletSize];
+        uint32_t split[1 << maxTreeletSize];
+        for (uint32_t s = 1; s < subsetCount; s++) {
+            uint32_t low = lowest_bit(s);
+            if (s == low) {
+                int leaf = 0;
+                while (!(low >> leaf & 1))
+                    leaf++;
+                bmin[s] = nodeStorage[leaves[leaf]].bmin;
+                bmax[s] = nodeStorage[leaves[leaf]].bmax;
+                best[s] = cost[leaves[leaf]];
+                continue;
+            }
+            bmin[s] = min(bmin[s ^ low], bmin[low]);
+            bmax[s] = max(bmax[s ^ low], bmax[low]);
+            float bestSplit = INF;
+            uint32_t bestPart = 0;
+            uint32_t rest = s ^ low;
+            for (uint32_t part = (rest - 1) & rest;; part = (part - 1) & rest) {
+                uint32_t left = part | low;
+                float c = best[left] + best[s ^ left];
+                if (c < bestSplit) {
+                    bestSplit = c;
+                    bestPart = left;
+                }
+                if (part == 0)
+                    break;
+            }
+            best[s] = traversalCost * surface_area(bmin[s], bmax[s]) + bestSplit;
+            split[s] = bestPart;
+        }
+        uint32_t all = subsetCount - 1;
+        if (best[all] >= cost[root] * 0.9999f)
+            return;
+
+        BvhNode leafNodes[maxTreeletSize];
+        float leafCost[maxTreeletSize];
+        uint32_t leafTriangles[maxTreeletSize];
+        for (int i = 0; i < leafCount; i++) {
+            leafNodes[i] = nodeStorage[leaves[i]];
+            leafCost[i] = cost[leaves[i]];
+            leafTriangles[i] = triangles[leaves[i]];
+        }
+
+        // Lay the new topology out over the same slots.
+        struct Placement
+        {
+            uint32_t subset;
+            uint32_t slot;
+        };
+        Placement stack[2 * maxTreeletSize];
+        int sp = 0, nextPair = 0;
+        stack[sp++] = { all, root };
+        while (sp) {
+            Placement p = stack[--sp];
+            if (p.subset == lowest_bit(p.subset)) {
+                int leaf = 0;
+                while (!(p.subset >> leaf & 1))
+                    leaf++;
+                nodeStorage[p.slot] = leafNodes[leaf];
+                cost[p.slot] = leafCost[leaf];
+                triangles[p.slot] = leafTriangles[leaf];
+                continue;
+            }
+            uint32_t pair = pairs[nextPair++];
+            BvhNode& node = nodeStorage[p.slot];
+            node.bmin = bmin[p.subset];
+            node.bmax = bmax[p.subset];
+            node.leftFirst = pair;
+            node.count = 0;
+            cost[p.slot] = best[p.subset];
+            uint32_t left = split[p.subset];
+            triangles[p.slot] = 0;
+            for (int i = 0; i < leafCount; i++)
+                triangles[p.slot] += (p.subset >> i & 1) ? leafTriangles[i] : 0;
+            stack[sp++] = { left, pair };
+            stack[sp++] = { p.subset ^ left, pair + 1 };
+        }
+    };
+
+    // Subtrees of nodes at one depth are disjoint. A restructured treelet
+    // keeps its root slot and only moves nodes below it, so the shallower
+    // levels still to come are unaffected.
+    uint32_t minTriangles = (uint32_t)n;
+    for (int iteration = 0; iteration < iterations; iteration++, minTriangles *= 2) {
+        bvh_levels(nodes, nodeCount, order, levelStart);
+        for (size_t level = levelStart.size() - 1; level-- > 0;) {
+            parallel_for(levelStart[level], levelStart[level + 1], 64, [&](size_t i) {
+                uint32_t index = order[i];
+                if (nodeStorage[index].count == 0 && triangles[index] >= minTriangles)
+                    restructure(index);
+            });
+        }
+    }
+    // Restructured treelets can come out deeper than they went in.
+    depth = bvh_depth(nodes, nodeCount);
+}
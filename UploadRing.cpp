@@ -0,0 +1,43 @@
+#include "UploadRing.hpp"
+
+void UploadRing::reset(uint64_t capacity_)
+{
+    capacity = capacity_;
+    head = 0;
+    tail = 0;
+    frames.clear();
+}
+
+bool UploadRing::allocate(uint64_t size, uint64_t alignment, uint64_t& offset)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) || capacity % alignment || size > capacity)
+        return false;
+    // With nothing in use, start over at the beginning so the whole ring is free.
+    if (head == tail && frames.empty())
+        head = tail = 0;
+    uint64_t position = (head + alignment - 1) & ~(alignment - 1);
+    // An allocation never straddles the end; the rest of the ring is skipped.
+    if (position % capacity + size > capacity)
+        position += capacity - position % capacity;
+    if (position + size - tail > capacity)
+        return false;
+    head = position + size;
+    offset = position % capacity;
+    return true;
+}
+
+void UploadRing::finishFrame(uint64_t fenceValue)
+{
+    if (!frames.empty() && frames.back().end == head)
+        frames.back().fenceValue = fenceValue;
+    else
+        frames.push_back({ fenceValue, head });
+}
+
+void UploadRing::retire(uint64_t completedFenceValue)
+{
+    while (!frames.empty() && frames.front().fenceValue <= completedFenceValue) {
+        tail = frames.front().end;
+        frames.pop_front();
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <deque>
+#include <stdint.h>
+
+// Linear allocator over a ring of capacity bytes, for per-frame data written
+// by the CPU and read by the GPU. Allocations are grouped into frames, each
+// tagged with the fence value the queue signals once it is done with them;
+// retire() hands the space back when the fence reaches that value. Only
+// offsets are tracked, so the buffer itself and the fence live elsewhere.
+struct UploadRing
+{
+    // Offsets keep the requested alignment as long as it divides capacity.
+    void reset(uint64_t capacity_);
+
+    // False if the space is still in use by frames the GPU has not finished,
+    // or the request can never fit.
+    bool allocate(uint64_t size, uint64_t alignment, uint64_t& offset);
+
+    // Tag everything allocated since the previous call with fenceValue.
+    void finishFrame(uint64_t fenceValue);
+
+    // Reclaim the frames whose fence value is at most completedFenceValue.
+    void retire(uint64_t completedFenceValue);
+
+    // Fence value to wait for to free the oldest frame, or 0 if none is pending.
+    uint64_t oldestFence() const { return frames.empty() ? 0 : frames.front().fenceValue; }
+    uint64_t usedBytes() const { return head - tail; }
+
+    struct Frame
+    {
+        uint64_t fenceValue;
+        uint64_t end; // head when the frame was finished
+    };
+
+    uint64_t capacity = 0;
+    // Positions grow without wrapping; the offset in the ring is position
+    // modulo capacity. [tail, head) is in use.
+    uint64_t head = 0;
+    uint64_t tail = 0;
+    std::deque<Frame> frames;
+};
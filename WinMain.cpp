@@ -52,8 +52,10 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lspzCmdLi
             TranslateMessage(&msg);
             DispatchMessage(&msg);
 
-            if (msg.message == WM_QUIT)
+            if (msg.message == WM_QUIT) {
+                RefractionDemo::shutdown();
                 return (int)msg.wParam;
+            }
         }
         RefractionDemo::drawFrame();
     }
@@ -1,3 +1,4 @@
+#define NOMINMAX
 #include <Windows.h>
 #include <wrl/client.h>
 #include <D3Dcompiler.h>
@@ -0,0 +1,52 @@
+#include "Check.hpp"
+#include "BvhReport.hpp"
+
+#include <cmath>
+
+static void add_triangle(Mesh& mesh, float3 a, float3 b, float3 c)
+{
+    for (float3 p : { a, b, c }) {
+        mesh.indices.push_back((uint32_t)mesh.verts.size());
+        mesh.verts.push_back({ { p.x, p.y, p.z }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f } });
+    }
+}
+
+static void test_json()
+{
+    Mesh mesh;
+    add_triangle(mesh, { 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    add_triangle(mesh, { 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 1.0f });
+    Bvh bvh;
+    bvh.build(mesh);
+    BvhReport report = inspect_bvh(bvh, 2, 8);
+    CHECK(report.triCount == 2 && report.leafCount > 0 && std::isfinite(report.sahCost));
+    std::string json = to_json(report);
+    CHECK(json.find("\"triCount\": 2,") != std::string::npos);
+    CHECK(json.find("null") == std::string::npos);
+}
+
+// A root box of zero area makes the SAH cost 0 / 0; JSON has no NaN, so it is
+// written as null.
+static void test_degenerate_tree()
+{
+    Mesh mesh;
+    add_triangle(mesh, { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f });
+    Bvh bvh;
+    bvh.build(mesh);
+    BvhReport report = inspect_bvh(bvh, 2, 8);
+    CHECK(!std::isfinite(report.sahCost));
+    std::string json = to_json(report);
+    CHECK(json.find("\"sahCost\": null,") != std::string::npos);
+    CHECK(json.find("nan") == std::string::npos && json.find("inf") == std::string::npos);
+
+    report.nodesPerRay = INFINITY;
+    json = to_json(report);
+    CHECK(json.find("\"nodesPerRay\": null,") != std::string::npos);
+}
+
+int main()
+{
+    test_json();
+    test_degenerate_tree();
+    return test_result();
+}
@@ -0,0 +1,281 @@
+#include "Check.hpp"
+#include "Bvh.hpp"
+#include "CompressedBvh.hpp"
+#include "Scene.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+// Cache files go next to a mesh file that need not exist.
+static const char* meshName = "bvh-test.obj";
+static const std::string cacheName = std::string(meshName) + ".bvh";
+
+static void add_triangle(Mesh& mesh, float3 a, float3 b, float3 c)
+{
+    for (float3 p : { a, b, c }) {
+        mesh.indices.push_back((uint32_t)mesh.verts.size());
+        mesh.verts.push_back({ { p.x, p.y, p.z }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f } });
+    }
+}
+
+static Mesh random_mesh(uint32_t triangles)
+{
+    Mesh mesh;
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> position(-1.0f, 1.0f), offset(-0.1f, 0.1f);
+    for (uint32_t i = 0; i < triangles; i++) {
+        float3 a = { position(rng), position(rng), position(rng) };
+        add_triangle(mesh, a, a + float3{ offset(rng), offset(rng), offset(rng) }, a + float3{ offset(rng), offset(rng), offset(rng) });
+    }
+    return mesh;
+}
+
+static bool brute_force(const Mesh& mesh, Ray ray, Hit& hit)
+{
+    bool found = false;
+    for (uint32_t prim = 0; prim < mesh.indices.size() / 3; prim++) {
+        float t, u, v;
+        if (intersect_triangle(ray, vertex_position(mesh, prim, 0), vertex_position(mesh, prim, 1), vertex_position(mesh, prim, 2),
+                CULL_NONE, t, u, v)) {
+            ray.tmax = t;
+            hit = { t, u, v, prim };
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Random rays through the mesh's box give the same closest hits as testing
+// every triangle.
+static bool matches_brute_force(const Bvh& bvh, int rayCount)
+{
+    std::mt19937 rng(9);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    for (int i = 0; i < rayCount; i++) {
+        float3 origin = { 3.0f * uniform(rng), 3.0f * uniform(rng), 3.0f * uniform(rng) };
+        float3 target = { uniform(rng), uniform(rng), uniform(rng) };
+        Ray ray = { origin, normalize(target - origin), 0.0f, 1e30f };
+        Hit expected, hit;
+        bool expectedFound = brute_force(*bvh.mesh, ray, expected);
+        if (bvh.intersect(ray, CULL_NONE, hit) != expectedFound || (expectedFound && hit.prim != expected.prim))
+            return false;
+    }
+    return true;
+}
+
+static std::string read_cache()
+{
+    std::ifstream is(cacheName, std::ios_base::binary);
+    return std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+}
+
+static void write_cache(const std::string& contents)
+{
+    std::ofstream(cacheName, std::ios_base::binary) << contents;
+}
+
+// Damaged cache files are rebuilt instead of traversed.
+static void test_damaged_cache()
+{
+    remove(cacheName.c_str());
+    Mesh mesh = random_mesh(500);
+    Bvh built;
+    CHECK(built.open(meshName, mesh));
+    CHECK(matches_brute_force(built, 2000));
+    built.file.close();
+    std::string good = read_cache();
+    CHECK(good.size() > sizeof(BvhFileHeader));
+
+    Bvh mapped;
+    CHECK(mapped.open(meshName, mesh) && mapped.file.data);
+    CHECK(mapped.depth == bvh_depth(mapped.nodes, mapped.nodeCount));
+    CHECK(matches_brute_force(mapped, 2000));
+    mapped.file.close();
+
+    auto nodeField = [&](uint32_t node, size_t field) { return sizeof(BvhFileHeader) + node * sizeof(BvhNode) + field; };
+    const BvhNode root = *(const BvhNode*)(good.data() + nodeField(0, 0));
+    CHECK(root.count == 0);
+    uint32_t count = (uint32_t)((good.size() - sizeof(BvhFileHeader)) / sizeof(BvhNode));
+
+    const uint32_t badValues[] = { 0, root.leftFirst - 1 + count, 0x7fffffff, ~0u };
+    for (uint32_t bad : badValues) {
+        // A child index out of range, or pointing back up the tree.
+        std::string damaged = good;
+        memcpy(&damaged[nodeField(0, offsetof(BvhNode, leftFirst))], &bad, sizeof(bad));
+        write_cache(damaged);
+        Bvh bvh;
+        CHECK(bvh.open(meshName, mesh));
+        CHECK(read_cache() == good);
+        CHECK(matches_brute_force(bvh, 200));
+    }
+
+    // Two nodes sharing a child.
+    std::string shared = good;
+    const BvhNode left = *(const BvhNode*)(good.data() + nodeField(root.leftFirst, 0));
+    if (left.count == 0) {
+        memcpy(&shared[nodeField(root.leftFirst + 1, 0)], &left, sizeof(left));
+        write_cache(shared);
+        Bvh bvh;
+        CHECK(bvh.open(meshName, mesh));
+        CHECK(read_cache() == good);
+    }
+
+    // A leaf past the triangle indices, and a triangle index past the mesh.
+    for (uint32_t node = 0; node < count; node++) {
+        const BvhNode& n = *(const BvhNode*)(good.data() + nodeField(node, 0));
+        if (n.count == 0)
+            continue;
+        std::string damaged = good;
+        uint32_t big = 0xffff0000u;
+        memcpy(&damaged[nodeField(node, offsetof(BvhNode, count))], &big, sizeof(big));
+        write_cache(damaged);
+        Bvh bvh;
+        CHECK(bvh.open(meshName, mesh));
+        CHECK(read_cache() == good);
+        break;
+    }
+    std::string damaged = good;
+    uint32_t badIndex = 500;
+    memcpy(&damaged[good.size() - sizeof(uint32_t)], &badIndex, sizeof(badIndex));
+    write_cache(damaged);
+    Bvh bvh;
+    CHECK(bvh.open(meshName, mesh));
+    CHECK(read_cache() == good);
+    bvh.file.close();
+    remove(cacheName.c_str());
+}
+
+// Treelet restructuring can change the depth a build recorded.
+static void test_optimized_depth()
+{
+    Mesh mesh = random_mesh(20000);
+    BvhBuildOptions options;
+    options.treeletIterations = 3;
+    Bvh bvh;
+    bvh.build(mesh, options);
+    CHECK(bvh.depth == bvh_depth(bvh.nodes, bvh.nodeCount));
+    CHECK(matches_brute_force(bvh, 2000));
+}
+
+// A chain of triangles one unit apart along x, as a tree whose every level
+// holds one group of triangles and the rest of the chain: far deeper than the
+// fixed traversal stacks.
+static const uint32_t chainLength = 400;
+
+// Fills nodes[index] with the subtree over triangles [first, first + count).
+static void add_chain_node(std::vector<BvhNode>& nodes, uint32_t index, uint32_t first, uint32_t count, uint32_t group)
+{
+    BvhNode node = { { (float)first, 0.0f, 0.0f }, first, { (float)(first + count - 1), 1.0f, 1.0f }, 1 };
+    if (count > 1) {
+        uint32_t left = count > group ? group : count / 2;
+        node.leftFirst = (uint32_t)nodes.size();
+        node.count = 0;
+        nodes.resize(nodes.size() + 2);
+        add_chain_node(nodes, node.leftFirst, first, left, group);
+        add_chain_node(nodes, node.leftFirst + 1, first + left, count - left, group);
+    }
+    nodes[index] = node;
+}
+
+static void build_chain(Mesh& mesh, Bvh& bvh, uint32_t n = chainLength, uint32_t group = 1)
+{
+    uint32_t triangles = n * group;
+    for (uint32_t k = 0; k < triangles; k++) {
+        add_triangle(mesh, { (float)k, 0.0f, 0.0f }, { (float)k, 1.0f, 0.0f }, { (float)k, 0.0f, 1.0f });
+        bvh.triIndexStorage.push_back(k);
+    }
+    bvh.nodeStorage.resize(1);
+    add_chain_node(bvh.nodeStorage, 0, 0, triangles, group);
+
+    bvh.mesh = &mesh;
+    bvh.triCount = triangles;
+    bvh.nodes = bvh.nodeStorage.data();
+    bvh.nodeCount = (uint32_t)bvh.nodeStorage.size();
+    bvh.triIndices = bvh.triIndexStorage.data();
+    bvh.triIndexCount = triangles;
+    bvh.depth = bvh_depth(bvh.nodes, bvh.nodeCount);
+}
+
+// From +x, the rest of the chain is always nearer than its group, so every
+// group waits on the stack until the last triangle is reached.
+static const Ray fromFar = { { 10000.0f, 0.2f, 0.2f }, { -1.0f, 0.0f, 0.0f }, 0.0f, 1e30f };
+static const Ray fromNear = { { -1.0f, 0.2f, 0.2f }, { 1.0f, 0.0f, 0.0f }, 0.0f, 1e30f };
+static const Ray pastChain = { { -1.0f, 2.0f, 0.2f }, { 1.0f, 0.0f, 0.0f }, 0.0f, 1e30f };
+
+static void test_deep_bvh()
+{
+    Mesh mesh;
+    Bvh bvh;
+    build_chain(mesh, bvh);
+    CHECK(bvh.depth == chainLength - 1);
+    CHECK(valid_bvh_nodes(bvh.nodes, bvh.nodeCount, bvh.triIndexCount));
+
+    Hit hit;
+    CHECK(bvh.intersect(fromFar, CULL_NONE, hit) && hit.prim == chainLength - 1);
+    CHECK(bvh.intersect(fromNear, CULL_NONE, hit) && hit.prim == 0);
+    CHECK(!bvh.intersect(pastChain, CULL_NONE, hit));
+}
+
+// Leaves are tested as soon as they are reached, so only interior groups wait:
+// two triangles per group, and a chain long enough that three groups waiting
+// per four-wide node outgrow the fixed stack.
+static void test_deep_compressed()
+{
+    const uint32_t n = 2 * 1000;
+    Mesh mesh;
+    Bvh bvh;
+    build_chain(mesh, bvh, n / 2, 2);
+    CHECK(valid_bvh_nodes(bvh.nodes, bvh.nodeCount, bvh.triIndexCount));
+    CompressedBvh compressed;
+    compressed.build(bvh);
+
+    Hit hit;
+    CHECK(compressed.intersect(fromFar, CULL_NONE, hit) && hit.prim == n - 1);
+    CHECK(compressed.intersect(fromNear, CULL_NONE, hit) && hit.prim == 0);
+    CHECK(!compressed.intersect(pastChain, CULL_NONE, hit));
+}
+
+// The same chain as a top level, one instance per triangle, in place of the
+// tree Scene::build made.
+static void test_deep_scene()
+{
+    Mesh chainMesh;
+    Bvh chain;
+    build_chain(chainMesh, chain);
+
+    Scene scene;
+    std::vector<Mesh> meshes(chainLength);
+    std::vector<Bvh> bvhs(chainLength);
+    for (uint32_t k = 0; k < chainLength; k++) {
+        add_triangle(meshes[k], { (float)k, 0.0f, 0.0f }, { (float)k, 1.0f, 0.0f }, { (float)k, 0.0f, 1.0f });
+        bvhs[k].build(meshes[k]);
+        scene.meshes.push_back(&bvhs[k]);
+        Instance instance = {};
+        instance.transform.m[0][0] = instance.transform.m[1][1] = instance.transform.m[2][2] = 1.0f;
+        instance.mesh = k;
+        scene.instances.push_back(instance);
+    }
+    scene.build();
+    scene.nodes = chain.nodeStorage;
+    scene.instanceIndices = chain.triIndexStorage;
+    scene.depth = chain.depth;
+
+    SceneHit hit;
+    CHECK(scene.intersect(fromFar, CULL_NONE, 0xff, hit) && hit.instance == chainLength - 1);
+    CHECK(scene.intersect(fromNear, CULL_NONE, 0xff, hit) && hit.instance == 0);
+    CHECK(!scene.intersect(pastChain, CULL_NONE, 0xff, hit));
+}
+
+int main()
+{
+    test_damaged_cache();
+    test_optimized_depth();
+    test_deep_bvh();
+    test_deep_compressed();
+    test_deep_scene();
+    return test_result();
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdio.h>
+
+// Just enough for the unit tests: a failed CHECK reports where it failed and
+// makes test_result() return nonzero, which is what CTest looks at.
+inline int testFailures = 0;
+
+#define CHECK(condition)                                                                   \
+    do {                                                                                   \
+        if (!(condition)) {                                                                \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            testFailures++;                                                                \
+        }                                                                                  \
+    } while (0)
+
+inline int test_result()
+{
+    if (testFailures)
+        fprintf(stderr, "%d checks failed\n", testFailures);
+    return testFailures ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+#include "Check.hpp"
+#include "DescriptorAllocator.hpp"
+
+#include <random>
+
+static void test_stale_handles()
+{
+    DescriptorAllocator descriptors;
+    descriptors.reset(4, 2, 8);
+
+    DescriptorHandle a;
+    CHECK(descriptors.allocate(a) && a.index == 0);
+    CHECK(descriptors.valid(a));
+
+    CHECK(descriptors.free(a, 1));
+    CHECK(!descriptors.valid(a));
+    // Freeing twice is caught.
+    CHECK(!descriptors.free(a, 1));
+
+    // Once the slot is handed out again, the old handle still does not
+    // resolve, nor can it free the new owner's slot.
+    descriptors.retire(1);
+    DescriptorHandle b;
+    for (int i = 0; i < 4; i++) {
+        CHECK(descriptors.allocate(b));
+        if (b.index == a.index)
+            break;
+    }
+    CHECK(b.index == a.index);
+    CHECK(b.generation != a.generation);
+    CHECK(descriptors.valid(b));
+    CHECK(!descriptors.valid(a));
+    CHECK(!descriptors.free(a, 2));
+    CHECK(descriptors.valid(b));
+
+    // Default and out-of-range handles are never valid.
+    CHECK(!descriptors.valid(DescriptorHandle()));
+    DescriptorHandle outside;
+    outside.index = 4;
+    outside.generation = 1;
+    CHECK(!descriptors.valid(outside));
+}
+
+static void test_reuse_after_fence()
+{
+    DescriptorAllocator descriptors;
+    descriptors.reset(2, 2, 8);
+
+    DescriptorHandle a, b, c;
+    CHECK(descriptors.allocate(a));
+    CHECK(descriptors.allocate(b));
+    CHECK(!descriptors.allocate(c));
+    CHECK(descriptors.persistentUsed() == 2);
+
+    // Frames up to fence 5 may still read slot a.
+    descriptors.free(a, 5);
+    CHECK(descriptors.persistentUsed() == 1);
+    CHECK(!descriptors.allocate(c));
+    descriptors.retire(4);
+    CHECK(!descriptors.allocate(c));
+    descriptors.retire(5);
+    CHECK(descriptors.allocate(c) && c.index == a.index);
+
+    // Slots come back in fence order as the fence moves on.
+    descriptors.free(b, 7);
+    descriptors.free(c, 8);
+    descriptors.retire(7);
+    DescriptorHandle d, e;
+    CHECK(descriptors.allocate(d) && d.index == b.index);
+    CHECK(!descriptors.allocate(e));
+    descriptors.retire(8);
+    CHECK(descriptors.allocate(e) && e.index == c.index);
+}
+
+// Random allocations and frees against a fence that lags behind: no slot is
+// handed out while a live handle or a frame in flight may still use it.
+static void test_random()
+{
+    const uint32_t count = 64;
+    DescriptorAllocator descriptors;
+    descriptors.reset(count, 2, 8);
+    std::mt19937 rng(3);
+    std::vector<DescriptorHandle> live;
+    std::vector<uint64_t> busyUntil(count, 0);  // fence value of the last frame using the slot
+    std::vector<uint8_t> owned(count, 0);
+    uint64_t fence = 0, completed = 0;
+    bool reusedEarly = false, doubleHanded = false, staleValid = false;
+    std::vector<DescriptorHandle> freed;
+
+    for (int i = 0; i < 100000; i++) {
+        if (rng() % 2) {
+            DescriptorHandle h;
+            if (descriptors.allocate(h)) {
+                doubleHanded |= owned[h.index] != 0;
+                reusedEarly |= busyUntil[h.index] > completed;
+                owned[h.index] = 1;
+                live.push_back(h);
+            }
+        } else if (!live.empty()) {
+            size_t k = rng() % live.size();
+            DescriptorHandle h = live[k];
+            live[k] = live.back();
+            live.pop_back();
+            descriptors.free(h, fence + 1);
+            busyUntil[h.index] = fence + 1;
+            owned[h.index] = 0;
+            freed.push_back(h);
+        }
+        if (rng() % 8 == 0) {
+            fence++;
+            if (fence > 2)
+                completed = fence - 2 - rng() % 2;
+            descriptors.retire(completed);
+        }
+    }
+    for (const DescriptorHandle& h : freed)
+        staleValid |= descriptors.valid(h);
+    for (const DescriptorHandle& h : live)
+        CHECK(descriptors.valid(h));
+    CHECK(!reusedEarly);
+    CHECK(!doubleHanded);
+    CHECK(!staleValid);
+}
+
+static void test_frame_regions()
+{
+    DescriptorAllocator descriptors;
+    descriptors.reset(10, 3, 4);
+    CHECK(descriptors.capacity() == 22);
+
+    uint32_t first;
+    descriptors.beginFrame(0);
+    CHECK(descriptors.allocateFrame(3, first) && first == 10);
+    CHECK(descriptors.allocateFrame(1, first) && first == 13);
+    CHECK(!descriptors.allocateFrame(1, first));
+
+    // Each context has its own region, so frame 1 does not touch frame 0's.
+    descriptors.beginFrame(1);
+    CHECK(descriptors.allocateFrame(4, first) && first == 14);
+    CHECK(!descriptors.allocateFrame(1, first));
+
+    // Beginning a frame again starts its region over.
+    descriptors.beginFrame(0);
+    CHECK(descriptors.allocateFrame(2, first) && first == 10);
+    descriptors.beginFrame(2);
+    CHECK(descriptors.allocateFrame(4, first) && first == 18);
+    CHECK(!descriptors.allocateFrame(5, first));
+
+    // Frames past the last context have no region.
+    descriptors.beginFrame(3);
+    CHECK(!descriptors.allocateFrame(1, first));
+}
+
+int main()
+{
+    test_stale_handles();
+    test_reuse_after_fence();
+    test_random();
+    test_frame_regions();
+    return test_result();
+}
@@ -0,0 +1,109 @@
+#include "Check.hpp"
+#include "FrameContexts.hpp"
+
+#include <deque>
+#include <random>
+
+// A queue that runs submitted frames in order and signals their fence values
+// as it finishes them.
+struct SimulatedQueue
+{
+    struct Submission
+    {
+        unsigned context;
+        uint64_t fenceValue;
+    };
+
+    uint64_t nextFence = 1;
+    uint64_t completed = 0;
+    std::deque<Submission> pending;
+
+    uint64_t submit(unsigned context)
+    {
+        pending.push_back({ context, nextFence });
+        return nextFence++;
+    }
+
+    void finishOne()
+    {
+        completed = pending.front().fenceValue;
+        pending.pop_front();
+    }
+
+    void waitFor(uint64_t fenceValue)
+    {
+        while (completed < fenceValue)
+            finishOne();
+    }
+
+    bool inUse(unsigned context) const
+    {
+        for (const Submission& s : pending) {
+            if (s.context == context)
+                return true;
+        }
+        return false;
+    }
+};
+
+static void test_cycle()
+{
+    FrameContexts contexts;
+    contexts.reset(3);
+    uint64_t wait;
+    for (unsigned frame = 0; frame < 9; frame++) {
+        unsigned context = contexts.begin(wait);
+        CHECK(context == frame % 3);
+        // Contexts wait for the frame that used them last, three frames back.
+        CHECK(wait == (frame < 3 ? 0 : frame - 2));
+        contexts.end(frame + 1);
+        CHECK(contexts.lastFence() == frame + 1);
+    }
+
+    // A single context waits for the frame right before.
+    contexts.reset(0);
+    CHECK(contexts.count == 1);
+    contexts.begin(wait);
+    CHECK(wait == 0);
+    contexts.end(7);
+    CHECK(contexts.begin(wait) == 0 && wait == 7);
+}
+
+// Random GPU progress: the CPU only ever waits for the fence begin() returns,
+// and a context must never be recorded into while the GPU still runs a frame
+// that used it.
+static void test_reuse_after_fence()
+{
+    for (unsigned count = 1; count <= 4; count++) {
+        FrameContexts contexts;
+        SimulatedQueue queue;
+        contexts.reset(count);
+        std::mt19937 rng(count);
+        bool reusedEarly = false, tooManyInFlight = false;
+
+        for (int frame = 0; frame < 5000; frame++) {
+            // The GPU gets through 0..2 frames while the CPU records.
+            for (unsigned n = rng() % 3; n && !queue.pending.empty(); n--)
+                queue.finishOne();
+
+            uint64_t wait;
+            unsigned context = contexts.begin(wait);
+            queue.waitFor(wait);
+            reusedEarly |= queue.inUse(context);
+            // Never more frames in flight than there are contexts.
+            tooManyInFlight |= queue.pending.size() >= count;
+            contexts.end(queue.submit(context));
+        }
+        CHECK(!reusedEarly);
+        CHECK(!tooManyInFlight);
+        queue.waitFor(contexts.lastFence());
+        CHECK(queue.pending.empty());
+    }
+}
+
+int main()
+{
+    test_cycle();
+    test_reuse_after_fence();
+    return test_result();
+}
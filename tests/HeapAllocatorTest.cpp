@@ -0,0 +1,140 @@
+#include "Check.hpp"
+#include "HeapAllocator.hpp"
+
+#include <iterator>
+#include <map>
+#include <random>
+
+static bool overlaps(const std::map<uint64_t, uint64_t>& live, uint64_t offset, uint64_t size)
+{
+    auto next = live.lower_bound(offset);
+    if (next != live.end() && next->first < offset + size)
+        return true;
+    if (next != live.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second > offset)
+            return true;
+    }
+    return false;
+}
+
+// Random allocations and frees: live blocks stay inside the heap, never
+// overlap and keep their alignment, and freeing everything leaves one block.
+// At most 500 blocks are live, which always fits in the heap.
+static void test_random()
+{
+    const uint64_t capacity = 64ull << 20;
+    HeapAllocator heap;
+    heap.reset(capacity);
+    std::mt19937_64 rng(7);
+    std::map<uint64_t, uint64_t> live; // offset to size
+    bool outside = false, overlap = false, misaligned = false;
+    int failures = 0;
+
+    for (int i = 0; i < 200000; i++) {
+        if (live.empty() || (live.size() < 500 && rng() % 2)) {
+            // Mostly small, sometimes large, like buffers and BLASes.
+            uint64_t size = rng() % 10 ? rng() % 4096 + 1 : rng() % (1 << 20) + 1;
+            uint64_t alignment = 1ull << (rng() % 17);
+            uint64_t offset;
+            if (!heap.allocate(size, alignment, offset)) {
+                failures++;
+                continue;
+            }
+            outside |= offset + size > capacity;
+            misaligned |= offset % alignment != 0;
+            overlap |= overlaps(live, offset, size);
+            live[offset] = size;
+        } else {
+            auto it = live.begin();
+            std::advance(it, rng() % std::min<size_t>(live.size(), 64));
+            heap.free(it->first);
+            live.erase(it);
+        }
+    }
+    CHECK(!outside);
+    CHECK(!overlap);
+    CHECK(!misaligned);
+    CHECK(heap.stats().allocationCount == live.size());
+    CHECK(failures == 0);
+
+    for (const auto& l : live)
+        heap.free(l.first);
+    HeapAllocatorStats stats = heap.stats();
+    CHECK(stats.usedBytes == 0);
+    CHECK(stats.allocationCount == 0);
+    CHECK(stats.freeBlockCount == 1);
+    CHECK(stats.largestFreeBlock == capacity);
+    CHECK(stats.fragmentation == 0.0f);
+}
+
+static void test_alignment()
+{
+    HeapAllocator heap;
+    heap.reset(1 << 20);
+    uint64_t a, b, c;
+    CHECK(heap.allocate(1, 1, a) && a == 0);
+    // The padding in front of an aligned block stays free for later.
+    CHECK(heap.allocate(100, 65536, b) && b == 65536);
+    CHECK(heap.allocate(100, 256, c) && c % 256 == 0 && c < 65536);
+    uint64_t offset;
+    CHECK(!heap.allocate(16, 0, offset));
+    CHECK(!heap.allocate(16, 48, offset));
+}
+
+static void test_coalescing()
+{
+    HeapAllocator heap;
+    heap.reset(4096);
+    uint64_t offsets[4];
+    for (uint64_t& offset : offsets)
+        CHECK(heap.allocate(1024, 1, offset));
+    CHECK(heap.stats().freeBytes == 0);
+
+    // Free out of order; neighbours on both sides merge.
+    heap.free(offsets[1]);
+    heap.free(offsets[3]);
+    CHECK(heap.stats().freeBlockCount == 2);
+    heap.free(offsets[2]);
+    CHECK(heap.stats().freeBlockCount == 1);
+    CHECK(heap.stats().largestFreeBlock == 3072);
+    heap.free(offsets[0]);
+    CHECK(heap.stats().freeBlockCount == 1);
+    CHECK(heap.stats().largestFreeBlock == 4096);
+
+    uint64_t whole;
+    CHECK(heap.allocate(4096, 1, whole) && whole == 0);
+}
+
+static void test_exhausted()
+{
+    HeapAllocator heap;
+    heap.reset(1 << 16);
+    uint64_t offset;
+    CHECK(!heap.allocate((1 << 16) + 1, 1, offset));
+    CHECK(!heap.allocate(~0ull, 1, offset));
+
+    int count = 0;
+    while (heap.allocate(4096, 1, offset))
+        count++;
+    CHECK(count == 16);
+    CHECK(heap.stats().freeBytes == 0);
+    CHECK(!heap.allocate(1, 1, offset));
+
+    heap.free(8192);
+    CHECK(heap.allocate(4096, 1, offset) && offset == 8192);
+
+    // An empty heap has nothing to give.
+    HeapAllocator empty;
+    empty.reset(0);
+    CHECK(!empty.allocate(1, 1, offset));
+}
+
+int main()
+{
+    test_random();
+    test_alignment();
+    test_coalescing();
+    test_exhausted();
+    return test_result();
+}
@@ -0,0 +1,216 @@
+#include "Check.hpp"
+#include "ResourceStates.hpp"
+
+static int texture, buffer, backBuffer, image;
+
+static bool is_transition(const ResourceBarrier& b, const void* resource, uint32_t before, uint32_t after,
+    BarrierSplit split = BARRIER_SPLIT_NONE, uint32_t subresource = allSubresources)
+{
+    return b.type == BARRIER_TRANSITION && b.split == split && b.resource == resource &&
+        b.subresource == subresource && b.before == before && b.after == after;
+}
+
+static void test_read_states_combine()
+{
+    ResourceStateTracker tracker;
+    tracker.track(&texture, 1, STATE_COPY_DEST);
+
+    // Two read-only states requested together become one combined state.
+    tracker.transition(&texture, STATE_PIXEL_SHADER_RESOURCE);
+    tracker.transition(&texture, STATE_NON_PIXEL_SHADER_RESOURCE);
+    std::vector<ResourceBarrier> barriers = tracker.flush();
+    uint32_t srv = STATE_PIXEL_SHADER_RESOURCE | STATE_NON_PIXEL_SHADER_RESOURCE;
+    CHECK(barriers.size() == 1);
+    CHECK(is_transition(barriers[0], &texture, STATE_COPY_DEST, srv));
+    CHECK(tracker.state(&texture) == srv);
+
+    // A read state the current one already includes needs no barrier.
+    tracker.transition(&texture, STATE_PIXEL_SHADER_RESOURCE);
+    CHECK(tracker.flush().empty());
+    CHECK(tracker.state(&texture) == srv);
+
+    // A further read state is added rather than swapped in.
+    tracker.transition(&texture, STATE_COPY_SOURCE);
+    barriers = tracker.flush();
+    CHECK(barriers.size() == 1);
+    CHECK(is_transition(barriers[0], &texture, srv, srv | STATE_COPY_SOURCE));
+
+    // A write state replaces the read states.
+    tracker.transition(&texture, STATE_COPY_DEST);
+    barriers = tracker.flush();
+    CHECK(barriers.size() == 1);
+    CHECK(is_transition(barriers[0], &texture, srv | STATE_COPY_SOURCE, STATE_COPY_DEST));
+
+    // COMMON relies on promotion and is not combined with reads.
+    tracker.track(&buffer, 1, STATE_COMMON);
+    tracker.transition(&buffer, STATE_COPY_SOURCE);
+    barriers = tracker.flush();
+    CHECK(barriers.size() == 1);
+    CHECK(is_transition(barriers[0], &buffer, STATE_COMMON, STATE_COPY_SOURCE));
+}
+
+static void test_no_op_transitions()
+{
+    ResourceStateTracker tracker;
+    tracker.track(&image, 1, STATE_UNORDERED_ACCESS);
+
+    tracker.transition(&image, STATE_UNORDERED_ACCESS);
+    CHECK(tracker.flush().empty());
+
+    // Requests in one batch collapse; ending where it started is no barrier.
+    tracker.transition(&image, STATE_COPY_SOURCE);
+    tracker.transition(&image, STATE_UNORDERED_ACCESS);
+    CHECK(tracker.flush().empty());
+    CHECK(tracker.state(&image) == STATE_UNORDERED_ACCESS);
+
+    // Otherwise only the last state counts.
+    tracker.transition(&image, STATE_COPY_DEST);
+    tracker.transition(&image, STATE_COPY_SOURCE);
+    std::vector<ResourceBarrier> barriers = tracker.flush();
+    CHECK(barriers.size() == 1);
+    CHECK(is_transition(barriers[0], &image, STATE_UNORDERED_ACCESS, STATE_COPY_SOURCE));
+
+    // Untracked resources start out in COMMON.
+    CHECK(tracker.state(&buffer) == STATE_COMMON);
+    tracker.transition(&buffer, STATE_COMMON);
+    CHECK(tracker.flush().empty());
+}
+
+static void test_subresources()
+{
+    ResourceStateTracker tracker;
+    tracker.track(&texture, 4, STATE_COPY_DEST);
+
+    // One mip moves on its own.
+    tracker.transition(&texture, STATE_PIXEL_SHADER_RESOURCE, 2);
+    std::vector<ResourceBarrier> barriers = tracker.flush();
+    CHECK(barriers.size() == 1);
+    CHECK(is_transition(barriers[0], &texture, STATE_COPY_DEST, STATE_PIXEL_SHADER_RESOURCE, BARRIER_SPLIT_NONE, 2));
+
+    // From mixed states, each subresource that changes gets its own barrier.
+    tracker.transition(&texture, STATE_PIXEL_SHADER_RESOURCE);
+    barriers = tracker.flush();
+    CHECK(barriers.size() == 3);
+    for (const ResourceBarrier& b : barriers)
+        CHECK(b.subresource != 2 && b.before == STATE_COPY_DEST);
+
+    // The same transition of every subresource is one barrier.
+    tracker.transition(&texture, STATE_COPY_DEST);
+    barriers = tracker.flush();
+    CHECK(barriers.size() == 1);
+    CHECK(is_transition(barriers[0], &texture, STATE_PIXEL_SHADER_RESOURCE, STATE_COPY_DEST));
+}
+
+// The back buffer as drawFrame uses it: the transition to COPY_DEST starts
+// right after the previous frame is presented and ends when the copy needs it.
+static void test_back_buffer_split()
+{
+    ResourceStateTracker tracker;
+    tracker.track(&backBuffer, 1, STATE_PRESENT);
+    tracker.track(&image, 1, STATE_UNORDERED_ACCESS);
+
+    tracker.beginTransition(&backBuffer, STATE_COPY_DEST);
+    tracker.transition(&image, STATE_UNORDERED_ACCESS);
+    std::vector<ResourceBarrier> barriers = tracker.flush();
+    CHECK(barriers.size() == 1);
+    CHECK(is_transition(barriers[0], &backBuffer, STATE_PRESENT, STATE_COPY_DEST, BARRIER_SPLIT_BEGIN));
+    CHECK(tracker.state(&backBuffer) == STATE_COPY_DEST);
+
+    // Beginning the same split again before it ends does nothing.
+    tracker.beginTransition(&backBuffer, STATE_COPY_DEST);
+    CHECK(tracker.flush().empty());
+
+    // Ray tracing, then the copy: the split ends, with the image moving in
+    // the same batch, the split's end first.
+    tracker.transition(&backBuffer, STATE_COPY_DEST);
+    tracker.transition(&image, STATE_COPY_SOURCE);
+    barriers = tracker.flush();
+    CHECK(barriers.size() == 2);
+    CHECK(is_transition(barriers[0], &backBuffer, STATE_PRESENT, STATE_COPY_DEST, BARRIER_SPLIT_END));
+    CHECK(is_transition(barriers[1], &image, STATE_UNORDERED_ACCESS, STATE_COPY_SOURCE));
+
+    // Back to PRESENT is an ordinary transition.
+    tracker.transition(&backBuffer, STATE_PRESENT);
+    tracker.transition(&image, STATE_UNORDERED_ACCESS);
+    barriers = tracker.flush();
+    CHECK(barriers.size() == 2);
+    CHECK(is_transition(barriers[0], &backBuffer, STATE_COPY_DEST, STATE_PRESENT));
+    CHECK(is_transition(barriers[1], &image, STATE_COPY_SOURCE, STATE_UNORDERED_ACCESS));
+
+    // A split that ends in another state is ended and followed by a transition.
+    tracker.beginTransition(&backBuffer, STATE_COPY_DEST);
+    tracker.flush();
+    tracker.transition(&backBuffer, STATE_RENDER_TARGET);
+    barriers = tracker.flush();
+    CHECK(barriers.size() == 2);
+    CHECK(is_transition(barriers[0], &backBuffer, STATE_PRESENT, STATE_COPY_DEST, BARRIER_SPLIT_END));
+    CHECK(is_transition(barriers[1], &backBuffer, STATE_COPY_DEST, STATE_RENDER_TARGET));
+}
+
+static void test_uav_barriers()
+{
+    ResourceStateTracker tracker;
+    tracker.track(&image, 1, STATE_UNORDERED_ACCESS);
+    tracker.track(&buffer, 1, STATE_UNORDERED_ACCESS);
+
+    // Asked for twice, emitted once, after the transitions.
+    tracker.uavBarrier(&image);
+    tracker.uavBarrier(&image);
+    tracker.transition(&texture, STATE_COPY_DEST);
+    std::vector<ResourceBarrier> barriers = tracker.flush();
+    CHECK(barriers.size() == 2);
+    CHECK(barriers[0].type == BARRIER_TRANSITION && barriers[0].resource == &texture);
+    CHECK(barriers[1].type == BARRIER_UAV && barriers[1].resource == &image);
+
+    // A resource that transitions in the batch needs no UAV barrier.
+    tracker.uavBarrier(&buffer);
+    tracker.transition(&buffer, STATE_COPY_SOURCE);
+    barriers = tracker.flush();
+    CHECK(barriers.size() == 1);
+    CHECK(is_transition(barriers[0], &buffer, STATE_UNORDERED_ACCESS, STATE_COPY_SOURCE));
+
+    // But one whose transition turns out a no-op still does.
+    tracker.uavBarrier(&image);
+    tracker.transition(&image, STATE_UNORDERED_ACCESS);
+    barriers = tracker.flush();
+    CHECK(barriers.size() == 1);
+    CHECK(barriers[0].type == BARRIER_UAV && barriers[0].resource == &image);
+}
+
+static void test_flush()
+{
+    ResourceStateTracker tracker;
+    tracker.track(&texture, 1, STATE_COPY_DEST);
+
+    // Requests only take effect at flush, and a flush clears them.
+    tracker.transition(&texture, STATE_PIXEL_SHADER_RESOURCE);
+    tracker.uavBarrier(&image);
+    CHECK(tracker.state(&texture) == STATE_COPY_DEST);
+    CHECK(tracker.flush().size() == 2);
+    CHECK(tracker.state(&texture) == STATE_PIXEL_SHADER_RESOURCE);
+    CHECK(tracker.flush().empty());
+
+    // Barriers come out in order of each resource's first request.
+    tracker.track(&buffer, 1, STATE_COMMON);
+    tracker.transition(&buffer, STATE_COPY_DEST);
+    tracker.transition(&texture, STATE_COPY_DEST);
+    tracker.transition(&buffer, STATE_COPY_SOURCE);
+    std::vector<ResourceBarrier> barriers = tracker.flush();
+    CHECK(barriers.size() == 2);
+    CHECK(barriers[0].resource == &buffer && barriers[1].resource == &texture);
+
+    // A forgotten resource starts over in COMMON.
+    tracker.forget(&texture);
+    CHECK(tracker.state(&texture) == STATE_COMMON);
+}
+
+int main()
+{
+    test_read_states_combine();
+    test_no_op_transitions();
+    test_subresources();
+    test_back_buffer_split();
+    test_uav_barriers();
+    test_flush();
+    return test_result();
+}
@@ -0,0 +1,165 @@
+#include "Check.hpp"
+#include "ShaderCache.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+static const std::string directory = "shader-cache-test";
+
+// Compiles by concatenating what it was given, reading an include when the
+// source names one, and counts how often it ran.
+struct FakeCompiler : ShaderCompiler
+{
+    std::string versionString = "fake 1";
+    int compileCount = 0;
+
+    std::string version() override { return versionString; }
+
+    bool compile(const ShaderCompileRequest& request, const std::string& source,
+        std::vector<uint8_t>& bytecode, std::vector<std::string>& includes, std::string& errors) override
+    {
+        compileCount++;
+        if (source.find("error") != std::string::npos) {
+            errors = "syntax error";
+            return false;
+        }
+        std::string output = versionString + request.profile + source;
+        for (const ShaderDefine& define : request.defines)
+            output += define.name + "=" + define.value;
+        if (source.find("#include") != std::string::npos) {
+            includes.push_back(directory + "/common.hlsli");
+            std::ifstream is(includes.back(), std::ios_base::binary);
+            output.append(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+        }
+        bytecode.assign(output.begin(), output.end());
+        return true;
+    }
+};
+
+static void write_file(const std::string& filename, const std::string& contents)
+{
+    std::ofstream(filename, std::ios_base::binary) << contents;
+}
+
+static std::string read_file(const std::string& filename)
+{
+    std::ifstream is(filename, std::ios_base::binary);
+    return std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+}
+
+static void test_cache()
+{
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    const std::string source = "#include \"common.hlsli\"\nvoid RayGen() {}\n";
+    write_file(directory + "/lib.hlsl", source);
+    write_file(directory + "/common.hlsli", "// v1\n");
+
+    FakeCompiler compiler;
+    ShaderCache cache;
+    cache.directory = directory;
+    cache.compiler = &compiler;
+    ShaderCompileRequest request = { directory + "/lib.hlsl", "", "lib_6_3", {} };
+    std::vector<uint8_t> first, second;
+    std::string errors;
+
+    // Compiled once, then a hit with the same bytes.
+    CHECK(cache.load(request, first, errors));
+    CHECK(compiler.compileCount == 1 && cache.compiles == 1 && cache.hits == 0);
+    CHECK(cache.load(request, second, errors));
+    CHECK(compiler.compileCount == 1 && cache.hits == 1);
+    CHECK(first == second);
+
+    // A new cache on the same directory, as on the next start, hits too.
+    ShaderCache restarted = cache;
+    restarted.hits = 0;
+    CHECK(restarted.load(request, second, errors) && restarted.hits == 1);
+
+    // Changing the include's contents makes the entry stale.
+    write_file(directory + "/common.hlsli", "// v2\n");
+    CHECK(cache.load(request, second, errors));
+    CHECK(compiler.compileCount == 2 && cache.rejected == 1);
+    CHECK(first != second);
+    CHECK(cache.load(request, first, errors) && compiler.compileCount == 2 && first == second);
+
+    // Empty includes are still files that hash.
+    write_file(directory + "/common.hlsli", "");
+    CHECK(cache.load(request, first, errors) && compiler.compileCount == 3);
+    CHECK(cache.load(request, first, errors) && compiler.compileCount == 3);
+
+    // Defines and the profile are part of the key.
+    request.defines.push_back({ "SAMPLES", "4" });
+    CHECK(cache.load(request, first, errors) && compiler.compileCount == 4);
+    request.defines.clear();
+    request.profile = "lib_6_5";
+    CHECK(cache.load(request, first, errors) && compiler.compileCount == 5);
+    request.profile = "lib_6_3";
+    CHECK(cache.load(request, first, errors) && compiler.compileCount == 5);
+
+    // So is the compiler version.
+    uint64_t oldKey = cache.key(request, source);
+    compiler.versionString = "fake 2";
+    CHECK(cache.key(request, source) != oldKey);
+    CHECK(cache.load(request, first, errors) && compiler.compileCount == 6);
+    CHECK(first.size() >= 6 && std::string(first.begin(), first.begin() + 6) == "fake 2");
+}
+
+static void test_damaged_entries()
+{
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    const std::string source = "void RayGen() {}\n";
+    write_file(directory + "/lib.hlsl", source);
+
+    FakeCompiler compiler;
+    ShaderCache cache;
+    cache.directory = directory;
+    cache.compiler = &compiler;
+    ShaderCompileRequest request = { directory + "/lib.hlsl", "", "lib_6_3", {} };
+    std::vector<uint8_t> expected, bytecode;
+    std::string errors;
+    CHECK(cache.load(request, expected, errors));
+    std::string entry = cache.entryFilename(cache.key(request, source));
+    CHECK(entry.size() > 5 && entry.compare(entry.size() - 5, 5, ".dxil") == 0);
+    std::string good = read_file(entry);
+    CHECK(good.size() > sizeof(ShaderCacheFileHeader));
+
+    // A flipped byte in the bytecode fails the content hash; the entry is
+    // rejected, compiled again and replaced.
+    std::string flipped = good;
+    flipped[flipped.size() - 2] ^= 0x20;
+    write_file(entry, flipped);
+    CHECK(cache.load(request, bytecode, errors));
+    CHECK(bytecode == expected);
+    CHECK(compiler.compileCount == 2 && cache.rejected == 1);
+    CHECK(read_file(entry) == good);
+    CHECK(cache.load(request, bytecode, errors) && compiler.compileCount == 2);
+
+    // So is a flipped byte in the header, and a truncated file.
+    std::string header = good;
+    header[sizeof(uint32_t) * 2] ^= 1;
+    write_file(entry, header);
+    CHECK(cache.load(request, bytecode, errors) && compiler.compileCount == 3 && cache.rejected == 2);
+    write_file(entry, good.substr(0, good.size() - 3));
+    CHECK(cache.load(request, bytecode, errors) && compiler.compileCount == 4 && cache.rejected == 3);
+    CHECK(bytecode == expected);
+
+    // Compile errors come back and nothing is cached.
+    write_file(directory + "/bad.hlsl", "error");
+    ShaderCompileRequest bad = { directory + "/bad.hlsl", "", "lib_6_3", {} };
+    CHECK(!cache.load(bad, bytecode, errors) && errors == "syntax error");
+    CHECK(!cache.load(bad, bytecode, errors) && compiler.compileCount == 6);
+
+    ShaderCompileRequest missing = { directory + "/missing.hlsl", "", "lib_6_3", {} };
+    CHECK(!cache.load(missing, bytecode, errors) && compiler.compileCount == 6);
+
+    std::filesystem::remove_all(directory);
+}
+
+int main()
+{
+    test_cache();
+    test_damaged_entries();
+    return test_result();
+}
@@ -0,0 +1,140 @@
+#include "Check.hpp"
+#include "ShaderTable.hpp"
+
+#include <string.h>
+
+// Fake shader identifiers: 32 bytes that tell the records apart.
+static const uint8_t* fake_identifier(uint8_t value)
+{
+    static uint8_t identifiers[256][shaderIdentifierSize];
+    memset(identifiers[value], value, shaderIdentifierSize);
+    return identifiers[value];
+}
+
+static void test_layout()
+{
+    ShaderTable table;
+    uint64_t address = 0x1234;
+    CHECK(table.addRayGen(fake_identifier(1)) == 0);
+    CHECK(table.addMiss(fake_identifier(2)) == 0);
+    CHECK(table.addMiss(fake_identifier(3)) == 1);
+    // Hit groups with an 8-byte and a 16-byte local root argument.
+    CHECK(table.addHitGroup(fake_identifier(4), &address, 8) == 0);
+    uint64_t twoAddresses[2] = { 1, 2 };
+    CHECK(table.addHitGroup(fake_identifier(5), twoAddresses, 16) == 1);
+    CHECK(table.addHitGroup(fake_identifier(6)) == 2);
+
+    ShaderTableLayout layout;
+    CHECK(table.layout(layout));
+    // A bare identifier takes 32 bytes and arguments round the stride up to
+    // the next 32; raygen records take 64 since each starts a table. Tables
+    // start on 64 bytes.
+    CHECK(layout.rayGen.offset == 0 && layout.rayGen.stride == 64 && layout.rayGen.size == 64);
+    CHECK(layout.miss.offset == 64 && layout.miss.stride == 32 && layout.miss.size == 64);
+    CHECK(layout.hitGroup.offset == 128 && layout.hitGroup.stride == 64 && layout.hitGroup.size == 192);
+    CHECK(layout.size == 320);
+    CHECK(layout.miss.offset % shaderTableAlignment == 0 && layout.hitGroup.offset % shaderTableAlignment == 0);
+}
+
+static void test_table_alignment()
+{
+    // Three 32-byte miss records from 64 end on 160; the hit groups start at 192.
+    ShaderTable table;
+    table.addRayGen(fake_identifier(1));
+    for (int i = 0; i < 3; i++)
+        table.addMiss(fake_identifier(2));
+    table.addHitGroup(fake_identifier(3));
+    ShaderTableLayout layout;
+    CHECK(table.layout(layout));
+    CHECK(layout.miss.offset == 64 && layout.miss.size == 96);
+    CHECK(layout.hitGroup.offset == 192 && layout.hitGroup.stride == 32);
+    CHECK(layout.size == 224);
+
+    // An empty table still has somewhere to point.
+    ShaderTable empty;
+    empty.addRayGen(fake_identifier(1));
+    CHECK(empty.layout(layout));
+    CHECK(layout.miss.size == 0 && layout.miss.stride == 0);
+    CHECK(layout.hitGroup.size == 0);
+}
+
+static void test_max_stride()
+{
+    std::vector<uint8_t> arguments(maxShaderRecordStride - shaderIdentifierSize, 7);
+    ShaderTableLayout layout;
+
+    ShaderTable fits;
+    fits.addRayGen(fake_identifier(1));
+    fits.addHitGroup(fake_identifier(2), arguments.data(), arguments.size());
+    CHECK(fits.layout(layout));
+    CHECK(layout.hitGroup.stride == maxShaderRecordStride);
+
+    std::vector<uint8_t> oversized(arguments.size() + 1, 7);
+    ShaderTable tooLarge;
+    tooLarge.addRayGen(fake_identifier(1));
+    tooLarge.addMiss(fake_identifier(2), oversized.data(), oversized.size());
+    CHECK(!tooLarge.layout(layout));
+}
+
+static void test_several_raygen_records()
+{
+    ShaderTable table;
+    uint32_t constant = 5;
+    table.addRayGen(fake_identifier(1));
+    CHECK(table.addRayGen(fake_identifier(2), &constant, 4) == 1);
+    table.addRayGen(fake_identifier(3));
+    table.addMiss(fake_identifier(4));
+
+    ShaderTableLayout layout;
+    CHECK(table.layout(layout));
+    // Every raygen record starts a table of its own.
+    CHECK(layout.rayGen.stride == 64);
+    CHECK(layout.miss.offset == 192);
+    for (uint32_t i = 0; i < 3; i++) {
+        ShaderTableRange range = table.rayGenRecord(layout, i);
+        CHECK(range.offset == i * 64 && range.size == 64);
+        CHECK(range.offset % shaderTableAlignment == 0);
+    }
+
+    std::vector<uint8_t> data(layout.size, 0xcd);
+    table.write(layout, data.data());
+    ShaderTableRange second = table.rayGenRecord(layout, 1);
+    CHECK(data[second.offset] == 2);
+    uint32_t written;
+    memcpy(&written, &data[second.offset + shaderIdentifierSize], 4);
+    CHECK(written == 5);
+}
+
+static void test_write_zeroes_padding()
+{
+    ShaderTable table;
+    uint64_t argument = 0x0102030405060708ull;
+    table.addRayGen(fake_identifier(1));
+    table.addMiss(fake_identifier(2));
+    table.addHitGroup(fake_identifier(3), &argument, 8);
+    table.addHitGroup(fake_identifier(4));
+
+    ShaderTableLayout layout;
+    CHECK(table.layout(layout));
+    // Start from garbage; only identifiers and arguments may be nonzero.
+    std::vector<uint8_t> data(layout.size, 0xcd);
+    table.write(layout, data.data());
+
+    std::vector<uint8_t> expected(layout.size, 0);
+    memset(&expected[layout.rayGen.offset], 1, shaderIdentifierSize);
+    memset(&expected[layout.miss.offset], 2, shaderIdentifierSize);
+    memset(&expected[layout.hitGroup.offset], 3, shaderIdentifierSize);
+    memcpy(&expected[layout.hitGroup.offset + shaderIdentifierSize], &argument, 8);
+    memset(&expected[layout.hitGroup.offset + layout.hitGroup.stride], 4, shaderIdentifierSize);
+    CHECK(data == expected);
+}
+
+int main()
+{
+    test_layout();
+    test_table_alignment();
+    test_max_stride();
+    test_several_raygen_records();
+    test_write_zeroes_padding();
+    return test_result();
+}
@@ -0,0 +1,124 @@
+#include "Check.hpp"
+#include "EnvMap.hpp"
+#include "Texture.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <string.h>
+#include <vector>
+
+// Baked files are opened by the source name; with no source next to them,
+// a well-formed .tex is used as is.
+static const char* sourceName = "texture-test.png";
+static const char* bakedName = "texture-test.png.tex";
+
+struct TestFile
+{
+    TextureFileHeader header = {};
+    std::vector<TextureMip> mips;
+    std::vector<float> texels;
+};
+
+// A width x height RGB32F texture with a full mip chain, laid out as
+// bake_texture writes it.
+static TestFile make_file(uint32_t width, uint32_t height, uint32_t levels)
+{
+    TestFile f;
+    memcpy(f.header.magic, "RTEX", 4);
+    f.header.version = 1;
+    f.header.format = TEXTURE_FORMAT_RGB32F;
+    f.header.width = width;
+    f.header.height = height;
+    f.header.mipLevels = levels;
+    uint64_t offset = sizeof(TextureFileHeader) + levels * sizeof(TextureMip);
+    for (uint32_t level = 0; level < levels; level++) {
+        TextureMip mip = { offset, std::max(width >> level, 1u), std::max(height >> level, 1u) };
+        f.mips.push_back(mip);
+        offset += (uint64_t)mip.width * mip.height * 3 * sizeof(float);
+    }
+    f.texels.resize((offset - f.mips[0].offset) / sizeof(float), 0.5f);
+    return f;
+}
+
+static void write_file(const TestFile& f)
+{
+    std::ofstream os(bakedName, std::ios_base::binary);
+    os.write((const char*)&f.header, sizeof(f.header));
+    os.write((const char*)f.mips.data(), f.mips.size() * sizeof(TextureMip));
+    os.write((const char*)f.texels.data(), f.texels.size() * sizeof(float));
+}
+
+static bool opens(const TestFile& f, bool mipmaps = false)
+{
+    write_file(f);
+    BakedTexture texture;
+    return texture.open(sourceName, mipmaps);
+}
+
+static void test_valid_files()
+{
+    CHECK(opens(make_file(8, 4, 1)));
+    CHECK(opens(make_file(8, 4, 4), true));
+    CHECK(opens(make_file(1, 1, 1)));
+    CHECK(opens(make_file(1, 1, 1), true));
+    CHECK(opens(make_file(5, 3, 3), true));
+
+    EnvMap env;
+    write_file(make_file(8, 4, 1));
+    CHECK(env.load(sourceName));
+    CHECK(env.width == 8 && env.height == 4 && env.texels.size() == 8 * 4 * 3);
+}
+
+static void test_damaged_files()
+{
+    // Mip 0 larger than the header says: its rows would be read past the
+    // end of the file's data.
+    TestFile f = make_file(8, 4, 1);
+    f.mips[0].width = 64;
+    CHECK(!opens(f));
+    EnvMap env;
+    CHECK(!env.load(sourceName));
+
+    f = make_file(8, 4, 1);
+    f.header.height = 400;
+    CHECK(!opens(f));
+
+    // Levels that do not halve.
+    f = make_file(8, 4, 4);
+    f.mips[1].width = 8;
+    CHECK(!opens(f, true));
+    f = make_file(8, 4, 4);
+    f.mips[2].height = 0;
+    CHECK(!opens(f, true));
+
+    // More levels than the chain has, a truncated chain, and a chain where
+    // none was asked for.
+    f = make_file(8, 4, 4);
+    f.header.mipLevels = 5;
+    CHECK(!opens(f, true));
+    CHECK(!opens(make_file(8, 4, 3), true));
+    CHECK(!opens(make_file(8, 4, 1), true));
+    CHECK(!opens(make_file(8, 4, 4)));
+
+    // Empty, truncated and misplaced data.
+    f = make_file(8, 4, 1);
+    f.header.width = 0;
+    CHECK(!opens(f));
+    f = make_file(8, 4, 1);
+    f.texels.pop_back();
+    CHECK(!opens(f));
+    f = make_file(8, 4, 1);
+    f.mips[0].offset += 2;
+    CHECK(!opens(f));
+    f = make_file(8, 4, 1);
+    f.mips[0].offset = ~0ull - 8;
+    CHECK(!opens(f));
+}
+
+int main()
+{
+    test_valid_files();
+    test_damaged_files();
+    remove(bakedName);
+    return test_result();
+}
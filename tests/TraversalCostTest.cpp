@@ -0,0 +1,97 @@
+#include "Check.hpp"
+#include "CpuRenderer.hpp"
+
+static void add_triangle(Mesh& mesh, float3 a, float3 b, float3 c)
+{
+    for (float3 p : { a, b, c }) {
+        mesh.indices.push_back((uint32_t)mesh.verts.size());
+        mesh.verts.push_back({ { p.x, p.y, p.z }, { 0.0f, 0.0f, -1.0f }, { 0.0f, 0.0f } });
+    }
+}
+
+// A square in the middle of a 64x48 view, wound both ways so that one pair of
+// triangles faces the camera whichever winding counts as front.
+static void test_cost_map()
+{
+    Mesh mesh;
+    float3 p00 = { -1.0f, -1.0f, 0.0f }, p10 = { 1.0f, -1.0f, 0.0f }, p01 = { -1.0f, 1.0f, 0.0f }, p11 = { 1.0f, 1.0f, 0.0f };
+    add_triangle(mesh, p00, p10, p11);
+    add_triangle(mesh, p00, p11, p01);
+    add_triangle(mesh, p00, p11, p10);
+    add_triangle(mesh, p00, p01, p11);
+    Bvh bvh;
+    bvh.build(mesh);
+
+    Scene scene;
+    scene.meshes.push_back(&bvh);
+    Instance instance = {};
+    instance.transform.m[0][0] = instance.transform.m[1][1] = instance.transform.m[2][2] = 1.0f;
+    scene.instances.push_back(instance);
+    scene.build();
+
+    EnvMap envMap;
+    envMap.width = 2;
+    envMap.height = 1;
+    envMap.texels.assign(2 * 1 * 3, 0.5f);
+
+    CpuRenderer renderer;
+    renderer.scene = &scene;
+    renderer.envMap = &envMap;
+    Camera camera = look_at_camera({ 0.0f, 0.0f, -6.0f }, { 0.0f, 0.0f, 0.0f });
+    Image image;
+    image.resize(64, 48);
+    TraversalCostMap costs;
+    renderer.render(camera, image, RENDER_TRACED, &costs);
+    CHECK(costs.width == 64 && costs.height == 48 && costs.pixels.size() == 64 * 48);
+
+    int hits = 0, misses = 0, unvisited = 0;
+    for (int y = 0; y < image.height; y++) {
+        for (int x = 0; x < image.width; x++) {
+            const TraversalCost& cost = costs.pixels[y * image.width + x];
+            Ray ray = { camera.origin, pixel_ray(camera, x, y, image.width, image.height), 0.0001f, 100.0f };
+            float3 invDir = { 1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z };
+            SceneHit hit;
+            if (scene.intersect(ray, CULL_NONE, 0xff, hit)) {
+                // The primary ray and at least one secondary ray.
+                CHECK(cost.nodes > 0 && cost.triangles > 0 && cost.rays >= 2);
+                hits++;
+            } else if (intersect_aabb(ray, invDir, scene.nodes[0]) == 1e30f) {
+                // Pixels in tiles the early-out skipped cast no ray at all.
+                CHECK(cost.nodes == 0 && cost.triangles == 0 && cost.rays <= 1);
+                misses++;
+                unvisited += cost.rays == 0;
+            }
+        }
+    }
+    CHECK(hits > 0 && misses > 0 && unvisited > 0);
+
+    // Every pixel lands in one bucket, and bucket 0 holds the pixels that
+    // entered no node.
+    std::vector<uint32_t> histogram = cost_histogram(costs, COUNT_NODES);
+    uint32_t total = 0;
+    for (uint32_t count : histogram)
+        total += count;
+    CHECK(total == costs.pixels.size());
+    uint32_t zero = 0;
+    for (const TraversalCost& cost : costs.pixels)
+        zero += cost.nodes == 0;
+    CHECK(histogram[0] == zero && histogram.size() > 1);
+
+    // Black exactly where the counter is 0.
+    Image heatmap;
+    cost_heatmap(costs, COUNT_NODES, 0, heatmap);
+    CHECK(heatmap.width == 64 && heatmap.height == 48);
+    bool blackWhereZero = true;
+    for (size_t i = 0; i < costs.pixels.size(); i++) {
+        float3 c = heatmap.pixels[i];
+        bool black = c.x == 0.0f && c.y == 0.0f && c.z == 0.0f;
+        blackWhereZero &= black == (costs.pixels[i].nodes == 0);
+    }
+    CHECK(blackWhereZero);
+}
+
+int main()
+{
+    test_cost_map();
+    return test_result();
+}
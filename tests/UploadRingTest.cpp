@@ -0,0 +1,200 @@
+#include "Check.hpp"
+#include "UploadRing.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// Stands in for an ID3D12Fence and the queue signalling it.
+struct FakeFence
+{
+    uint64_t next = 1;
+    uint64_t completed = 0;
+
+    uint64_t signal() { return next++; }
+    void complete(uint64_t value) { completed = value; }
+};
+
+static void test_allocate_finish_retire()
+{
+    UploadRing ring;
+    FakeFence fence;
+    ring.reset(1024);
+
+    uint64_t a, b;
+    CHECK(ring.allocate(100, 1, a) && a == 0);
+    CHECK(ring.allocate(100, 1, b) && b == 100);
+    CHECK(ring.usedBytes() == 200);
+    CHECK(ring.oldestFence() == 0);
+
+    uint64_t first = fence.signal();
+    ring.finishFrame(first);
+    CHECK(ring.oldestFence() == first);
+
+    // Nothing comes back before the fence completes.
+    ring.retire(fence.completed);
+    CHECK(ring.usedBytes() == 200);
+
+    uint64_t c;
+    CHECK(ring.allocate(50, 1, c) && c == 200);
+    uint64_t second = fence.signal();
+    ring.finishFrame(second);
+
+    fence.complete(first);
+    ring.retire(fence.completed);
+    CHECK(ring.usedBytes() == 50);
+    CHECK(ring.oldestFence() == second);
+
+    fence.complete(second);
+    ring.retire(fence.completed);
+    CHECK(ring.usedBytes() == 0);
+    CHECK(ring.oldestFence() == 0);
+
+    // An empty ring starts over, so all of it is available again.
+    uint64_t whole;
+    CHECK(ring.allocate(1024, 1, whole) && whole == 0);
+}
+
+static void test_empty_frame_keeps_fence()
+{
+    UploadRing ring;
+    ring.reset(256);
+    uint64_t offset;
+    CHECK(ring.allocate(64, 1, offset));
+    ring.finishFrame(1);
+    // A frame with no allocations only moves the newest fence value.
+    ring.finishFrame(2);
+    CHECK(ring.frames.size() == 1);
+    ring.retire(1);
+    CHECK(ring.usedBytes() == 64);
+    ring.retire(2);
+    CHECK(ring.usedBytes() == 0);
+}
+
+static void test_alignment()
+{
+    UploadRing ring;
+    ring.reset(4096);
+    uint64_t offset;
+    CHECK(ring.allocate(3, 1, offset) && offset == 0);
+    CHECK(ring.allocate(8, 16, offset) && offset == 16);
+    CHECK(ring.allocate(1, 256, offset) && offset == 256);
+
+    // Bad alignments, and alignments that do not divide the ring, fail.
+    CHECK(!ring.allocate(8, 0, offset));
+    CHECK(!ring.allocate(8, 24, offset));
+    CHECK(!ring.allocate(8, 8192, offset));
+}
+
+static void test_wrap_around()
+{
+    UploadRing ring;
+    ring.reset(1000);
+    uint64_t a, b, c;
+    CHECK(ring.allocate(400, 1, a) && a == 0);
+    ring.finishFrame(1);
+    CHECK(ring.allocate(400, 1, b) && b == 400);
+    ring.finishFrame(2);
+    ring.retire(1);
+
+    // 300 bytes do not fit in the 200 left at the end, so the allocation
+    // skips them and starts over at 0, where frame 1 was.
+    CHECK(ring.allocate(300, 1, c) && c == 0);
+    CHECK(ring.usedBytes() == 400 + 200 + 300);
+    ring.finishFrame(3);
+
+    ring.retire(2);
+    uint64_t d;
+    CHECK(!ring.allocate(600, 1, d));
+    CHECK(ring.allocate(500, 1, d) && d == 300);
+}
+
+static void test_full()
+{
+    UploadRing ring;
+    FakeFence fence;
+    ring.reset(1024);
+    uint64_t offset;
+
+    CHECK(!ring.allocate(2048, 1, offset));
+
+    CHECK(ring.allocate(512, 256, offset));
+    uint64_t first = fence.signal();
+    ring.finishFrame(first);
+    CHECK(ring.allocate(512, 256, offset));
+    ring.finishFrame(fence.signal());
+
+    // Full until the GPU is done with the oldest frame, which is the fence
+    // the caller waits for.
+    CHECK(!ring.allocate(256, 256, offset));
+    CHECK(ring.oldestFence() == first);
+    fence.complete(ring.oldestFence());
+    ring.retire(fence.completed);
+    CHECK(ring.allocate(256, 256, offset) && offset == 0);
+}
+
+// Frames of random allocations while the fake GPU lags a few frames behind:
+// no two live allocations may overlap.
+static void test_random_frames()
+{
+    struct Live
+    {
+        uint64_t offset, size, fenceValue;
+    };
+
+    const uint64_t capacity = 64 * 1024;
+    UploadRing ring;
+    FakeFence fence;
+    ring.reset(capacity);
+    std::mt19937 rng(1);
+    std::vector<Live> live;
+    std::vector<Live> frame;
+    bool overlap = false, misaligned = false;
+    auto complete = [&](uint64_t value) {
+        fence.complete(value);
+        ring.retire(fence.completed);
+        live.erase(std::remove_if(live.begin(), live.end(), [&](const Live& l) { return l.fenceValue <= value; }),
+            live.end());
+    };
+
+    for (int f = 0; f < 2000; f++) {
+        int count = rng() % 8 + 1;
+        for (int i = 0; i < count; i++) {
+            uint64_t size = rng() % 4000 + 1;
+            uint64_t alignment = rng() % 2 ? 16 : 256;
+            uint64_t offset;
+            while (!ring.allocate(size, alignment, offset))
+                complete(ring.oldestFence());
+            misaligned |= offset % alignment != 0;
+            for (const Live& l : live)
+                overlap |= offset < l.offset + l.size && l.offset < offset + size;
+            for (const Live& l : frame)
+                overlap |= offset < l.offset + l.size && l.offset < offset + size;
+            frame.push_back({ offset, size, 0 });
+        }
+        uint64_t value = fence.signal();
+        ring.finishFrame(value);
+        for (Live& l : frame)
+            l.fenceValue = value;
+        live.insert(live.end(), frame.begin(), frame.end());
+        frame.clear();
+
+        // The GPU finishes up to three frames behind the CPU.
+        uint64_t lag = rng() % 4;
+        if (value > lag && value - lag > fence.completed)
+            complete(value - lag);
+    }
+    CHECK(!overlap);
+    CHECK(!misaligned);
+}
+
+int main()
+{
+    test_allocate_finish_retire();
+    test_empty_frame_keeps_fence();
+    test_alignment();
+    test_wrap_around();
+    test_full();
+    test_random_frames();
+    return test_result();
+}